@@ -19,6 +19,121 @@ vasprintf_reexported (char **strp, const char *fmt, va_list ap) noexcept//@;
 }
 } //@
 
+#include <string.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+char * //@
+strchrnul_reexported (const char *s, int c) noexcept//@;
+{
+  return (char *)strchrnul (s, c);
+}
+} //@
+
+//@ #include <sys/types.h>
+//@ #include <sys/uio.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+ssize_t //@
+preadv2_reexported (int fd, const iovec *iov, int iovcnt, off_t offset, int flags) noexcept//@;
+{
+  return preadv2 (fd, iov, iovcnt, offset, flags);
+}
+
+ssize_t //@
+pwritev2_reexported (int fd, const iovec *iov, int iovcnt, off_t offset, int flags) noexcept//@;
+{
+  return pwritev2 (fd, iov, iovcnt, offset, flags);
+}
+} //@
+
+//@ #include <spawn.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+posix_spawn_file_actions_addchdir_np_reexported (posix_spawn_file_actions_t *file_actions, const char *path) noexcept//@;
+{
+  return posix_spawn_file_actions_addchdir_np (file_actions, path);
+}
+} //@
+
+// Открывает безымянный файл (O_TMPFILE) в директории dirfd на запись
+//@ #include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+open_tmpfile_reexported (int dirfd, mode_t mode) noexcept//@;
+{
+  return openat (dirfd, ".", O_TMPFILE | O_WRONLY | O_CLOEXEC, mode);
+}
+} //@
+
+//@ #include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+sync_file_range_reexported (int fd, off_t offset, off_t nbytes, unsigned int flags) noexcept//@;
+{
+  return sync_file_range (fd, offset, nbytes, flags);
+}
+} //@
+
+//@ #include <sys/types.h>
+//@ #include <cstddef>
+#include <fcntl.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+ssize_t //@
+readahead_reexported (int fd, off_t offset, std::size_t count) noexcept//@;
+{
+  return readahead (fd, offset, count);
+}
+} //@
+
+//@ #include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+fallocate_reexported (int fd, int mode, off_t offset, off_t len) noexcept//@;
+{
+  return fallocate (fd, mode, offset, len);
+}
+} //@
+
+//@ #include <poll.h>
+//@ #include <signal.h>
+//@ #include <time.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+ppoll_reexported (pollfd *fds, nfds_t nfds, const timespec *timeout, const sigset_t *sigmask) noexcept//@;
+{
+  return ppoll (fds, nfds, timeout, sigmask);
+}
+} //@
+
+#include <unistd.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+int //@
+pipe2_reexported (int pipefd[2], int flags) noexcept//@;
+{
+  return pipe2 (pipefd, flags);
+}
+} //@
+
+#include <unistd.h>
+namespace libsh_treis::libc::detail //@
+{ //@
+char ** //@
+environ_reexported (void) noexcept//@;
+{
+  return environ;
+}
+} //@
+
 #include <errno.h>
 namespace libsh_treis::libc::detail //@
 { //@
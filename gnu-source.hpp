@@ -0,0 +1,82 @@
+#pragma once
+#include <stdarg.h>
+namespace libsh_treis::libc::detail
+{
+int
+vasprintf_reexported (char **strp, const char *fmt, va_list ap) noexcept;
+}
+namespace libsh_treis::libc::detail
+{
+char *
+strchrnul_reexported (const char *s, int c) noexcept;
+}
+#include <sys/types.h>
+#include <sys/uio.h>
+namespace libsh_treis::libc::detail
+{
+ssize_t
+preadv2_reexported (int fd, const iovec *iov, int iovcnt, off_t offset, int flags) noexcept;
+ssize_t
+pwritev2_reexported (int fd, const iovec *iov, int iovcnt, off_t offset, int flags) noexcept;
+}
+#include <spawn.h>
+namespace libsh_treis::libc::detail
+{
+int
+posix_spawn_file_actions_addchdir_np_reexported (posix_spawn_file_actions_t *file_actions, const char *path) noexcept;
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::detail
+{
+int
+open_tmpfile_reexported (int dirfd, mode_t mode) noexcept;
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::detail
+{
+int
+sync_file_range_reexported (int fd, off_t offset, off_t nbytes, unsigned int flags) noexcept;
+}
+#include <sys/types.h>
+#include <cstddef>
+namespace libsh_treis::libc::detail
+{
+ssize_t
+readahead_reexported (int fd, off_t offset, std::size_t count) noexcept;
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::detail
+{
+int
+fallocate_reexported (int fd, int mode, off_t offset, off_t len) noexcept;
+}
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+namespace libsh_treis::libc::detail
+{
+int
+ppoll_reexported (pollfd *fds, nfds_t nfds, const timespec *timeout, const sigset_t *sigmask) noexcept;
+}
+namespace libsh_treis::libc::detail
+{
+int
+pipe2_reexported (int pipefd[2], int flags) noexcept;
+}
+namespace libsh_treis::libc::detail
+{
+char **
+environ_reexported (void) noexcept;
+}
+namespace libsh_treis::libc::detail
+{
+char *
+program_invocation_name_reexported (void) noexcept;
+}
+#include <sys/syscall.h>
+namespace libsh_treis::libc::detail
+{
+typedef long (*syscall_reexported_t) (long, ...);
+extern
+constinit const syscall_reexported_t syscall_reexported;
+}
@@ -52,7 +52,9 @@
 // - Если результат read положить в int32_t на 64-разрядной машине, то компилятор не может вывести, что этот результат >= -1. Поэтому нужно использовать int64_t либо "подсказать" компилятору правильный интервал для значения. См. https://github.com/llvm/llvm-project/issues/43705
 // - В wc -l при чтении из пайпа оптимальный размер буфера - это размер пайпа, даже если он изменён. Скорость не падает от использования runtime-значения для размера буфера
 // - В wc -l при чтении из пайпа буфер должен иметь выравнивание 32 байта. Причина такого значения не известна
-// - Не исследовано: vmsplice ("So you could do a very efficient "stdio-like" implementation for logging"), st_blksize, O_DIRECT, pipe (O_DIRECT), самому устанавливать размер пайпа с помощью F_SETPIPE_SZ, __builtin_assume_aligned, big/huge pages, io_uring, async, non-blocking, функции со словом advise в названии
+// - Результат: libsh_treis::libc::input_buffer (замена fgetc поверх fd) и libsh_treis::libc::output_buffer (замена fputc поверх fd)
+// - Не исследовано: vmsplice ("So you could do a very efficient "stdio-like" implementation for logging"), st_blksize, O_DIRECT, pipe (O_DIRECT), самому устанавливать размер пайпа с помощью F_SETPIPE_SZ, __builtin_assume_aligned, big/huge pages, io_uring, async, non-blocking
+// - Функции со словом advise в названии: обёрнуты в x_posix_fadvise и x_madvise. Большое последовательное чтение (например, ночной проход по логам) вытесняет из page cache рабочий набор. Чтобы этого не было, есть sequential_scan: WILLNEED впереди позиции чтения, DONTNEED позади
 
 // Build systems
 // - Провёл большое исследование систем сборки. Отбрасывал те, где нет базовой функциональности make и где нет того include, который нужен мне (т. е. конвертирующего пути). Результат:
@@ -145,12 +147,141 @@ x_strerror_l (int errnum, locale_t locale)//@;
 }
 } //@
 
-// В glibc locale_t - это указатель, поэтому, согласно моему code style, следовало бы написать (locale_t)nullptr, а не (locale_t)0. Тем не менее, мне не удалось найти в POSIX подтверждение тому, что locale_t - это указатель, поэтому (locale_t)0
+// Исключение, которое бросают THROW_ERRNO и THROW_ERRNO_MESSAGE. Конструктор ничего не выделяет в куче: хранит errno, указатель на __PRETTY_FUNCTION__ (это static строка) и копию сообщения (обычно пути) во встроенном буфере. Слишком длинное сообщение обрезается, в конце ставится "..."
+// Строка для what () (та же, что раньше собиралась из std::string'ов: "функция: сообщение: strerror") форматируется в куче при первом вызове what (). Так исключение, которое ловят и обрабатывают по error_number (), не форматирует строк и не выделяет памяти сверх самого объекта исключения (а он около 300 байт). Если памяти для what () не хватило, what () возвращает имя функции
+//@ #include <atomic>
+//@ #include <stdexcept>
+//@ #include <string_view>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class errno_error : public std::runtime_error
+//@ {
+//@   int _errnum;
+//@   const char *_function;
+//@   char _message[256];
+//@
+//@   // nullptr, пока what () ещё не вызывали. Выделяется new[]
+//@   mutable std::atomic<char *> _what;
+//@
+//@ public:
+//@   explicit errno_error (int errnum, const char *function) noexcept;
+//@
+//@   explicit errno_error (int errnum, const char *function, std::string_view message) noexcept;
+//@
+//@   errno_error (const errno_error &other) noexcept;
+//@
+//@   errno_error &
+//@   operator= (const errno_error &) = delete;
+//@
+//@   ~errno_error (void) override;
+//@
+//@   int
+//@   error_number (void) const noexcept
+//@   {
+//@     return _errnum;
+//@   }
+//@
+//@   const char *
+//@   function (void) const noexcept
+//@   {
+//@     return _function;
+//@   }
+//@
+//@   const char *
+//@   message (void) const noexcept
+//@   {
+//@     return _message;
+//@   }
+//@
+//@   const char *
+//@   what (void) const noexcept override;
+//@ };
+//@ }
+
+#include <new>
+namespace libsh_treis::libc
+{
+errno_error::errno_error (int errnum, const char *function) noexcept : errno_error (errnum, function, std::string_view ())
+{
+}
+
+errno_error::errno_error (int errnum, const char *function, std::string_view message) noexcept : std::runtime_error (""), _errnum (errnum), _function (function), _what (nullptr)
+{
+  if (message.size () < sizeof (_message))
+    {
+      message.copy (_message, message.size ());
+      _message[message.size ()] = '\0';
+    }
+  else
+    {
+      message.copy (_message, sizeof (_message) - 4);
+      memcpy (_message + sizeof (_message) - 4, "...", 4);
+    }
+}
+
+errno_error::errno_error (const errno_error &other) noexcept : std::runtime_error (other), _errnum (other._errnum), _function (other._function), _what (nullptr)
+{
+  memcpy (_message, other._message, sizeof (_message));
+}
+
+errno_error::~errno_error (void)
+{
+  delete[] _what.load (std::memory_order_acquire);
+}
+
+const char *
+errno_error::what (void) const noexcept
+{
+  char *result = _what.load (std::memory_order_acquire);
+
+  if (result != nullptr)
+    {
+      return result;
+    }
+
+  // В glibc locale_t - это указатель, поэтому, согласно моему code style, следовало бы написать (locale_t)nullptr, а не (locale_t)0. Тем не менее, мне не удалось найти в POSIX подтверждение тому, что locale_t - это указатель, поэтому (locale_t)0
+  const char *error = strerror_l (_errnum, (locale_t)0);
+
+  if (error == nullptr)
+    {
+      error = "Unknown error";
+    }
+
+  const char *separator = _message[0] == '\0' ? "" : ": ";
+  int size = snprintf (nullptr, 0, "%s: %s%s%s", _function, _message, separator, error);
+
+  if (size < 0)
+    {
+      return _function;
+    }
+
+  result = new (std::nothrow) char[size + 1];
+
+  if (result == nullptr)
+    {
+      return _function;
+    }
+
+  snprintf (result, size + 1, "%s: %s%s%s", _function, _message, separator, error);
+
+  // Один и тот же объект (например, через std::exception_ptr) может попасть в несколько потоков сразу. Тогда строку форматируют несколько из них, но сохраняется только первая
+  char *expected = nullptr;
+
+  if (!_what.compare_exchange_strong (expected, result, std::memory_order_acq_rel, std::memory_order_acquire))
+    {
+      delete[] result;
+      return expected;
+    }
+
+  return result;
+}
+}
+
 #define THROW_ERRNO \
   do \
     { \
       int saved_errno = errno; \
-      throw std::runtime_error (__PRETTY_FUNCTION__ + ": "s + x_strerror_l (saved_errno, (locale_t)0)); \
+      throw libsh_treis::libc::errno_error (saved_errno, __PRETTY_FUNCTION__); \
     } \
   while (false)
 
@@ -159,7 +290,7 @@ x_strerror_l (int errnum, locale_t locale)//@;
   do \
     { \
       int saved_errno = errno; \
-      throw std::runtime_error (__PRETTY_FUNCTION__ + ": "s + (m) + ": "s + x_strerror_l (saved_errno, (locale_t)0)); \
+      throw libsh_treis::libc::errno_error (saved_errno, __PRETTY_FUNCTION__, (m)); \
     } \
   while (false)
 
@@ -302,18 +433,17 @@ main_helper (const std::function<void(void)> &func) noexcept//@;
 //@ };
 //@ }
 
+// Нулевые байты ищем с помощью memchr, а не циклом: в glibc memchr векторизован и в runtime'е выбирает реализацию (SSE2, AVX2, EVEX...), на длинных строках это в разы быстрее
 //@ #include <cstddef>
+#include <string.h>
 namespace libsh_treis::tools //@
 { //@
 cstring_span //@
 make_cstring_span (char *data, std::size_t size)//@;
 {
-  for (std::ptrdiff_t i = 0; i != (std::ptrdiff_t)size; ++i)
+  if (memchr (data, '\0', size) != nullptr)
     {
-      if (data[i] == '\0')
-        {
-          _LIBSH_TREIS_THROW_MESSAGE ("Embedded null bytes");
-        }
+      _LIBSH_TREIS_THROW_MESSAGE ("Embedded null bytes");
     }
 
   if (data[size] != '\0')
@@ -399,18 +529,18 @@ x_read (int fildes, std::span<std::byte> buf)//@;
 }
 } //@
 
-// Сбрасывает err flag перед вызовом getc
-//@ #include <stdio.h>
+// iovec'и передаются как есть, поэтому их не должно быть больше IOV_MAX
+//@ #include <sys/types.h> // ssize_t
+//@ #include <sys/uio.h>
+//@ #include <span>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_fgetc (FILE *stream)//@;
+ssize_t //@
+x_writev (int fildes, std::span<const iovec> iov)//@;
 {
-  clearerr (stream);
-
-  int result = getc (stream);
+  ssize_t result = writev (fildes, iov.data (), iov.size ());
 
-  if (result == EOF && ferror (stream))
+  if (result == -1)
     {
       THROW_ERRNO;
     }
@@ -419,18 +549,18 @@ x_fgetc (FILE *stream)//@;
 }
 } //@
 
-// Сбрасывает err flag перед вызовом getchar
-#include <stdio.h>
+// iovec'и передаются как есть, поэтому их не должно быть больше IOV_MAX
+//@ #include <sys/types.h> // ssize_t
+//@ #include <sys/uio.h>
+//@ #include <span>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_getchar_nunu (void)//@;
+ssize_t //@
+x_readv (int fildes, std::span<const iovec> iov)//@;
 {
-  clearerr (stdin);
+  ssize_t result = readv (fildes, iov.data (), iov.size ());
 
-  int result = getchar ();
-
-  if (result == EOF && ferror (stdin))
+  if (result == -1)
     {
       THROW_ERRNO;
     }
@@ -439,281 +569,358 @@ x_getchar_nunu (void)//@;
 }
 } //@
 
-// Сбрасывает err flag перед вызовом getdelim
-// По-хорошему надо вернуть std::unique_ptr<std::span<char>>, но я решил возвращать просто ssize_t, т. к. в пользовательском коде я всё равно вряд ли буду вызывать эту функцию. Использоваться она будет лишь для дальнейших обёрток, а там важна максимальная производительность
-// no_raii, потому что нужен free
-//@ #include <sys/types.h> // size_t, ssize_t
-//@ #include <stdio.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-ssize_t //@
-x_getdelim (char **lineptr, size_t *n, int delimiter, FILE *stream)//@;
-{
-  clearerr (stdin);
+// Результат try_-функций (аналог std::expected, которого нет в C++20): либо значение, либо errno. errno бывает только EAGAIN (он же EWOULDBLOCK) или EINTR, т. е. случаи, когда операцию надо просто повторить позже. Настоящие ошибки по-прежнему бросаются исключением, с тем же текстом, что и у x_-функций
+// Нужно для неблокирующих fd: на "would block" не создаётся исключение (а THROW_ERRNO - это строчка из __PRETTY_FUNCTION__, strerror_l и раскрутка стека)
+//@ #include <cassert>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename T> class try_result
+//@ {
+//@   T _value;
+//@   int _error;
 
-  ssize_t result = getdelim (lineptr, n, delimiter, stream);
+//@   explicit try_result (T value, int error) noexcept : _value (value), _error (error)
+//@   {
+//@   }
 
-  if (result == -1 && ferror (stream))
-    {
-      THROW_ERRNO;
-    }
+//@ public:
+//@   static try_result
+//@   success (T value) noexcept
+//@   {
+//@     return try_result (value, 0);
+//@   }
 
-  return result;
-}
-} //@
+//@   static try_result
+//@   failure (int error) noexcept
+//@   {
+//@     assert (error != 0);
+//@     return try_result (T (), error);
+//@   }
 
-// Сбрасывает err flag перед вызовом функции из libc
-//@ #include <sys/types.h> // size_t, ssize_t
-//@ #include <stdio.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-ssize_t //@
-x_getline (char **lineptr, size_t *n, FILE *stream)//@;
+//@   bool
+//@   has_value (void) const noexcept
+//@   {
+//@     return _error == 0;
+//@   }
+
+//@   explicit operator bool (void) const noexcept
+//@   {
+//@     return has_value ();
+//@   }
+
+//@   T
+//@   value (void) const noexcept
+//@   {
+//@     assert (has_value ());
+//@     return _value;
+//@   }
+
+//@   int
+//@   error (void) const noexcept
+//@   {
+//@     assert (!has_value ());
+//@     return _error;
+//@   }
+//@ };
+//@ }
+
+// На Linux EWOULDBLOCK == EAGAIN, но POSIX этого не гарантирует
+#include <errno.h>
+namespace libsh_treis::libc::detail
 {
-  return x_getdelim (lineptr, n, '\n', stream);
+bool
+is_retryable_errno (int err) noexcept
+{
+  return err == EAGAIN || err == EWOULDBLOCK || err == EINTR;
+}
 }
-} //@
 
-// Инклудит хедер для O_RDONLY и тому подобных
-// Называем именно x_open_2, а не x_open2, т. к. в ядре Linux существует системный вызов openat2
-//@ #include <fcntl.h>
-namespace libsh_treis::libc::no_raii //@
+// Макрос, а не функция, чтобы __PRETTY_FUNCTION__ в тексте исключения был тот же, что у соответствующей x_-функции (т. е. имя try_-функции)
+#define TRY_RETURN_ERRNO(T) \
+  do \
+    { \
+      if (libsh_treis::libc::detail::is_retryable_errno (errno)) \
+        { \
+          return try_result<T>::failure (errno); \
+        } \
+      THROW_ERRNO; \
+    } \
+  while (false)
+
+//@ #include <cstddef>
+//@ #include <sys/types.h>
+//@ #include <span>
+#include <unistd.h>
+namespace libsh_treis::libc //@
 { //@
-int //@
-x_open_2 (const char *path, int oflag)//@;
+try_result<ssize_t> //@
+try_read (int fildes, std::span<std::byte> buf)//@;
 {
-  LIBSH_TREIS_ASSERT (!((oflag & O_CREAT) == O_CREAT || (oflag & O_TMPFILE) == O_TMPFILE));
-
-  int result = open (path, oflag);
+  ssize_t result = read (fildes, buf.data (), buf.size ());
 
   if (result == -1)
     {
-      THROW_ERRNO_MESSAGE (path);
+      TRY_RETURN_ERRNO (ssize_t);
     }
 
-  return result;
+  return try_result<ssize_t>::success (result);
 }
-} //@
 
-// Инклудит хедер для O_RDONLY и тому подобных
-//@ #include <sys/types.h>
-//@ #include <fcntl.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-int //@
-x_open_3 (const char *path, int oflag, mode_t mode)//@;
+try_result<ssize_t> //@
+try_write (int fildes, std::span<const std::byte> buf)//@;
 {
-  int result = open (path, oflag, mode);
+  ssize_t result = write (fildes, buf.data (), buf.size ());
 
   if (result == -1)
     {
-      THROW_ERRNO_MESSAGE (path);
+      TRY_RETURN_ERRNO (ssize_t);
     }
 
-  return result;
+  return try_result<ssize_t>::success (result);
 }
 } //@
 
-#include <unistd.h>
+// iovec'и передаются как есть, поэтому их не должно быть больше IOV_MAX
+//@ #include <cstddef>
+//@ #include <sys/types.h>
+//@ #include <sys/uio.h>
+//@ #include <span>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_close (int fildes)//@;
+try_result<ssize_t> //@
+try_readv (int fildes, std::span<const iovec> iov)//@;
 {
-  if (close (fildes) == -1)
+  ssize_t result = readv (fildes, iov.data (), iov.size ());
+
+  if (result == -1)
     {
-      THROW_ERRNO;
+      TRY_RETURN_ERRNO (ssize_t);
     }
+
+  return try_result<ssize_t>::success (result);
 }
-} //@
 
-//@ #include <stdarg.h>
-#include <stdio.h>
-namespace libsh_treis::libc //@
-{ //@
-int //@
-x_vdprintf (int fildes, const char *format, va_list ap)//@;
+try_result<ssize_t> //@
+try_writev (int fildes, std::span<const iovec> iov)//@;
 {
-  int result = vdprintf (fildes, format, ap);
+  ssize_t result = writev (fildes, iov.data (), iov.size ());
 
-  if (result < 0)
+  if (result == -1)
     {
-      THROW_ERRNO;
+      TRY_RETURN_ERRNO (ssize_t);
     }
 
-  return result;
+  return try_result<ssize_t>::success (result);
 }
 } //@
 
-//@ #include <stdarg.h>
-//@ #include <stdio.h>
-namespace libsh_treis::libc //@
+// Возвращает fd без RAII-обёртки, как и остальные функции из no_raii
+//@ #include <sys/socket.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-int //@
-x_vfprintf (FILE *stream, const char *format, va_list ap)//@;
+try_result<int> //@
+try_accept (int socket, sockaddr *address, socklen_t *address_len)//@;
 {
-  int result = vfprintf (stream, format, ap);
+  int result = accept (socket, address, address_len);
 
-  if (result < 0)
+  if (result == -1)
     {
-      THROW_ERRNO;
+      TRY_RETURN_ERRNO (int);
     }
 
-  return result;
+  return try_result<int>::success (result);
 }
 } //@
 
-//@ #include <stdarg.h>
-#include <stdio.h>
+//@ #include <cstddef>
+//@ #include <sys/types.h>
+//@ #include <span>
+#include <sys/socket.h>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_vprintf (const char *format, va_list ap)//@;
+try_result<ssize_t> //@
+try_recv (int socket, std::span<std::byte> buf, int flags)//@;
 {
-  int result = vprintf (format, ap);
+  ssize_t result = recv (socket, buf.data (), buf.size (), flags);
 
-  if (result < 0)
+  if (result == -1)
     {
-      THROW_ERRNO;
+      TRY_RETURN_ERRNO (ssize_t);
     }
 
-  return result;
+  return try_result<ssize_t>::success (result);
 }
-} //@
 
-// Результат vsnprintf может быть больше длины s, поэтому возвращать span нельзя
-// Эту функцию нужно использовать, если в вашем случае переполнение не является ошибкой, например, потому что вы передаёте в качестве s span длины 0, чтобы узнать длину вывода. Во всех остальных случаях нужно использовать xx_vsnprintf. Если вы передаёте span длины 0, нужно использовать x_vsnprintf
-//@ #include <span>
-//@ #include <stdarg.h>
-#include <stdio.h>
-namespace libsh_treis::libc //@
-{ //@
-int //@
-x_vsnprintf (std::span<char> s, const char *format, va_list ap)//@;
+try_result<ssize_t> //@
+try_send (int socket, std::span<const std::byte> buf, int flags)//@;
 {
-  int result = vsnprintf (s.data (), s.size (), format, ap);
+  ssize_t result = send (socket, buf.data (), buf.size (), flags);
 
-  if (result < 0)
+  if (result == -1)
     {
-      THROW_ERRNO;
+      TRY_RETURN_ERRNO (ssize_t);
     }
 
-  return result;
+  return try_result<ssize_t>::success (result);
 }
 } //@
 
-//@ #include <stdarg.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-int //@
-x_vasprintf (char **strp, const char *fmt, va_list ap)//@;
+// Раскладывает bufs (начиная со смещения offset в bufs[0]) по iov, пропуская пустые буферы. Заполняет не больше IOV_MAX iovec'ов. Возвращает количество заполненных iovec'ов
+#include <limits.h>
+#include <sys/uio.h>
+#include <algorithm>
+namespace libsh_treis::libc::detail
 {
-  int result = libsh_treis::libc::detail::vasprintf_reexported (strp, fmt, ap);
+template <typename T> std::size_t
+spans_to_iovecs (std::span<iovec, IOV_MAX> iov, std::span<const std::span<T>> bufs, std::size_t offset) noexcept
+{
+  std::size_t n = 0;
 
-  if (result < 0)
+  for (std::size_t i = 0; i != bufs.size () && n != iov.size (); ++i)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Failed");
+      std::size_t skip = i == 0 ? offset : 0;
+
+      if (bufs[i].size () == skip)
+        {
+          continue;
+        }
+
+      iov[n].iov_base = (void *)(bufs[i].data () + skip);
+      iov[n].iov_len = bufs[i].size () - skip;
+      ++n;
     }
 
-  return result;
+  return n;
 }
-} //@
 
-#include <stdarg.h>
-namespace libsh_treis::libc //@
-{ //@
-int //@
-x_dprintf (int fildes, const char *format, ...)//@;
+// Сдвигает (bufs, offset) на done байт и пропускает пустые буферы
+template <typename T> void
+advance_spans (std::span<const std::span<T>> &bufs, std::size_t &offset, std::size_t done) noexcept
 {
-  va_list ap;
-  va_start (ap, format);
-  int result = x_vdprintf (fildes, format, ap);
-  va_end (ap);
-  return result;
+  for (;;)
+    {
+      while (bufs.size () != 0 && offset == bufs[0].size ())
+        {
+          bufs = bufs.subspan (1);
+          offset = 0;
+        }
+
+      if (done == 0 || bufs.size () == 0)
+        {
+          break;
+        }
+
+      std::size_t n = std::min (done, bufs[0].size () - offset);
+      offset += n;
+      done -= n;
+    }
+}
 }
-} //@
 
-//@ #include <stdio.h>
-#include <stdarg.h>
+// Span'ы вместо iovec'ов. Буферов должно быть не больше IOV_MAX (для x_writev и x_readv с большим количеством есть writev_repeatedly и readv_repeatedly). Пустые буферы пропускаются
+//@ #include <sys/types.h> // ssize_t, off_t
+//@ #include <span>
+//@ #include <cstddef>
+#include <limits.h>
+#include <sys/uio.h>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_fprintf (FILE *stream, const char *format, ...)//@;
+ssize_t //@
+x_writev (int fildes, std::span<const std::span<const std::byte>> bufs)//@;
 {
-  va_list ap;
-  va_start (ap, format);
-  int result = x_vfprintf (stream, format, ap);
-  va_end (ap);
-  return result;
+  LIBSH_TREIS_ASSERT (bufs.size () <= IOV_MAX);
+
+  iovec iov[IOV_MAX];
+  return x_writev (fildes, std::span<const iovec> (iov, libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, 0)));
 }
-} //@
 
-#include <stdarg.h>
-namespace libsh_treis::libc //@
-{ //@
-int //@
-x_printf (const char *format, ...)//@;
+ssize_t //@
+x_readv (int fildes, std::span<const std::span<std::byte>> bufs)//@;
 {
-  va_list ap;
-  va_start (ap, format);
-  int result = x_vprintf (format, ap);
-  va_end (ap);
-  return result;
+  LIBSH_TREIS_ASSERT (bufs.size () <= IOV_MAX);
+
+  iovec iov[IOV_MAX];
+  return x_readv (fildes, std::span<const iovec> (iov, libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, 0)));
+}
+
+ssize_t //@
+x_pwritev2 (int fildes, std::span<const std::span<const std::byte>> bufs, off_t offset, int flags)//@;
+{
+  LIBSH_TREIS_ASSERT (bufs.size () <= IOV_MAX);
+
+  iovec iov[IOV_MAX];
+  return x_pwritev2 (fildes, std::span<const iovec> (iov, libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, 0)), offset, flags);
+}
+
+ssize_t //@
+x_preadv2 (int fildes, std::span<const std::span<std::byte>> bufs, off_t offset, int flags)//@;
+{
+  LIBSH_TREIS_ASSERT (bufs.size () <= IOV_MAX);
+
+  iovec iov[IOV_MAX];
+  return x_preadv2 (fildes, std::span<const iovec> (iov, libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, 0)), offset, flags);
 }
 } //@
 
+//@ #include <sys/types.h> // size_t, ssize_t, off_t
 //@ #include <span>
-#include <stdarg.h>
+//@ #include <cstddef>
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_snprintf (std::span<char> s, const char *format, ...)//@;
+ssize_t //@
+x_pwrite (int fildes, std::span<const std::byte> buf, off_t offset)//@;
 {
-  va_list ap;
-  va_start (ap, format);
-  int result = x_vsnprintf (s, format, ap);
-  va_end (ap);
+  ssize_t result = pwrite (fildes, buf.data (), buf.size (), offset);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
   return result;
 }
-} //@
 
-#include <stdarg.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-int //@
-x_asprintf_nunu (char **strp, const char *fmt, ...)//@;
+ssize_t //@
+x_pread (int fildes, std::span<std::byte> buf, off_t offset)//@;
 {
-  va_list ap;
-  va_start (ap, fmt);
-  int result = x_vasprintf (strp, fmt, ap);
-  va_end (ap);
+  ssize_t result = pread (fildes, buf.data (), buf.size (), offset);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
   return result;
 }
 } //@
 
-#include <unistd.h>
+// iovec'и передаются как есть, поэтому их не должно быть больше IOV_MAX
+// С RWF_NOWAIT EAGAIN (данных нет в page cache) - это, как и везде в этой либе, ошибка, т. е. исключение
+//@ #include <sys/types.h> // ssize_t, off_t
+//@ #include <sys/uio.h> // RWF_NOWAIT, RWF_HIPRI, ...
+//@ #include <span>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_chdir (const char *path)//@;
+ssize_t //@
+x_pwritev2 (int fildes, std::span<const iovec> iov, off_t offset, int flags)//@;
 {
-  if (chdir (path) == -1)
+  ssize_t result = libsh_treis::libc::detail::pwritev2_reexported (fildes, iov.data (), iov.size (), offset, flags);
+
+  if (result == -1)
     {
-      THROW_ERRNO_MESSAGE (path);
+      THROW_ERRNO;
     }
+
+  return result;
 }
-} //@
 
-// POSIX 2018 сообщает, что popen "may set errno" в случае ошибки. Предполагаем, что popen всегда ставит errno в случае ошибки (так написано в линуксовом мане)
-// #include <stdio.h>
-namespace libsh_treis::libc::no_raii //@
-{ //@
-FILE * //@
-x_popen (const char *command, const char *mode)//@;
+ssize_t //@
+x_preadv2 (int fildes, std::span<const iovec> iov, off_t offset, int flags)//@;
 {
-  FILE *result = popen (command, mode);
+  ssize_t result = libsh_treis::libc::detail::preadv2_reexported (fildes, iov.data (), iov.size (), offset, flags);
 
-  if (result == nullptr)
+  if (result == -1)
     {
       THROW_ERRNO;
     }
@@ -722,15 +929,18 @@ x_popen (const char *command, const char *mode)//@;
 }
 } //@
 
+// Сбрасывает err flag перед вызовом getc
 //@ #include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
 int //@
-x_pclose (FILE *stream)//@;
+x_fgetc (FILE *stream)//@;
 {
-  int result = pclose (stream);
+  clearerr (stream);
 
-  if (result == -1)
+  int result = getc (stream);
+
+  if (result == EOF && ferror (stream))
     {
       THROW_ERRNO;
     }
@@ -739,15 +949,18 @@ x_pclose (FILE *stream)//@;
 }
 } //@
 
-//@ #include <stdio.h>
+// Сбрасывает err flag перед вызовом getchar
+#include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
 int //@
-x_fileno (FILE *stream)//@;
+x_getchar_nunu (void)//@;
 {
-  int result = fileno (stream);
+  clearerr (stdin);
 
-  if (result == -1)
+  int result = getchar ();
+
+  if (result == EOF && ferror (stdin))
     {
       THROW_ERRNO;
     }
@@ -756,156 +969,188 @@ x_fileno (FILE *stream)//@;
 }
 } //@
 
-#include <unistd.h>
+// Сбрасывает err flag перед вызовом getdelim
+// По-хорошему надо вернуть std::unique_ptr<std::span<char>>, но я решил возвращать просто ssize_t, т. к. в пользовательском коде я всё равно вряд ли буду вызывать эту функцию. Использоваться она будет лишь для дальнейших обёрток, а там важна максимальная производительность
+// no_raii, потому что нужен free
+//@ #include <sys/types.h> // size_t, ssize_t
+//@ #include <stdio.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-//@ struct pipe_result
-//@ {
-//@   int readable;
-//@   int writable;
-//@ };
-
-pipe_result //@
-x_pipe (void)//@;
+ssize_t //@
+x_getdelim (char **lineptr, size_t *n, int delimiter, FILE *stream)//@;
 {
-  int result[2];
+  clearerr (stdin);
 
-  if (pipe (result) == -1)
+  ssize_t result = getdelim (lineptr, n, delimiter, stream);
+
+  if (result == -1 && ferror (stream))
     {
       THROW_ERRNO;
     }
 
-  return {.readable = result[0], .writable = result[1]};
+  return result;
 }
 } //@
 
-//@ #include <sys/types.h>
-#include <unistd.h>
+// Сбрасывает err flag перед вызовом функции из libc
+//@ #include <sys/types.h> // size_t, ssize_t
+//@ #include <stdio.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-pid_t //@
-x_fork (void)//@;
+ssize_t //@
+x_getline (char **lineptr, size_t *n, FILE *stream)//@;
 {
-  pid_t result = fork ();
+  return x_getdelim (lineptr, n, '\n', stream);
+}
+} //@
 
-  if (result == (pid_t)-1)
+// Инклудит хедер для O_RDONLY и тому подобных
+// Называем именно x_open_2, а не x_open2, т. к. в ядре Linux существует системный вызов openat2
+//@ #include <fcntl.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+int //@
+x_open_2 (const char *path, int oflag)//@;
+{
+  LIBSH_TREIS_ASSERT (!((oflag & O_CREAT) == O_CREAT || (oflag & O_TMPFILE) == O_TMPFILE));
+
+  int result = open (path, oflag);
+
+  if (result == -1)
     {
-      THROW_ERRNO;
+      THROW_ERRNO_MESSAGE (path);
     }
 
   return result;
 }
 } //@
 
+// Инклудит хедер для O_RDONLY и тому подобных
 //@ #include <sys/types.h>
-#include <sys/wait.h>
-namespace libsh_treis::libc //@
+//@ #include <fcntl.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-pid_t //@
-x_waitpid (pid_t pid, int *stat_loc, int options)//@;
+int //@
+x_open_3 (const char *path, int oflag, mode_t mode)//@;
 {
-  pid_t result = waitpid (pid, stat_loc, options);
+  int result = open (path, oflag, mode);
 
-  if (result == (pid_t)-1)
+  if (result == -1)
     {
-      THROW_ERRNO;
+      THROW_ERRNO_MESSAGE (path);
     }
 
   return result;
 }
 } //@
 
-// Функция обычно используется, чтобы скопировать fd на 0, 1 или 2. Эти fd не имеет смысла оборачивать в RAII-обёртки. Поэтому не-RAII версию x_dup2 помещаем в namespace libsh_treis::libc
-#include <unistd.h>
-namespace libsh_treis::libc //@
+// Инклудит хедер для O_RDONLY, AT_FDCWD и тому подобных
+// Как и x_open_2, x_openat_3 нельзя вызывать с O_CREAT и O_TMPFILE
+//@ #include <sys/types.h>
+//@ #include <fcntl.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-void //@
-x_dup2 (int fildes, int fildes2)//@;
+int //@
+x_openat_3 (int dirfd, const char *path, int oflag)//@;
 {
-  if (dup2 (fildes, fildes2) == -1)
+  LIBSH_TREIS_ASSERT (!((oflag & O_CREAT) == O_CREAT || (oflag & O_TMPFILE) == O_TMPFILE));
+
+  int result = openat (dirfd, path, oflag);
+
+  if (result == -1)
     {
-      THROW_ERRNO;
+      THROW_ERRNO_MESSAGE (path);
     }
+
+  return result;
 }
-} //@
 
-// За одно фиксим проблему с прототипом функций exec*
-#include <unistd.h>
-namespace libsh_treis::libc //@
-{ //@
-[[noreturn]] void //@
-x_execv_nunu (const char *path, const char *const argv[])//@;
+int //@
+x_openat_4 (int dirfd, const char *path, int oflag, mode_t mode)//@;
 {
-  execv (path, (char *const *)argv);
+  int result = openat (dirfd, path, oflag, mode);
 
-  THROW_ERRNO_MESSAGE (path);
+  if (result == -1)
+    {
+      THROW_ERRNO_MESSAGE (path);
+    }
+
+  return result;
 }
 } //@
 
 #include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-[[noreturn]] void //@
-x_execvp (const char *file, const char *const argv[])//@;
+void //@
+x_close (int fildes)//@;
 {
-  execvp (file, (char *const *)argv);
-
-  THROW_ERRNO_MESSAGE (file);
+  if (close (fildes) == -1)
+    {
+      THROW_ERRNO;
+    }
 }
 } //@
 
-//@ #include <time.h>
+// Называем x_fcntl_2 и x_fcntl_3 по аналогии с x_open_2 и x_open_3. Пока третий аргумент нужен только типа int
+//@ #include <fcntl.h>
 namespace libsh_treis::libc //@
 { //@
-timespec //@
-x_clock_gettime (clockid_t clk_id)//@;
+int //@
+x_fcntl_2 (int fildes, int cmd)//@;
 {
-  timespec result;
+  int result = fcntl (fildes, cmd);
 
-  if (clock_gettime (clk_id, &result) == -1)
+  if (result == -1)
     {
       THROW_ERRNO;
     }
 
   return result;
 }
-} //@
 
-#include <unistd.h>
-namespace libsh_treis::libc //@
-{ //@
-void //@
-x_syncfs (int fd)//@;
+int //@
+x_fcntl_3 (int fildes, int cmd, int arg)//@;
 {
-  if (syncfs (fd) == -1)
+  int result = fcntl (fildes, cmd, arg);
+
+  if (result == -1)
     {
       THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-#include <unistd.h>
+//@ #include <stdarg.h>
+#include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_unlink (const char *pathname)//@;
+int //@
+x_vdprintf (int fildes, const char *format, va_list ap)//@;
 {
-  if (unlink (pathname) == -1)
+  int result = vdprintf (fildes, format, ap);
+
+  if (result < 0)
     {
-      THROW_ERRNO_MESSAGE (pathname);
+      THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-//@ #include <unistd.h>
+//@ #include <stdarg.h>
+//@ #include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-off_t //@
-x_lseek (int fd, off_t offset, int whence)//@;
+int //@
+x_vfprintf (FILE *stream, const char *format, va_list ap)//@;
 {
-  off_t result = lseek (fd, offset, whence);
+  int result = vfprintf (stream, format, ap);
 
-  if (result == -1)
+  if (result < 0)
     {
       THROW_ERRNO;
     }
@@ -914,15 +1159,16 @@ x_lseek (int fd, off_t offset, int whence)//@;
 }
 } //@
 
-#include <stdlib.h>
-namespace libsh_treis::libc::no_raii //@
+//@ #include <stdarg.h>
+#include <stdio.h>
+namespace libsh_treis::libc //@
 { //@
 int //@
-x_mkstemp (char *templ)//@;
+x_vprintf (const char *format, va_list ap)//@;
 {
-  int result = mkstemp (templ);
+  int result = vprintf (format, ap);
 
-  if (result == -1)
+  if (result < 0)
     {
       THROW_ERRNO;
     }
@@ -931,298 +1177,342 @@ x_mkstemp (char *templ)//@;
 }
 } //@
 
-//@ #include <time.h>
+// Результат vsnprintf может быть больше длины s, поэтому возвращать span нельзя
+// Эту функцию нужно использовать, если в вашем случае переполнение не является ошибкой, например, потому что вы передаёте в качестве s span длины 0, чтобы узнать длину вывода. Во всех остальных случаях нужно использовать xx_vsnprintf. Если вы передаёте span длины 0, нужно использовать x_vsnprintf
+//@ #include <span>
+//@ #include <stdarg.h>
+#include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_clock_nanosleep (clockid_t clock_id, int flags, const timespec *request)//@;
+int //@
+x_vsnprintf (std::span<char> s, const char *format, va_list ap)//@;
 {
-  if (flags != TIMER_ABSTIME)
-    {
-      _LIBSH_TREIS_THROW_MESSAGE ("Реализован только TIMER_ABSTIME");
-    }
-
-  int err = clock_nanosleep (clock_id, flags, request, nullptr);
+  int result = vsnprintf (s.data (), s.size (), format, ap);
 
-  if (err != 0)
+  if (result < 0)
     {
-      if (err == EINTR)
-        {
-          return x_clock_nanosleep (clock_id, flags, request);
-        }
-
-      errno = err;
       THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-//@ #include <dirent.h>
+//@ #include <stdarg.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-DIR * //@
-x_opendir (const char *dirname)//@;
+int //@
+x_vasprintf (char **strp, const char *fmt, va_list ap)//@;
 {
-  DIR *result = opendir (dirname);
+  int result = libsh_treis::libc::detail::vasprintf_reexported (strp, fmt, ap);
 
-  if (result == nullptr)
+  if (result < 0)
     {
-      THROW_ERRNO_MESSAGE (dirname);
+      _LIBSH_TREIS_THROW_MESSAGE ("Failed");
     }
 
   return result;
 }
 } //@
 
-//@ #include <dirent.h>
+#include <stdarg.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_closedir (DIR *dirp)//@;
+int //@
+x_dprintf (int fildes, const char *format, ...)//@;
 {
-  if (closedir (dirp) == -1)
-    {
-      THROW_ERRNO;
-    }
+  va_list ap;
+  va_start (ap, format);
+  int result = x_vdprintf (fildes, format, ap);
+  va_end (ap);
+  return result;
 }
 } //@
 
-// Мы инклудим <dirent.h>, значит, можно использовать DT_REG и прочие
-//@ #include <dirent.h>
+//@ #include <stdio.h>
+#include <stdarg.h>
 namespace libsh_treis::libc //@
 { //@
-dirent * //@
-x_readdir (DIR *dirp)//@;
+int //@
+x_fprintf (FILE *stream, const char *format, ...)//@;
 {
-  int saved_errno = errno;
-
-  errno = 0;
-
-  dirent *result = readdir (dirp);
-
-  if (result == nullptr && errno != 0)
-    {
-      THROW_ERRNO;
-    }
-
-  errno = saved_errno;
-
+  va_list ap;
+  va_start (ap, format);
+  int result = x_vfprintf (stream, format, ap);
+  va_end (ap);
   return result;
 }
 } //@
 
-//@ #include <dirent.h>
+#include <stdarg.h>
 namespace libsh_treis::libc //@
 { //@
 int //@
-x_dirfd (DIR *dirp)//@;
+x_printf (const char *format, ...)//@;
 {
-  int result = dirfd (dirp);
-
-  if (result == -1)
-    {
-      THROW_ERRNO;
-    }
-
+  va_list ap;
+  va_start (ap, format);
+  int result = x_vprintf (format, ap);
+  va_end (ap);
   return result;
 }
 } //@
 
-//@ #include <sys/stat.h>
+//@ #include <span>
+#include <stdarg.h>
 namespace libsh_treis::libc //@
 { //@
-struct stat //@
-x_stat (const char *path)//@;
+int //@
+x_snprintf (std::span<char> s, const char *format, ...)//@;
 {
-  struct stat result;
-
-  if (stat (path, &result) == -1)
-    {
-      THROW_ERRNO_MESSAGE (path);
-    }
-
+  va_list ap;
+  va_start (ap, format);
+  int result = x_vsnprintf (s, format, ap);
+  va_end (ap);
   return result;
 }
 } //@
 
-// Стандартный fread эквивалентен read_repeatedly в том смысле, что он читает всё, пока не упрётся в ошибку или EOF. То есть некий fread_repeatedly уже не нужен
-// Всегда передаём 1 в качестве второго аргумента (size) в fread. Чтобы можно было точно понять, сколько именно байт прочитано. Возможно, это будет иметь некие последствия для производительности. Но если вам важна производительность, вы просто не должны использовать fread вовсе, а должны использовать самописную буферизацию
-// x_fread аналогичен read_repeatedly, поэтому тоже возвращает std::span<std::byte>
-// Сбрасывает err flag
-//@ #include <span>
-//@ #include <cstddef>
-//@ #include <stdio.h>
-#include <stddef.h>
-namespace libsh_treis::libc //@
+#include <stdarg.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-std::span<std::byte> //@
-x_fread (std::span<std::byte> buf, FILE *stream)//@;
+int //@
+x_asprintf_nunu (char **strp, const char *fmt, ...)//@;
 {
-  clearerr (stream);
-
-  size_t result = fread (buf.data (), 1, buf.size (), stream);
-
-  if (ferror (stream))
-    {
-      THROW_ERRNO;
-    }
-
-  return std::span<std::byte> (buf.data (), result);
+  va_list ap;
+  va_start (ap, fmt);
+  int result = x_vasprintf (strp, fmt, ap);
+  va_end (ap);
+  return result;
 }
 } //@
 
-//@ #include <time.h>
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-tm //@
-x_gmtime_r (time_t t)//@;
+void //@
+x_chdir (const char *path)//@;
 {
-  tm result;
-
-  if (gmtime_r (&t, &result) == nullptr)
+  if (chdir (path) == -1)
     {
-      THROW_ERRNO;
+      THROW_ERRNO_MESSAGE (path);
     }
-
-  return result;
 }
 } //@
 
-// Вы должны позаботиться, чтобы эта функция всегда писала непустую строку
-//@ #include <stddef.h>
-//@ #include <time.h>
-//@ #include <span>
+// POSIX 2018 сообщает, что popen "may set errno" в случае ошибки. Предполагаем, что popen всегда ставит errno в случае ошибки (так написано в линуксовом мане)
+// #include <stdio.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-libsh_treis::tools::cstring_span //@
-x_strftime (std::span<char> s, const char *format, const tm &tm)//@;
+FILE * //@
+x_popen (const char *command, const char *mode)//@;
 {
-  size_t result = strftime (s.data (), s.size (), format, &tm);
+  FILE *result = popen (command, mode);
 
-  if (result == 0)
+  if (result == nullptr)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+      THROW_ERRNO;
     }
 
-  return libsh_treis::tools::make_cstring_span_unsafe (s.data (), result);
+  return result;
 }
 } //@
 
-//@ #include <sys/types.h>
-#include <sys/stat.h>
-#include <fcntl.h>
+//@ #include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_mkdir (const char *path, mode_t mode)//@;
+int //@
+x_pclose (FILE *stream)//@;
 {
-  if (mkdir (path, mode) == -1)
+  int result = pclose (stream);
+
+  if (result == -1)
     {
       THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-#include <stdlib.h>
+//@ #include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_mkdtemp (char *templ)//@;
+int //@
+x_fileno (FILE *stream)//@;
 {
-  if (mkdtemp (templ) == nullptr)
+  int result = fileno (stream);
+
+  if (result == -1)
     {
       THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-// Не вызывайте с command == nullptr
-#include <stdlib.h>
-namespace libsh_treis::libc //@
+#include <unistd.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-int //@
-x_system (const char *command)//@;
+//@ struct pipe_result
+//@ {
+//@   int readable;
+//@   int writable;
+//@ };
+
+pipe_result //@
+x_pipe (void)//@;
 {
-  int result = system (command);
+  int result[2];
 
-  if (result == -1)
+  if (pipe (result) == -1)
     {
       THROW_ERRNO;
     }
 
-  return result;
+  return {.readable = result[0], .writable = result[1]};
 }
 } //@
 
-//@ #include <stdio.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-FILE * //@
-x_fopen (const char *pathname, const char *mode)//@;
+pipe_result //@
+x_pipe2 (int flags)//@;
 {
-  FILE *result = fopen (pathname, mode);
+  int result[2];
 
-  if (result == nullptr)
+  if (libsh_treis::libc::detail::pipe2_reexported (result, flags) == -1)
     {
-      THROW_ERRNO_MESSAGE (pathname);
+      THROW_ERRNO;
     }
 
-  return result;
+  return {.readable = result[0], .writable = result[1]};
 }
 } //@
 
-//@ #include <stdio.h>
-namespace libsh_treis::libc //@
-{ //@
-void //@
-x_fclose (FILE *stream)//@;
+#include <time.h>
+#include <algorithm>
+#include <chrono>
+namespace libsh_treis::libc::detail
 {
-  if (fclose (stream) == EOF)
+// Для перезапуска после EINTR функций с таймаутом в миллисекундах (-1 - бесконечно): сколько осталось до deadline
+int
+remaining_timeout (int timeout, std::chrono::steady_clock::time_point deadline)
+{
+  if (timeout <= 0)
     {
-      THROW_ERRNO;
+      return timeout;
+    }
+
+  auto now = std::chrono::steady_clock::now ();
+
+  if (now >= deadline)
+    {
+      return 0;
     }
+
+  // Округляем вверх, чтобы не проснуться раньше срока
+  return (int)std::chrono::ceil<std::chrono::milliseconds> (deadline - now).count ();
 }
-} //@;
 
-#include <unistd.h>
+// То же для функций с таймаутом в timespec (nullptr - бесконечно). Оставшееся время записывается в buf
+const timespec *
+remaining_timespec (const timespec *timeout, std::chrono::steady_clock::time_point deadline, timespec &buf)
+{
+  if (timeout == nullptr)
+    {
+      return nullptr;
+    }
+
+  auto left = std::max (deadline - std::chrono::steady_clock::now (), std::chrono::steady_clock::duration::zero ());
+  auto sec = std::chrono::floor<std::chrono::seconds> (left);
+
+  buf.tv_sec = (time_t)sec.count ();
+  buf.tv_nsec = (long)std::chrono::duration_cast<std::chrono::nanoseconds> (left - sec).count ();
+
+  return &buf;
+}
+}
+
+// Перезапускается после EINTR (poll не перезапускается даже с SA_RESTART), и тогда ждёт только оставшуюся часть timeout
+//@ #include <poll.h>
+//@ #include <span>
+#include <errno.h>
+#include <chrono>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_fsync (int fildes)//@;
+int //@
+x_poll (std::span<pollfd> fds, int timeout)//@;
 {
-  if (fsync (fildes) == -1)
+  auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+
+  for (;;)
     {
-      THROW_ERRNO;
+      int result = poll (fds.data (), fds.size (), libsh_treis::libc::detail::remaining_timeout (timeout, deadline));
+
+      if (result != -1)
+        {
+          return result;
+        }
+
+      if (errno != EINTR)
+        {
+          THROW_ERRNO;
+        }
     }
 }
 } //@
 
+// Если sigmask == nullptr, то, как x_poll, перезапускается после EINTR, ожидая оставшуюся часть timeout. Иначе не перезапускается: sigmask обычно передают как раз затем, чтобы атомарно разблокировать сигналы на время ожидания и узнать о них по EINTR
+//@ #include <poll.h>
 //@ #include <signal.h>
+//@ #include <time.h>
+//@ #include <span>
+#include <errno.h>
+#include <algorithm>
+#include <chrono>
 namespace libsh_treis::libc //@
 { //@
-struct sigaction //@
-x_sigaction (int sig, const struct sigaction *act)//@;
+int //@
+x_ppoll (std::span<pollfd> fds, const timespec *timeout, const sigset_t *sigmask)//@;
 {
-  struct sigaction oact;
+  std::chrono::steady_clock::time_point deadline;
 
-  if (sigaction (sig, act, &oact) == -1)
+  if (timeout != nullptr)
     {
-      THROW_ERRNO;
+      // Ограничиваем огромные таймауты (их передают вместо бесконечности), чтобы не переполнить steady_clock
+      deadline = std::chrono::steady_clock::now () + std::chrono::seconds (std::min (timeout->tv_sec, (time_t)1 << 32)) + std::chrono::nanoseconds (timeout->tv_nsec);
     }
 
-  return oact;
+  for (;;)
+    {
+      timespec left;
+      int result = libsh_treis::libc::detail::ppoll_reexported (fds.data (), fds.size (), libsh_treis::libc::detail::remaining_timespec (timeout, deadline, left), sigmask);
+
+      if (result != -1)
+        {
+          return result;
+        }
+
+      if (errno != EINTR || sigmask != nullptr)
+        {
+          THROW_ERRNO;
+        }
+    }
 }
 } //@
 
-//@ #include <signal.h>
-namespace libsh_treis::libc //@
+//@ #include <sys/types.h>
+#include <unistd.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-sigset_t //@
-x_sigemptyset (void)//@;
+pid_t //@
+x_fork (void)//@;
 {
-  sigset_t result;
+  pid_t result = fork ();
 
-  if (sigemptyset (&result) == -1)
+  if (result == (pid_t)-1)
     {
       THROW_ERRNO;
     }
@@ -1231,922 +1521,6262 @@ x_sigemptyset (void)//@;
 }
 } //@
 
-#include <stdio.h>
+//@ #include <sys/types.h>
+#include <sys/wait.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-x_rename (const char *oldpath, const char *newpath)//@;
+pid_t //@
+x_waitpid (pid_t pid, int *stat_loc, int options)//@;
 {
-  if (rename (oldpath, newpath) == -1)
+  pid_t result = waitpid (pid, stat_loc, options);
+
+  if (result == (pid_t)-1)
     {
       THROW_ERRNO;
     }
+
+  return result;
 }
 } //@
 
-//@ #include <fcntl.h> // For AT_FDCWD
-//@ #include <linux/fs.h> // For RENAME_EXCHANGE, ...
+// Функция обычно используется, чтобы скопировать fd на 0, 1 или 2. Эти fd не имеет смысла оборачивать в RAII-обёртки. Поэтому не-RAII версию x_dup2 помещаем в namespace libsh_treis::libc
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
 void //@
-x_renameat2 (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)//@;
+x_dup2 (int fildes, int fildes2)//@;
 {
-  if ((*libsh_treis::libc::detail::syscall_reexported) (SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags) == -1)
+  if (dup2 (fildes, fildes2) == -1)
     {
       THROW_ERRNO;
     }
 }
 } //@
 
-// xx-обёртки
-
-// Сбрасывает err flag перед вызовом getc
-//@ #include <stdio.h>
+// За одно фиксим проблему с прототипом функций exec*
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-char //@
-xx_fgetc_nunu (FILE *stream)//@;
+[[noreturn]] void //@
+x_execv_nunu (const char *path, const char *const argv[])//@;
 {
-  int result = x_fgetc (stream);
-
-  if (result == EOF)
-    {
-      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
-    }
+  execv (path, (char *const *)argv);
 
-  return (char)(unsigned char)result;
+  THROW_ERRNO_MESSAGE (path);
 }
 } //@
 
-// Сбрасывает err flag перед вызовом getchar
-#include <stdio.h>
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-char //@
-xx_getchar_nunu (void)//@;
+[[noreturn]] void //@
+x_execvp (const char *file, const char *const argv[])//@;
 {
-  int result = x_getchar_nunu ();
-
-  if (result == EOF)
-    {
-      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
-    }
+  execvp (file, (char *const *)argv);
 
-  return (char)(unsigned char)result;
+  THROW_ERRNO_MESSAGE (file);
 }
 } //@
 
-//@ #include <span>
-//@ #include <cstddef>
-//@ #include <stdio.h>
+//@ #include <time.h>
 namespace libsh_treis::libc //@
 { //@
-bool //@
-xx_fread (std::span<std::byte> buf, FILE *stream)//@;
+timespec //@
+x_clock_gettime (clockid_t clk_id)//@;
 {
-  auto have_read = x_fread (buf, stream).size ();
-
-  if (have_read == buf.size ())
-    {
-      return true;
-    }
+  timespec result;
 
-  if (have_read == 0)
+  if (clock_gettime (clk_id, &result) == -1)
     {
-      return false;
+      THROW_ERRNO;
     }
 
-  _LIBSH_TREIS_THROW_MESSAGE ("Partial data");
+  return result;
 }
 } //@
 
-//@ #include <span>
-//@ #include <cstddef>
-//@ #include <stdio.h>
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
 void //@
-xxx_fread (std::span<std::byte> buf, FILE *stream)//@;
+x_syncfs (int fd)//@;
 {
-  if (!xx_fread (buf, stream))
+  if (syncfs (fd) == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+      THROW_ERRNO;
     }
 }
 } //@
 
-//@ #include <stdarg.h>
-//@ #include <span>
+#include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-std::span<char> //@
-xx_vsnprintf (std::span<char> s, const char *format, va_list ap)//@;
+void //@
+x_unlink (const char *pathname)//@;
 {
-  int result = x_vsnprintf (s, format, ap);
-
-  if (result >= std::ssize (s))
+  if (unlink (pathname) == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Overflow");
+      THROW_ERRNO_MESSAGE (pathname);
     }
-
-  return std::span<char> (s.data (), result);
-}
-} //@
-
-//@ #include <span>
-#include <stdarg.h>
-namespace libsh_treis::libc //@
-{ //@
-std::span<char> //@
-xx_snprintf (std::span<char> s, const char *format, ...)//@;
-{
-  va_list ap;
-  va_start (ap, format);
-  std::span<char> result = xx_vsnprintf (s, format, ap);
-  va_end (ap);
-  return result;
 }
 } //@
 
-#include <string.h>
+//@ #include <unistd.h>
 namespace libsh_treis::libc //@
 { //@
-const char * //@
-xx_strrchr (const char *s, int c)//@;
+off_t //@
+x_lseek (int fd, off_t offset, int whence)//@;
 {
-  const char *result = strrchr (s, c);
+  off_t result = lseek (fd, offset, whence);
 
-  if (result == nullptr)
+  if (result == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Character not found");
+      THROW_ERRNO;
     }
 
   return result;
 }
+} //@
 
-char * //@
-xx_strrchr (char *s, int c)//@;
+#include <stdlib.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+int //@
+x_mkstemp (char *templ)//@;
 {
-  char *result = strrchr (s, c);
+  int result = mkstemp (templ);
 
-  if (result == nullptr)
+  if (result == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Character not found");
+      THROW_ERRNO;
     }
 
   return result;
 }
 } //@
 
-// Прочие функции
-
-// Такая функция пригодится (т. е. именно с таким API), если, скажем, нужно прочитать первые 1000 байт файла, чтобы узнать, текстовый ли этот файл
-// Необходимость повторять вызовы read может быть при чтении с терминала
-// Если buf.size () равен нулю, read не вызывается ни разу
-// Возвращаем std::span<std::byte>, т. к. именно это нужно в задаче чтения первых 1000 байт файла
-//@ #include <span>
-//@ #include <cstddef>
-#include <sys/types.h>
+//@ #include <time.h>
 namespace libsh_treis::libc //@
 { //@
-std::span<std::byte> //@
-read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+void //@
+x_clock_nanosleep (clockid_t clock_id, int flags, const timespec *request)//@;
 {
-  auto to_fill = buf;
-
-  while (to_fill.size () > 0)
+  if (flags != TIMER_ABSTIME)
     {
-      ssize_t result_of_x_read = x_read (fildes, to_fill);
+      _LIBSH_TREIS_THROW_MESSAGE ("Реализован только TIMER_ABSTIME");
+    }
 
-      if (result_of_x_read == 0)
+  int err = clock_nanosleep (clock_id, flags, request, nullptr);
+
+  if (err != 0)
+    {
+      if (err == EINTR)
         {
-          break;
+          return x_clock_nanosleep (clock_id, flags, request);
         }
 
-      to_fill = to_fill.subspan (result_of_x_read);
+      errno = err;
+      THROW_ERRNO;
     }
-
-  return buf.first (buf.size () - to_fill.size ());
 }
 } //@
 
-// Такая функция пригодится, если мы читаем блоки фиксированного размера из файла один за другим
-//@ #include <span>
-//@ #include <cstddef>
-namespace libsh_treis::libc //@
+//@ #include <dirent.h>
+namespace libsh_treis::libc::no_raii //@
 { //@
-bool //@
-x_read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+DIR * //@
+x_opendir (const char *dirname)//@;
 {
-  auto have_read = read_repeatedly (fildes, buf).size ();
-
-  if (have_read == buf.size ())
-    {
-      return true;
-    }
+  DIR *result = opendir (dirname);
 
-  if (have_read == 0)
+  if (result == nullptr)
     {
-      return false;
+      THROW_ERRNO_MESSAGE (dirname);
     }
 
-  _LIBSH_TREIS_THROW_MESSAGE ("Partial data");
+  return result;
 }
 } //@
 
-//@ #include <span>
-//@ #include <cstddef>
+//@ #include <dirent.h>
 namespace libsh_treis::libc //@
 { //@
 void //@
-xx_read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+x_closedir (DIR *dirp)//@;
 {
-  if (!x_read_repeatedly (fildes, buf))
+  if (closedir (dirp) == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+      THROW_ERRNO;
     }
 }
 } //@
 
-// Если buf.size () равно нулю, write не вызывается ни разу
-//@ #include <span>
-//@ #include <cstddef>
+// Мы инклудим <dirent.h>, значит, можно использовать DT_REG и прочие
+//@ #include <dirent.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-write_repeatedly (int fildes, std::span<const std::byte> buf)//@;
+dirent * //@
+x_readdir (DIR *dirp)//@;
 {
-  while (buf.size () != 0)
-    {
-      buf = buf.subspan (x_write (fildes, buf));
-    }
-}
-} //@
+  int saved_errno = errno;
 
-//@ #include <sys/types.h>
-//@ #include <unistd.h>
-//@ namespace libsh_treis::libc
-//@ {
-//@ class fd: libsh_treis::tools::not_movable
-//@ {
-//@   int _fd;
-//@   int _exceptions;
+  errno = 0;
 
-//@ public:
-//@   explicit fd (int f) noexcept : _fd (f), _exceptions (std::uncaught_exceptions ())
-//@   {
-//@   }
+  dirent *result = readdir (dirp);
 
-//@   ~fd (void) noexcept (false)
-//@   {
-//@     if (std::uncaught_exceptions () == _exceptions)
-//@       {
-//@         x_close (_fd);
-//@       }
-//@     else
-//@       {
-//@         close (_fd);
-//@       }
-//@   }
+  if (result == nullptr && errno != 0)
+    {
+      THROW_ERRNO;
+    }
 
-//@   int
-//@   resource (void) const noexcept
-//@   {
-//@     return _fd;
-//@   }
-//@ };
-//@ }
+  errno = saved_errno;
+
+  return result;
+}
+} //@
 
+//@ #include <dirent.h>
 namespace libsh_treis::libc //@
 { //@
-fd //@
-x_open_2 (const char *path, int oflag)//@;
+int //@
+x_dirfd (DIR *dirp)//@;
 {
-  return fd (libsh_treis::libc::no_raii::x_open_2 (path, oflag));
-}
+  int result = dirfd (dirp);
 
-fd //@
-x_open_3 (const char *path, int oflag, mode_t mode)//@;
-{
-  return fd (libsh_treis::libc::no_raii::x_open_3 (path, oflag, mode));
-}
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
 
-fd //@
-x_mkstemp (char *templ)//@;
-{
-  return fd (libsh_treis::libc::no_raii::x_mkstemp (templ));
+  return result;
 }
 } //@
 
-// Мне не нравятся функции для парсинга целых чисел в стандартах C и C++, поэтому я пишу свою. А раз уж пишу свою, то в качестве back end'а буду использовать from_chars как самую низкоуровневую и быструю
-//@ #include <string_view>
-//@ #include <charconv>
-//@ #include <system_error>
-//@ namespace libsh_treis::libc
-//@ {
-//@ template <typename T> T
-//@ sto (std::string_view s)
-//@ {
-//@   if (s.size () == 0)
-//@     {
-//@       _LIBSH_TREIS_THROW_MESSAGE ("Empty string");
-//@     }
-
-//@   if (!(s[0] == '-' || ('0' <= s[0] && s[0] <= '9')))
-//@     {
-//@       _LIBSH_TREIS_THROW_MESSAGE ("Doesn't begin with [-0-9]");
-//@     }
-
-//@   T result;
-
-//@   auto [ptr, ec] = std::from_chars (s.data (), s.data () + s.size (), result);
-
-//@   if (ec != std::errc ())
-//@     {
-//@       _LIBSH_TREIS_THROW_MESSAGE ("Not a valid number (std::from_chars returned error)");
-//@     }
+//@ #include <sys/stat.h>
+namespace libsh_treis::libc //@
+{ //@
+struct stat //@
+x_stat (const char *path)//@;
+{
+  struct stat result;
 
-//@   if (ptr != s.data () + s.size ())
-//@     {
-//@       _LIBSH_TREIS_THROW_MESSAGE ("There is a garbagge after number");
-//@     }
+  if (stat (path, &result) == -1)
+    {
+      THROW_ERRNO_MESSAGE (path);
+    }
 
-//@   return result;
-//@ }
-//@ }
+  return result;
+}
+} //@
 
-// Не возвращаем результат [v]asprintf'а, т. к. его можно получить за O(1), вызвав size () у строки. Работает, даже если есть нулевые байты
-//@ #include <stdarg.h>
-//@ #include <string>
-#include <stdlib.h>
+//@ #include <sys/stat.h>
 namespace libsh_treis::libc //@
 { //@
-std::string //@
-x_vasprintf (const char *fmt, va_list ap)//@;
+struct stat //@
+x_fstat (int fildes)//@;
 {
-  char *str;
-
-  int length = libsh_treis::libc::no_raii::x_vasprintf (&str, fmt, ap);
-
-  std::string result (str, length);
+  struct stat result;
 
-  free (str);
+  if (fstat (fildes, &result) == -1)
+    {
+      THROW_ERRNO;
+    }
 
   return result;
 }
 } //@
 
-//@ #include <string>
-#include <stdarg.h>
+// Инклудит хедер для AT_SYMLINK_NOFOLLOW и тому подобных
+//@ #include <sys/stat.h>
+//@ #include <fcntl.h>
 namespace libsh_treis::libc //@
 { //@
-std::string //@
-x_asprintf (const char *fmt, ...)//@;
+struct stat //@
+x_fstatat (int dirfd, const char *path, int flags)//@;
 {
-  va_list ap;
-  va_start (ap, fmt);
-  std::string result = x_vasprintf (fmt, ap);
-  va_end (ap);
+  struct stat result;
+
+  if (fstatat (dirfd, path, &result, flags) == -1)
+    {
+      THROW_ERRNO_MESSAGE (path);
+    }
+
   return result;
 }
 } //@
 
-#include <stdlib.h>
-#include <sys/wait.h>
+// В glibc statx есть только с _GNU_SOURCE, поэтому вызываем через syscall, как renameat2. struct statx и STATX_* берём из <linux/stat.h>
+// AT_STATX_DONT_SYNC, AT_SYMLINK_NOFOLLOW, AT_EMPTY_PATH и т. д. - из <fcntl.h>
+// Ядро заполняет только поля из mask (и, возможно, другие, см. stx_mask), поэтому просите только то, что нужно. Например, для размера и времени изменения - STATX_SIZE | STATX_MTIME
+//@ #include <fcntl.h>
+//@ #include <linux/stat.h>
 namespace libsh_treis::libc //@
 { //@
-void //@
-process_succeed (int status)//@;
+struct statx //@
+x_statx (int dirfd, const char *path, int flags, unsigned int mask)//@;
 {
-  if (!WIFEXITED (status))
-    {
-      _LIBSH_TREIS_THROW_MESSAGE ("Process status is not \"exited\"");
-    }
+  struct statx result;
 
-  if (WEXITSTATUS (status) != EXIT_SUCCESS)
+  if ((*libsh_treis::libc::detail::syscall_reexported) (SYS_statx, dirfd, path, flags, mask, &result) == -1)
     {
-      _LIBSH_TREIS_THROW_MESSAGE ("Process exit code is not 0");
+      THROW_ERRNO_MESSAGE (path);
     }
+
+  return result;
 }
 } //@
 
-// Деструктор всегда делает pclose
+// Стандартный fread эквивалентен read_repeatedly в том смысле, что он читает всё, пока не упрётся в ошибку или EOF. То есть некий fread_repeatedly уже не нужен
+// Всегда передаём 1 в качестве второго аргумента (size) в fread. Чтобы можно было точно понять, сколько именно байт прочитано. Возможно, это будет иметь некие последствия для производительности. Но если вам важна производительность, вы просто не должны использовать fread вовсе, а должны использовать самописную буферизацию
+// x_fread аналогичен read_repeatedly, поэтому тоже возвращает std::span<std::byte>
+// Сбрасывает err flag
+//@ #include <span>
+//@ #include <cstddef>
 //@ #include <stdio.h>
-//@ namespace libsh_treis::libc
-//@ {
-//@ class pipe_stream: libsh_treis::tools::not_movable
-//@ {
-//@   FILE *_stream;
-//@   int _exceptions;
+#include <stddef.h>
+namespace libsh_treis::libc //@
+{ //@
+std::span<std::byte> //@
+x_fread (std::span<std::byte> buf, FILE *stream)//@;
+{
+  clearerr (stream);
 
-//@ public:
-//@   explicit pipe_stream (FILE *stream) noexcept : _stream (stream), _exceptions (std::uncaught_exceptions ())
-//@   {
-//@   }
+  size_t result = fread (buf.data (), 1, buf.size (), stream);
 
-//@   ~pipe_stream (void) noexcept (false)
-//@   {
-//@     if (std::uncaught_exceptions () == _exceptions)
-//@       {
-//@         process_succeed (x_pclose (_stream));
-//@       }
-//@     else
-//@       {
-//@         pclose (_stream);
-//@       }
-//@   }
+  if (ferror (stream))
+    {
+      THROW_ERRNO;
+    }
 
-//@   FILE *
-//@   resource (void) const noexcept
-//@   {
-//@     return _stream;
-//@   }
-//@ };
-//@ }
+  return std::span<std::byte> (buf.data (), result);
+}
+} //@
 
+//@ #include <time.h>
 namespace libsh_treis::libc //@
 { //@
-pipe_stream //@
-x_popen (const char *command, const char *mode)//@;
+tm //@
+x_gmtime_r (time_t t)//@;
 {
-  return pipe_stream (libsh_treis::libc::no_raii::x_popen (command, mode));
+  tm result;
+
+  if (gmtime_r (&t, &result) == nullptr)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
 }
 } //@
 
-// Эта функция не является exception-safe
-//@ #include <memory>
-namespace libsh_treis::libc //@
+// Вы должны позаботиться, чтобы эта функция всегда писала непустую строку
+//@ #include <stddef.h>
+//@ #include <time.h>
+//@ #include <span>
+namespace libsh_treis::libc::no_raii //@
 { //@
-//@ struct pipe_result
-//@ {
-//@   std::unique_ptr<fd> readable;
-//@   std::unique_ptr<fd> writable;
-//@ };
-pipe_result //@
-x_pipe (void)//@;
+libsh_treis::tools::cstring_span //@
+x_strftime (std::span<char> s, const char *format, const tm &tm)//@;
 {
-  auto result = libsh_treis::libc::no_raii::x_pipe ();
+  size_t result = strftime (s.data (), s.size (), format, &tm);
 
-  return {.readable = std::unique_ptr<fd> (new fd (result.readable)), .writable = std::unique_ptr<fd> (new fd (result.writable))};
+  if (result == 0)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+    }
+
+  return libsh_treis::tools::make_cstring_span_unsafe (s.data (), result);
 }
 } //@
 
-// Вызывающая сторона должна сама flush'нуть C stdio и C++ streams перед вызовом этой функции. В том числе flush'нуть C stderr, т. к. он используется моей либой (если туда был вывод без '\n' в конце)
 //@ #include <sys/types.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_mkdir (const char *path, mode_t mode)//@;
+{
+  if (mkdir (path, mode) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+#include <stdlib.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_mkdtemp (char *templ)//@;
+{
+  if (mkdtemp (templ) == nullptr)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// Не вызывайте с command == nullptr
 #include <stdlib.h>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+x_system (const char *command)//@;
+{
+  int result = system (command);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <stdio.h>
 namespace libsh_treis::libc::no_raii //@
 { //@
-pid_t //@
-safe_fork (const std::function<void(void)> &func)//@;
+FILE * //@
+x_fopen (const char *pathname, const char *mode)//@;
 {
-  pid_t result = libsh_treis::libc::no_raii::x_fork ();
+  FILE *result = fopen (pathname, mode);
 
-  if (result == 0)
+  if (result == nullptr)
     {
-      _Exit (libsh_treis::tools::main_helper (func));
+      THROW_ERRNO_MESSAGE (pathname);
     }
 
   return result;
 }
 } //@
 
-//@ #include <sys/types.h>
+//@ #include <stdio.h>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_waitpid_status (pid_t pid, int options)//@;
+void //@
+x_fclose (FILE *stream)//@;
 {
-  int result;
+  if (fclose (stream) == EOF)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@;
 
-  x_waitpid (pid, &result, options);
+#include <unistd.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_fsync (int fildes)//@;
+{
+  if (fsync (fildes) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
 
-  return result;
+#include <unistd.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_fdatasync (int fildes)//@;
+{
+  if (fdatasync (fildes) == -1)
+    {
+      THROW_ERRNO;
+    }
 }
 } //@
 
-// Деструктор всегда делает waitpid
+// Флаги (SYNC_FILE_RANGE_WRITE и т. д.) есть только в fcntl.h с _GNU_SOURCE, поэтому свои константы
 //@ #include <sys/types.h>
-//@ #include <sys/wait.h>
 //@ namespace libsh_treis::libc
 //@ {
-//@ class process : libsh_treis::tools::not_movable
-//@ {
-//@   pid_t _pid;
-//@   int _exceptions;
-
-//@ public:
-//@   explicit process (pid_t pid) noexcept : _pid (pid), _exceptions (std::uncaught_exceptions ())
-//@   {
-//@   }
-
-//@   ~process (void) noexcept (false)
-//@   {
-//@     if (std::uncaught_exceptions () == _exceptions)
-//@       {
-//@         process_succeed (x_waitpid_status (_pid, 0));
-//@       }
-//@     else
-//@       {
-//@         waitpid (_pid, nullptr, 0);
-//@       }
-//@   }
-
-//@   pid_t
-//@   resource (void) const noexcept
-//@   {
-//@     return _pid;
-//@   }
-//@ };
+//@ inline constexpr unsigned int sync_file_range_wait_before = 1;
+//@ inline constexpr unsigned int sync_file_range_write = 2;
+//@ inline constexpr unsigned int sync_file_range_wait_after = 4;
 //@ }
 
+// Не даёт никаких гарантий сохранности (метаданные не пишутся, кэш диска не сбрасывается), только управляет write-back'ом. Для сохранности нужен x_fdatasync
 namespace libsh_treis::libc //@
 { //@
-process //@
-safe_fork (const std::function<void(void)> &func)//@;
+void //@
+x_sync_file_range (int fildes, off_t offset, off_t nbytes, unsigned int flags)//@;
 {
-  return process (libsh_treis::libc::no_raii::safe_fork (func));
+  if (libsh_treis::libc::detail::sync_file_range_reexported (fildes, offset, nbytes, flags) == -1)
+    {
+      THROW_ERRNO;
+    }
 }
 } //@
 
-//@ #include <memory>
+//@ #include <signal.h>
 namespace libsh_treis::libc //@
 { //@
-int //@
-x_waitpid_raii (std::unique_ptr<process> proc, int options)//@;
+struct sigaction //@
+x_sigaction (int sig, const struct sigaction *act)//@;
 {
-  LIBSH_TREIS_ASSERT (proc != nullptr);
+  struct sigaction oact;
 
-  process *ptr = proc.release ();
+  if (sigaction (sig, act, &oact) == -1)
+    {
+      THROW_ERRNO;
+    }
 
-  int result = x_waitpid_status (ptr->resource (), options);
+  return oact;
+}
+} //@
 
-  operator delete (ptr);
+//@ #include <signal.h>
+namespace libsh_treis::libc //@
+{ //@
+sigset_t //@
+x_sigemptyset (void)//@;
+{
+  sigset_t result;
+
+  if (sigemptyset (&result) == -1)
+    {
+      THROW_ERRNO;
+    }
 
   return result;
 }
 } //@
 
-// x_execv_string и x_execvp_string - для range'а объектов, у которых есть c_str ()
-
-//@ #include <vector>
-//@ namespace libsh_treis::libc
-//@ {
-//@ template <typename Iter> [[noreturn]] void
-//@ x_execv_string_nunu (const char *path, Iter b, Iter e)
-//@ {
-//@   std::vector<const char *> v;
-//@   for (; b != e; ++b)
-//@     {
-//@       v.push_back (b->c_str ());
-//@     }
-//@   v.push_back (nullptr);
-//@   x_execv_nunu (path, v.data ());
-//@ }
-//@ }
+#include <stdio.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_rename (const char *oldpath, const char *newpath)//@;
+{
+  if (rename (oldpath, newpath) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
 
-//@ #include <vector>
-//@ namespace libsh_treis::libc
-//@ {
-//@ template <typename Iter> [[noreturn]] void
-//@ x_execvp_string (const char *file, Iter b, Iter e)
-//@ {
-//@   std::vector<const char *> v;
+//@ #include <fcntl.h> // For AT_FDCWD
+//@ #include <linux/fs.h> // For RENAME_EXCHANGE, ...
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_renameat2 (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags)//@;
+{
+  if ((*libsh_treis::libc::detail::syscall_reexported) (SYS_renameat2, olddirfd, oldpath, newdirfd, newpath, flags) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+#include <unistd.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_linkat (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags)//@;
+{
+  if (linkat (olddirfd, oldpath, newdirfd, newpath, flags) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+//@ #include <sys/types.h>
+#include <sys/stat.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_fchmod (int fildes, mode_t mode)//@;
+{
+  if (fchmod (fildes, mode) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+//@ #include <sys/types.h>
+//@ #include <sys/mman.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+void * //@
+x_mmap (void *addr, size_t len, int prot, int flags, int fildes, off_t off)//@;
+{
+  void *result = mmap (addr, len, prot, flags, fildes, off);
+
+  if (result == MAP_FAILED)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+#include <sys/mman.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_munmap (std::span<std::byte> addr)//@;
+{
+  if (munmap (addr.data (), addr.size ()) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// Инклудит хедер для MADV_SEQUENTIAL и тому подобных
+//@ #include <span>
+//@ #include <cstddef>
+//@ #include <sys/mman.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_madvise (std::span<std::byte> addr, int advice)//@;
+{
+  if (madvise (addr.data (), addr.size (), advice) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// posix_fadvise возвращает номер ошибки, а не -1
+//@ #include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_posix_fadvise (int fildes, off_t offset, off_t len, int advice)//@;
+{
+  int err = posix_fadvise (fildes, offset, len, advice);
+
+  if (err != 0)
+    {
+      errno = err;
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// readahead и fallocate в glibc есть только с _GNU_SOURCE, поэтому вызываем их через gnu-source.cpp, как sync_file_range. Через syscall нельзя: off_t в variadic syscall на 32-битных платформах передаётся не так, как ждёт ядро
+//@ #include <sys/types.h>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_readahead (int fildes, off_t offset, std::size_t count)//@;
+{
+  if (libsh_treis::libc::detail::readahead_reexported (fildes, offset, count) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// Инклудит хедер для FALLOC_FL_PUNCH_HOLE, FALLOC_FL_KEEP_SIZE и тому подобных. PUNCH_HOLE требует KEEP_SIZE
+//@ #include <sys/types.h>
+//@ #include <linux/falloc.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_fallocate (int fildes, int mode, off_t offset, off_t len)//@;
+{
+  if (libsh_treis::libc::detail::fallocate_reexported (fildes, mode, offset, len) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// vec должен иметь не меньше (addr.size () + размер страницы - 1) / размер страницы элементов. addr.data () должен быть выровнен на страницу
+//@ #include <span>
+//@ #include <cstddef>
+#include <unistd.h>
+#include <sys/mman.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_mincore (std::span<std::byte> addr, std::span<unsigned char> vec)//@;
+{
+  std::size_t page = (std::size_t)sysconf (_SC_PAGESIZE);
+
+  LIBSH_TREIS_ASSERT (vec.size () >= (addr.size () + page - 1) / page);
+
+  if (mincore (addr.data (), addr.size (), vec.data ()) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// splice, tee, vmsplice и copy_file_range вызываем через syscall, как renameat2, т. к. в glibc они есть только с _GNU_SOURCE. Ядро принимает смещения как loff_t, т. е. 64-битные
+// Инклудит хедер для SPLICE_F_MOVE и тому подобных
+//@ #include <sys/types.h>
+//@ #include <fcntl.h>
+namespace libsh_treis::libc //@
+{ //@
+static_assert (sizeof (off_t) == 8);
+
+ssize_t //@
+x_splice (int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags)//@;
+{
+  ssize_t result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_splice, fd_in, off_in, fd_out, off_out, len, flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+
+ssize_t //@
+x_tee (int fd_in, int fd_out, size_t len, unsigned int flags)//@;
+{
+  ssize_t result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_tee, fd_in, fd_out, len, flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+
+ssize_t //@
+x_copy_file_range (int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags)//@;
+{
+  ssize_t result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_copy_file_range, fd_in, off_in, fd_out, off_out, len, flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// iovec'и передаются как есть, поэтому их не должно быть больше IOV_MAX
+//@ #include <sys/types.h>
+//@ #include <sys/uio.h>
+//@ #include <span>
+namespace libsh_treis::libc //@
+{ //@
+ssize_t //@
+x_vmsplice (int fd, std::span<const iovec> iov, unsigned int flags)//@;
+{
+  ssize_t result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_vmsplice, fd, iov.data (), iov.size (), flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <sys/types.h>
+#include <sys/sendfile.h>
+namespace libsh_treis::libc //@
+{ //@
+ssize_t //@
+x_sendfile (int out_fd, int in_fd, off_t *offset, size_t count)//@;
+{
+  ssize_t result = sendfile (out_fd, in_fd, offset, count);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// io_uring вызываем через syscall, без liburing
+//@ #include <linux/io_uring.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+int //@
+x_io_uring_setup (unsigned int entries, io_uring_params *p)//@;
+{
+  int result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_io_uring_setup, entries, p);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// sigset не передаём, т. к. пока не нужно
+// EINTR (сигнал во время ожидания) здесь не перезапускаем, т. к. часть SQE к этому моменту может быть уже отправлена. Правильно перезапускает uring::x_submit
+namespace libsh_treis::libc //@
+{ //@
+int //@
+x_io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags)//@;
+{
+  int result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_io_uring_enter, fd, to_submit, min_complete, flags, nullptr, 0);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+
+int //@
+x_io_uring_register (int fd, unsigned int opcode, const void *arg, unsigned int nr_args)//@;
+{
+  int result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_io_uring_register, fd, opcode, arg, nr_args);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// glibc 2.30+ тоже содержит getdents64, но только с _GNU_SOURCE, поэтому вызываем через syscall, как renameat2
+//@ #include <sys/types.h>
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+ssize_t //@
+x_getdents64 (int fd, std::span<std::byte> dirp)//@;
+{
+  ssize_t result = (*libsh_treis::libc::detail::syscall_reexported) (SYS_getdents64, fd, dirp.data (), dirp.size ());
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// xx-обёртки
+
+// Сбрасывает err flag перед вызовом getc
+//@ #include <stdio.h>
+namespace libsh_treis::libc //@
+{ //@
+char //@
+xx_fgetc_nunu (FILE *stream)//@;
+{
+  int result = x_fgetc (stream);
+
+  if (result == EOF)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+    }
+
+  return (char)(unsigned char)result;
+}
+} //@
+
+// Сбрасывает err flag перед вызовом getchar
+#include <stdio.h>
+namespace libsh_treis::libc //@
+{ //@
+char //@
+xx_getchar_nunu (void)//@;
+{
+  int result = x_getchar_nunu ();
+
+  if (result == EOF)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+    }
+
+  return (char)(unsigned char)result;
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+//@ #include <stdio.h>
+namespace libsh_treis::libc //@
+{ //@
+bool //@
+xx_fread (std::span<std::byte> buf, FILE *stream)//@;
+{
+  auto have_read = x_fread (buf, stream).size ();
+
+  if (have_read == buf.size ())
+    {
+      return true;
+    }
+
+  if (have_read == 0)
+    {
+      return false;
+    }
+
+  _LIBSH_TREIS_THROW_MESSAGE ("Partial data");
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+//@ #include <stdio.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+xxx_fread (std::span<std::byte> buf, FILE *stream)//@;
+{
+  if (!xx_fread (buf, stream))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+    }
+}
+} //@
+
+//@ #include <stdarg.h>
+//@ #include <span>
+namespace libsh_treis::libc //@
+{ //@
+std::span<char> //@
+xx_vsnprintf (std::span<char> s, const char *format, va_list ap)//@;
+{
+  int result = x_vsnprintf (s, format, ap);
+
+  if (result >= std::ssize (s))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Overflow");
+    }
+
+  return std::span<char> (s.data (), result);
+}
+} //@
+
+//@ #include <span>
+#include <stdarg.h>
+namespace libsh_treis::libc //@
+{ //@
+std::span<char> //@
+xx_snprintf (std::span<char> s, const char *format, ...)//@;
+{
+  va_list ap;
+  va_start (ap, format);
+  std::span<char> result = xx_vsnprintf (s, format, ap);
+  va_end (ap);
+  return result;
+}
+} //@
+
+#include <string.h>
+namespace libsh_treis::libc //@
+{ //@
+const char * //@
+xx_strrchr (const char *s, int c)//@;
+{
+  const char *result = strrchr (s, c);
+
+  if (result == nullptr)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Character not found");
+    }
+
+  return result;
+}
+
+char * //@
+xx_strrchr (char *s, int c)//@;
+{
+  char *result = strrchr (s, c);
+
+  if (result == nullptr)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Character not found");
+    }
+
+  return result;
+}
+} //@
+
+// Прочие функции
+
+// Такая функция пригодится (т. е. именно с таким API), если, скажем, нужно прочитать первые 1000 байт файла, чтобы узнать, текстовый ли этот файл
+// Необходимость повторять вызовы read может быть при чтении с терминала
+// Если buf.size () равен нулю, read не вызывается ни разу
+// Возвращаем std::span<std::byte>, т. к. именно это нужно в задаче чтения первых 1000 байт файла
+//@ #include <span>
+//@ #include <cstddef>
+#include <sys/types.h>
+namespace libsh_treis::libc //@
+{ //@
+std::span<std::byte> //@
+read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+{
+  auto to_fill = buf;
+
+  while (to_fill.size () > 0)
+    {
+      ssize_t result_of_x_read = x_read (fildes, to_fill);
+
+      if (result_of_x_read == 0)
+        {
+          break;
+        }
+
+      to_fill = to_fill.subspan (result_of_x_read);
+    }
+
+  return buf.first (buf.size () - to_fill.size ());
+}
+} //@
+
+// Такая функция пригодится, если мы читаем блоки фиксированного размера из файла один за другим
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+bool //@
+x_read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+{
+  auto have_read = read_repeatedly (fildes, buf).size ();
+
+  if (have_read == buf.size ())
+    {
+      return true;
+    }
+
+  if (have_read == 0)
+    {
+      return false;
+    }
+
+  _LIBSH_TREIS_THROW_MESSAGE ("Partial data");
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+xx_read_repeatedly (int fildes, std::span<std::byte> buf)//@;
+{
+  if (!x_read_repeatedly (fildes, buf))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+    }
+}
+} //@
+
+// Аналоги read_repeatedly, x_read_repeatedly и xx_read_repeatedly для чтения с заданного смещения. Не используют и не меняют file offset, поэтому один fd можно читать из нескольких потоков
+// Если buf.size () равен нулю, pread не вызывается ни разу
+//@ #include <sys/types.h>
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+std::span<std::byte> //@
+pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset)//@;
+{
+  auto to_fill = buf;
+
+  while (to_fill.size () > 0)
+    {
+      ssize_t result_of_x_pread = x_pread (fildes, to_fill, offset + (off_t)(buf.size () - to_fill.size ()));
+
+      if (result_of_x_pread == 0)
+        {
+          break;
+        }
+
+      to_fill = to_fill.subspan (result_of_x_pread);
+    }
+
+  return buf.first (buf.size () - to_fill.size ());
+}
+
+bool //@
+x_pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset)//@;
+{
+  auto have_read = pread_repeatedly (fildes, buf, offset).size ();
+
+  if (have_read == buf.size ())
+    {
+      return true;
+    }
+
+  if (have_read == 0)
+    {
+      return false;
+    }
+
+  _LIBSH_TREIS_THROW_MESSAGE ("Partial data");
+}
+
+void //@
+xx_pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset)//@;
+{
+  if (!x_pread_repeatedly (fildes, buf, offset))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+    }
+}
+} //@
+
+// Если buf.size () равно нулю, pwrite не вызывается ни разу
+//@ #include <sys/types.h>
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+pwrite_repeatedly (int fildes, std::span<const std::byte> buf, off_t offset)//@;
+{
+  while (buf.size () != 0)
+    {
+      ssize_t written = x_pwrite (fildes, buf, offset);
+      buf = buf.subspan (written);
+      offset += written;
+    }
+}
+} //@
+
+// Если buf.size () равно нулю, write не вызывается ни разу
+//@ #include <span>
+//@ #include <cstddef>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+write_repeatedly (int fildes, std::span<const std::byte> buf)//@;
+{
+  while (buf.size () != 0)
+    {
+      buf = buf.subspan (x_write (fildes, buf));
+    }
+}
+} //@
+
+// Аналог write_repeatedly для нескольких буферов: пишет всё, сколько бы раз ни пришлось вызвать writev. Частичная запись может оборваться посреди любого буфера, тогда следующий writev начнётся с середины этого буфера. Буферов может быть больше IOV_MAX
+// Если суммарный размер равен нулю, writev не вызывается ни разу
+//@ #include <span>
+//@ #include <cstddef>
+#include <limits.h>
+#include <sys/uio.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+writev_repeatedly (int fildes, std::span<const std::span<const std::byte>> bufs)//@;
+{
+  std::size_t offset = 0;
+
+  libsh_treis::libc::detail::advance_spans (bufs, offset, 0);
+
+  while (bufs.size () != 0)
+    {
+      iovec iov[IOV_MAX];
+      std::size_t n = libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, offset);
+      libsh_treis::libc::detail::advance_spans (bufs, offset, x_writev (fildes, std::span<const iovec> (iov, n)));
+    }
+}
+} //@
+
+// Аналог read_repeatedly для нескольких буферов: читает, пока не заполнит все буферы или не упрётся в EOF. Возвращает общее количество прочитанных байт
+// Если суммарный размер равен нулю, readv не вызывается ни разу
+//@ #include <sys/types.h> // ssize_t
+//@ #include <span>
+//@ #include <cstddef>
+#include <limits.h>
+#include <sys/uio.h>
+namespace libsh_treis::libc //@
+{ //@
+ssize_t //@
+readv_repeatedly (int fildes, std::span<const std::span<std::byte>> bufs)//@;
+{
+  std::size_t offset = 0;
+  ssize_t result = 0;
+
+  libsh_treis::libc::detail::advance_spans (bufs, offset, 0);
+
+  while (bufs.size () != 0)
+    {
+      iovec iov[IOV_MAX];
+      std::size_t n = libsh_treis::libc::detail::spans_to_iovecs (iov, bufs, offset);
+      ssize_t result_of_x_readv = x_readv (fildes, std::span<const iovec> (iov, n));
+
+      if (result_of_x_readv == 0)
+        {
+          break;
+        }
+
+      result += result_of_x_readv;
+      libsh_treis::libc::detail::advance_spans (bufs, offset, result_of_x_readv);
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <sys/types.h>
+//@ #include <unistd.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class fd: libsh_treis::tools::not_movable
+//@ {
+//@   int _fd;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit fd (int f) noexcept : _fd (f), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+
+//@   ~fd (void) noexcept (false)
+//@   {
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         x_close (_fd);
+//@       }
+//@     else
+//@       {
+//@         close (_fd);
+//@       }
+//@   }
+
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd;
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+fd //@
+x_open_2 (const char *path, int oflag)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_open_2 (path, oflag));
+}
+
+fd //@
+x_open_3 (const char *path, int oflag, mode_t mode)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_open_3 (path, oflag, mode));
+}
+
+fd //@
+x_mkstemp (char *templ)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_mkstemp (templ));
+}
+
+fd //@
+x_openat_3 (int dirfd, const char *path, int oflag)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_openat_3 (dirfd, path, oflag));
+}
+
+fd //@
+x_openat_4 (int dirfd, const char *path, int oflag, mode_t mode)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_openat_4 (dirfd, path, oflag, mode));
+}
+} //@
+
+// Мне не нравятся функции для парсинга целых чисел в стандартах C и C++, поэтому я пишу свою. А раз уж пишу свою, то в качестве back end'а буду использовать from_chars как самую низкоуровневую и быструю
+//@ #include <string_view>
+//@ #include <charconv>
+//@ #include <system_error>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename T> T
+//@ sto (std::string_view s)
+//@ {
+//@   if (s.size () == 0)
+//@     {
+//@       _LIBSH_TREIS_THROW_MESSAGE ("Empty string");
+//@     }
+
+//@   if (!(s[0] == '-' || ('0' <= s[0] && s[0] <= '9')))
+//@     {
+//@       _LIBSH_TREIS_THROW_MESSAGE ("Doesn't begin with [-0-9]");
+//@     }
+
+//@   T result;
+
+//@   auto [ptr, ec] = std::from_chars (s.data (), s.data () + s.size (), result);
+
+//@   if (ec != std::errc ())
+//@     {
+//@       _LIBSH_TREIS_THROW_MESSAGE ("Not a valid number (std::from_chars returned error)");
+//@     }
+
+//@   if (ptr != s.data () + s.size ())
+//@     {
+//@       _LIBSH_TREIS_THROW_MESSAGE ("There is a garbagge after number");
+//@     }
+
+//@   return result;
+//@ }
+//@ }
+
+// Массовый вариант sto: разбирает s - числа, разделённые delimiter (например, поле CSV или лога), и кладёт их в out. Правила для каждого числа те же, что у sto (никаких пробелов, '+' и мусора после числа). Пустое число (например, два delimiter'а подряд или delimiter в конце) - ошибка. Пустая s - ноль чисел
+// Вместо исключения на каждое число возвращает, где остановился:
+// - если всё разобрано, то count - количество чисел, position == s.size (), error == false
+// - если нашлось неправильное число, то error == true, position - начало этого числа в s, в out лежат count чисел до него
+// - если out закончился раньше s, то count == out.size (), position - начало следующего числа, error == false
+// Для целых чисел до 19 цифр не вызывает from_chars, а разбирает цифры по 8 штук за раз (SWAR: 8 байт как одно 64-битное число), т. е. 16-значное число - это два шага. Остальное (длинные числа, числа с плавающей точкой) - через std::from_chars
+//@ #include <cstddef>
+//@ #include <cstdint>
+//@ #include <string_view>
+//@ #include <span>
+//@ #include <bit>
+//@ #include <charconv>
+//@ #include <limits>
+//@ #include <type_traits>
+//@ #include <system_error>
+//@ #include <string.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ struct sto_span_result
+//@ {
+//@   std::size_t count;
+//@   std::size_t position;
+//@   bool error;
+//@ };
+//@
+//@ namespace detail
+//@ {
+//@ // Все 8 байт - цифры
+//@ inline bool
+//@ swar_is_8_digits (std::uint64_t chunk) noexcept
+//@ {
+//@   return ((chunk & 0xF0F0F0F0F0F0F0F0) | (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+//@ }
+//@
+//@ // 8 цифр в число. Первая цифра - в младшем байте (little endian)
+//@ inline std::uint64_t
+//@ swar_parse_8_digits (std::uint64_t chunk) noexcept
+//@ {
+//@   chunk = (chunk & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+//@   chunk = (chunk & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+//@   return (chunk & 0x0000FFFF0000FFFF) * 42949672960001 >> 32;
+//@ }
+//@
+//@ template <typename T> bool
+//@ sto_field (const char *begin, const char *end, T &result) noexcept
+//@ {
+//@   if (begin == end || !(*begin == '-' || ('0' <= *begin && *begin <= '9')))
+//@     {
+//@       return false;
+//@     }
+//@
+//@   if constexpr (std::is_integral_v<T> && std::endian::native == std::endian::little)
+//@     {
+//@       bool negative = *begin == '-';
+//@       const char *p = begin + negative;
+//@
+//@       if (p != end && end - p <= 19)
+//@         {
+//@           std::uint64_t value = 0;
+//@
+//@           for (; end - p >= 8; p += 8)
+//@             {
+//@               std::uint64_t chunk;
+//@               memcpy (&chunk, p, 8);
+//@
+//@               if (!swar_is_8_digits (chunk))
+//@                 {
+//@                   return false;
+//@                 }
+//@
+//@               value = value * 100000000 + swar_parse_8_digits (chunk);
+//@             }
+//@
+//@           for (; p != end; ++p)
+//@             {
+//@               if (!('0' <= *p && *p <= '9'))
+//@                 {
+//@                   return false;
+//@                 }
+//@
+//@               value = value * 10 + (*p - '0');
+//@             }
+//@
+//@           if (!negative)
+//@             {
+//@               if (value > (std::uint64_t)std::numeric_limits<T>::max ())
+//@                 {
+//@                   return false;
+//@                 }
+//@
+//@               result = (T)value;
+//@               return true;
+//@             }
+//@
+//@           // Для беззнаковых типов from_chars не принимает знак вообще, даже "-0"
+//@           if constexpr (std::is_signed_v<T>)
+//@             {
+//@               if (value > (std::uint64_t)std::numeric_limits<T>::max () + 1)
+//@                 {
+//@                   return false;
+//@                 }
+//@
+//@               result = (T)(0 - value);
+//@               return true;
+//@             }
+//@           else
+//@             {
+//@               return false;
+//@             }
+//@         }
+//@     }
+//@
+//@   auto [ptr, ec] = std::from_chars (begin, end, result);
+//@
+//@   return ec == std::errc () && ptr == end;
+//@ }
+//@ }
+//@
+//@ template <typename T> sto_span_result
+//@ sto_span (std::string_view s, char delimiter, std::span<T> out) noexcept
+//@ {
+//@   const char *begin = s.data ();
+//@   const char *end = s.data () + s.size ();
+//@   const char *p = begin;
+//@   std::size_t count = 0;
+//@
+//@   if (p == end)
+//@     {
+//@       return {.count = 0, .position = 0, .error = false};
+//@     }
+//@
+//@   for (;;)
+//@     {
+//@       if (count == out.size ())
+//@         {
+//@           return {.count = count, .position = (std::size_t)(p - begin), .error = false};
+//@         }
+//@
+//@       const char *field_end = (const char *)memchr (p, delimiter, end - p);
+//@
+//@       if (field_end == nullptr)
+//@         {
+//@           field_end = end;
+//@         }
+//@
+//@       if (!detail::sto_field (p, field_end, out[count]))
+//@         {
+//@           return {.count = count, .position = (std::size_t)(p - begin), .error = true};
+//@         }
+//@
+//@       ++count;
+//@
+//@       if (field_end == end)
+//@         {
+//@           return {.count = count, .position = s.size (), .error = false};
+//@         }
+//@
+//@       p = field_end + 1;
+//@     }
+//@ }
+//@ }
+
+// Не возвращаем результат [v]asprintf'а, т. к. его можно получить за O(1), вызвав size () у строки. Работает, даже если есть нулевые байты
+//@ #include <stdarg.h>
+//@ #include <string>
+#include <stdlib.h>
+namespace libsh_treis::libc //@
+{ //@
+std::string //@
+x_vasprintf (const char *fmt, va_list ap)//@;
+{
+  char *str;
+
+  int length = libsh_treis::libc::no_raii::x_vasprintf (&str, fmt, ap);
+
+  std::string result (str, length);
+
+  free (str);
+
+  return result;
+}
+} //@
+
+//@ #include <string>
+#include <stdarg.h>
+namespace libsh_treis::libc //@
+{ //@
+std::string //@
+x_asprintf (const char *fmt, ...)//@;
+{
+  va_list ap;
+  va_start (ap, fmt);
+  std::string result = x_vasprintf (fmt, ap);
+  va_end (ap);
+  return result;
+}
+} //@
+
+#include <stdlib.h>
+#include <sys/wait.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+process_succeed (int status)//@;
+{
+  if (!WIFEXITED (status))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Process status is not \"exited\"");
+    }
+
+  if (WEXITSTATUS (status) != EXIT_SUCCESS)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Process exit code is not 0");
+    }
+}
+} //@
+
+// Деструктор всегда делает pclose
+//@ #include <stdio.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class pipe_stream: libsh_treis::tools::not_movable
+//@ {
+//@   FILE *_stream;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit pipe_stream (FILE *stream) noexcept : _stream (stream), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+
+//@   ~pipe_stream (void) noexcept (false)
+//@   {
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         process_succeed (x_pclose (_stream));
+//@       }
+//@     else
+//@       {
+//@         pclose (_stream);
+//@       }
+//@   }
+
+//@   FILE *
+//@   resource (void) const noexcept
+//@   {
+//@     return _stream;
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+pipe_stream //@
+x_popen (const char *command, const char *mode)//@;
+{
+  return pipe_stream (libsh_treis::libc::no_raii::x_popen (command, mode));
+}
+} //@
+
+// Эта функция не является exception-safe
+//@ #include <memory>
+namespace libsh_treis::libc //@
+{ //@
+//@ struct pipe_result
+//@ {
+//@   std::unique_ptr<fd> readable;
+//@   std::unique_ptr<fd> writable;
+//@ };
+pipe_result //@
+x_pipe (void)//@;
+{
+  auto result = libsh_treis::libc::no_raii::x_pipe ();
+
+  return {.readable = std::unique_ptr<fd> (new fd (result.readable)), .writable = std::unique_ptr<fd> (new fd (result.writable))};
+}
+} //@
+
+// Эта функция не является exception-safe
+namespace libsh_treis::libc //@
+{ //@
+pipe_result //@
+x_pipe2 (int flags)//@;
+{
+  auto result = libsh_treis::libc::no_raii::x_pipe2 (flags);
+
+  return {.readable = std::unique_ptr<fd> (new fd (result.readable)), .writable = std::unique_ptr<fd> (new fd (result.writable))};
+}
+} //@
+
+// Вызывающая сторона должна сама flush'нуть C stdio и C++ streams перед вызовом этой функции. В том числе flush'нуть C stderr, т. к. он используется моей либой (если туда был вывод без '\n' в конце)
+//@ #include <sys/types.h>
+#include <stdlib.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+pid_t //@
+safe_fork (const std::function<void(void)> &func)//@;
+{
+  pid_t result = libsh_treis::libc::no_raii::x_fork ();
+
+  if (result == 0)
+    {
+      _Exit (libsh_treis::tools::main_helper (func));
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <sys/types.h>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+x_waitpid_status (pid_t pid, int options)//@;
+{
+  int result;
+
+  x_waitpid (pid, &result, options);
+
+  return result;
+}
+} //@
+
+// Деструктор всегда делает waitpid
+//@ #include <sys/types.h>
+//@ #include <sys/wait.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class process : libsh_treis::tools::not_movable
+//@ {
+//@   pid_t _pid;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit process (pid_t pid) noexcept : _pid (pid), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+
+//@   ~process (void) noexcept (false)
+//@   {
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         process_succeed (x_waitpid_status (_pid, 0));
+//@       }
+//@     else
+//@       {
+//@         waitpid (_pid, nullptr, 0);
+//@       }
+//@   }
+
+//@   pid_t
+//@   resource (void) const noexcept
+//@   {
+//@     return _pid;
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+process //@
+safe_fork (const std::function<void(void)> &func)//@;
+{
+  return process (libsh_treis::libc::no_raii::safe_fork (func));
+}
+} //@
+
+//@ #include <memory>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+x_waitpid_raii (std::unique_ptr<process> proc, int options)//@;
+{
+  LIBSH_TREIS_ASSERT (proc != nullptr);
+
+  process *ptr = proc.release ();
+
+  int result = x_waitpid_status (ptr->resource (), options);
+
+  operator delete (ptr);
+
+  return result;
+}
+} //@
+
+// x_execv_string и x_execvp_string - для range'а объектов, у которых есть c_str ()
+
+//@ #include <vector>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename Iter> [[noreturn]] void
+//@ x_execv_string_nunu (const char *path, Iter b, Iter e)
+//@ {
+//@   std::vector<const char *> v;
+//@   for (; b != e; ++b)
+//@     {
+//@       v.push_back (b->c_str ());
+//@     }
+//@   v.push_back (nullptr);
+//@   x_execv_nunu (path, v.data ());
+//@ }
+//@ }
+
+//@ #include <vector>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename Iter> [[noreturn]] void
+//@ x_execvp_string (const char *file, Iter b, Iter e)
+//@ {
+//@   std::vector<const char *> v;
+//@   for (; b != e; ++b)
+//@     {
+//@       v.push_back (b->c_str ());
+//@     }
+//@   v.push_back (nullptr);
+//@   x_execvp (file, v.data ());
+//@ }
+//@ }
+
+// Запуск процесса без fork: posix_spawnp (в glibc это clone (CLONE_VM | CLONE_VFORK)), т. е. без копирования таблиц страниц. На процессах с большим RSS это миллисекунды на каждого ребёнка
+// Вместо произвольного кода в ребёнке (как в safe_fork) - декларативное описание в spawn_options:
+// - dup2: пары {.from, .to}, применяются по порядку, т. е. в ребёнке to будет копией from. Если from == to, то с fd просто снимается FD_CLOEXEC
+// - chdir: директория ребёнка, nullptr - как у родителя
+// - sigmask: маска сигналов ребёнка, nullptr - как у родителя
+// - sigdefault: эти сигналы в ребёнке будут SIG_DFL (например, чтобы ребёнок не унаследовал игнорируемый SIGPIPE), nullptr - ничего не менять
+// - envp: окружение ребёнка, nullptr - environ родителя
+// Ошибки (в том числе "файл не найден") приходят исключением из этой функции, а не кодом возврата ребёнка
+//@ #include <vector>
+//@ #include <signal.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ struct spawn_dup2
+//@ {
+//@   int from;
+//@   int to;
+//@ };
+//@
+//@ struct spawn_options
+//@ {
+//@   std::vector<spawn_dup2> dup2;
+//@   const char *chdir = nullptr;
+//@   const sigset_t *sigmask = nullptr;
+//@   const sigset_t *sigdefault = nullptr;
+//@   char *const *envp = nullptr;
+//@ };
+//@ }
+
+#include <spawn.h>
+#include <errno.h>
+namespace libsh_treis::libc::detail
+{
+void
+x_spawn_check (int err)
+{
+  if (err != 0)
+    {
+      errno = err;
+      THROW_ERRNO;
+    }
+}
+
+class spawn_file_actions: libsh_treis::tools::not_movable
+{
+  posix_spawn_file_actions_t _actions;
+
+public:
+  spawn_file_actions (void)
+  {
+    x_spawn_check (posix_spawn_file_actions_init (&_actions));
+  }
+
+  ~spawn_file_actions (void)
+  {
+    posix_spawn_file_actions_destroy (&_actions);
+  }
+
+  posix_spawn_file_actions_t *
+  resource (void) noexcept
+  {
+    return &_actions;
+  }
+};
+
+class spawn_attr: libsh_treis::tools::not_movable
+{
+  posix_spawnattr_t _attr;
+
+public:
+  spawn_attr (void)
+  {
+    x_spawn_check (posix_spawnattr_init (&_attr));
+  }
+
+  ~spawn_attr (void)
+  {
+    posix_spawnattr_destroy (&_attr);
+  }
+
+  posix_spawnattr_t *
+  resource (void) noexcept
+  {
+    return &_attr;
+  }
+};
+}
+
+//@ #include <sys/types.h>
+#include <spawn.h>
+#include <unistd.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+pid_t //@
+x_spawnp (const char *file, const char *const argv[], const spawn_options &options)//@;
+{
+  libsh_treis::libc::detail::spawn_file_actions actions;
+  libsh_treis::libc::detail::spawn_attr attr;
+
+  for (const spawn_dup2 &d : options.dup2)
+    {
+      libsh_treis::libc::detail::x_spawn_check (posix_spawn_file_actions_adddup2 (actions.resource (), d.from, d.to));
+    }
+
+  if (options.chdir != nullptr)
+    {
+      libsh_treis::libc::detail::x_spawn_check (libsh_treis::libc::detail::posix_spawn_file_actions_addchdir_np_reexported (actions.resource (), options.chdir));
+    }
+
+  short flags = 0;
+
+  if (options.sigmask != nullptr)
+    {
+      libsh_treis::libc::detail::x_spawn_check (posix_spawnattr_setsigmask (attr.resource (), options.sigmask));
+      flags |= POSIX_SPAWN_SETSIGMASK;
+    }
+
+  if (options.sigdefault != nullptr)
+    {
+      libsh_treis::libc::detail::x_spawn_check (posix_spawnattr_setsigdefault (attr.resource (), options.sigdefault));
+      flags |= POSIX_SPAWN_SETSIGDEF;
+    }
+
+  libsh_treis::libc::detail::x_spawn_check (posix_spawnattr_setflags (attr.resource (), flags));
+
+  pid_t result;
+
+  int err = posix_spawnp (&result, file, actions.resource (), attr.resource (), (char *const *)argv, options.envp == nullptr ? libsh_treis::libc::detail::environ_reexported () : options.envp);
+
+  if (err != 0)
+    {
+      errno = err;
+      THROW_ERRNO_MESSAGE (file);
+    }
+
+  return result;
+}
+} //@
+
+namespace libsh_treis::libc //@
+{ //@
+process //@
+x_spawnp (const char *file, const char *const argv[], const spawn_options &options)//@;
+{
+  return process (libsh_treis::libc::no_raii::x_spawnp (file, argv, options));
+}
+} //@
+
+// То же для range'а объектов, у которых есть c_str (), как x_execvp_string
+//@ #include <vector>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename Iter> process
+//@ x_spawnp_string (const char *file, Iter b, Iter e, const spawn_options &options)
+//@ {
+//@   std::vector<const char *> v;
 //@   for (; b != e; ++b)
 //@     {
-//@       v.push_back (b->c_str ());
+//@       v.push_back (b->c_str ());
+//@     }
+//@   v.push_back (nullptr);
+//@   return x_spawnp (file, v.data (), options);
+//@ }
+//@ }
+
+//@ #include <sys/types.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+int //@
+x_pidfd_open (pid_t pid, unsigned int flags)//@;
+{
+  int result = (int)(*libsh_treis::libc::detail::syscall_reexported) (SYS_pidfd_open, pid, flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+//@ #include <sys/types.h>
+namespace libsh_treis::libc //@
+{ //@
+fd //@
+x_pidfd_open (pid_t pid, unsigned int flags)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_pidfd_open (pid, flags));
+}
+} //@
+
+//@ #include <signal.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_pidfd_send_signal (int pidfd, int sig, siginfo_t *info, unsigned int flags)//@;
+{
+  if ((*libsh_treis::libc::detail::syscall_reexported) (SYS_pidfd_send_signal, pidfd, sig, info, flags) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// С WNOHANG, если ребёнок ещё не завершился, возвращает siginfo_t с si_pid == 0
+//@ #include <signal.h>
+//@ #include <sys/wait.h>
+#include <string.h>
+namespace libsh_treis::libc //@
+{ //@
+siginfo_t //@
+x_waitid (idtype_t idtype, id_t id, int options)//@;
+{
+  siginfo_t result;
+
+  memset (&result, 0, sizeof (result));
+
+  if (waitid (idtype, id, &result, options) == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+// Переводит результат waitid в status в формате waitpid, т. е. такой, который понимают WIFEXITED и т. д. и process_succeed
+//@ #include <signal.h>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+siginfo_to_status (const siginfo_t &info)//@;
+{
+  switch (info.si_code)
+    {
+    case CLD_EXITED:
+      return (info.si_status & 0xff) << 8;
+    case CLD_KILLED:
+      return info.si_status & 0x7f;
+    case CLD_DUMPED:
+      return (info.si_status & 0x7f) | 0x80;
+    default:
+      _LIBSH_TREIS_THROW_MESSAGE ("Process is not terminated");
+    }
+}
+} //@
+
+// Как process, но держит pidfd. resource () можно добавить в poll или epoll: pidfd становится readable, когда ребёнок завершился. Тогда x_try_wait заберёт его, не блокируясь. Так один поток может следить за тысячами детей
+// Деструктор, как у process, ждёт ребёнка и проверяет его с помощью process_succeed, если его ещё не забрали с помощью x_wait или x_try_wait. Если деструктор вызван из-за исключения, то просто ждёт, ничего не проверяя
+// Конструктор принимает pid ребёнка, который ещё не забран (т. е. работает или стал зомби). Если pidfd_open не удался, конструктор бросает исключение, и ребёнка (который всё ещё может работать) должен забрать вызывающий. Сам конструктор ребёнка не ждёт: это может заблокироваться навсегда (например, если ребёнок читает stdin, а вызывающий держит трубу открытой)
+//@ #include <optional>
+//@ #include <sys/types.h>
+//@ #include <signal.h>
+//@ #include <sys/wait.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class pidfd_process : libsh_treis::tools::not_movable
+//@ {
+//@   pid_t _pid;
+//@   fd _pidfd;
+//@   bool _reaped;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit pidfd_process (pid_t pid);
+
+//@   ~pidfd_process (void) noexcept (false);
+
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _pidfd.resource ();
+//@   }
+
+//@   pid_t
+//@   pid (void) const noexcept
+//@   {
+//@     return _pid;
+//@   }
+
+//@   // Блокируется до завершения ребёнка, забирает его и возвращает status в формате waitpid
+//@   int
+//@   x_wait (void);
+
+//@   // Не блокируется. Если ребёнок завершился, забирает его и возвращает status в формате waitpid
+//@   std::optional<int>
+//@   x_try_wait (void);
+
+//@   void
+//@   x_send_signal (int sig);
+//@ };
+//@ }
+
+#include <sys/wait.h>
+namespace libsh_treis::libc
+{
+pidfd_process::pidfd_process (pid_t pid) : _pid (pid), _pidfd (libsh_treis::libc::no_raii::x_pidfd_open (pid, 0)), _reaped (false), _exceptions (std::uncaught_exceptions ())
+{
+}
+
+pidfd_process::~pidfd_process (void) noexcept (false)
+{
+  if (_reaped)
+    {
+      return;
+    }
+
+  if (std::uncaught_exceptions () == _exceptions)
+    {
+      process_succeed (x_wait ());
+    }
+  else
+    {
+      siginfo_t info;
+      waitid (P_PIDFD, (id_t)_pidfd.resource (), &info, WEXITED);
+    }
+}
+
+int
+pidfd_process::x_wait (void)
+{
+  LIBSH_TREIS_ASSERT (!_reaped);
+
+  int result = siginfo_to_status (x_waitid (P_PIDFD, (id_t)_pidfd.resource (), WEXITED));
+
+  _reaped = true;
+
+  return result;
+}
+
+std::optional<int>
+pidfd_process::x_try_wait (void)
+{
+  LIBSH_TREIS_ASSERT (!_reaped);
+
+  siginfo_t info = x_waitid (P_PIDFD, (id_t)_pidfd.resource (), WEXITED | WNOHANG);
+
+  if (info.si_pid == 0)
+    {
+      return std::nullopt;
+    }
+
+  _reaped = true;
+
+  return siginfo_to_status (info);
+}
+
+void
+pidfd_process::x_send_signal (int sig)
+{
+  LIBSH_TREIS_ASSERT (!_reaped);
+
+  x_pidfd_send_signal (_pidfd.resource (), sig, nullptr, 0);
+}
+}
+
+// x_spawnp, возвращающий pidfd_process. Если pidfd_open не удался, ребёнок убивается SIGKILL'ом и забирается, и бросается исключение
+#include <signal.h>
+#include <sys/wait.h>
+namespace libsh_treis::libc //@
+{ //@
+pidfd_process //@
+x_spawnp_pidfd (const char *file, const char *const argv[], const spawn_options &options)//@;
+{
+  pid_t pid = libsh_treis::libc::no_raii::x_spawnp (file, argv, options);
+
+  try
+    {
+      return pidfd_process (pid);
+    }
+  catch (...)
+    {
+      kill (pid, SIGKILL);
+      waitpid (pid, nullptr, 0);
+      throw;
+    }
+}
+} //@
+
+// Пул процессов: запускает команды (без shell'а, через x_spawnp_pidfd), не больше max_running одновременно, и обслуживает их всех в одном потоке через один poll
+// Каждой команде: stdin - неблокирующая (со стороны родителя) труба, в которую пишется input, после чего она закрывается. stdout - неблокирующая труба, куски из неё отдаются в on_output по мере поступления. stderr наследуется
+// Команда завершена, когда в stdout пришёл EOF и процесс завершился. Тогда вызывается on_exit (status в формате waitpid), а если on_exit пуст - process_succeed
+// Память ограничена: один буфер на чтение размера chunk_size на весь пул и max_running труб. input не копируется
+// Ребёнок, закрывший stdin раньше времени, просто перестаёт получать input. SIGPIPE при этом не приходит, даже если вызывающая сторона его не игнорирует
+// Если x_run бросает исключение (в том числе из callback'а), то трубы работающих детей закрываются, и каждый ребёнок ждётся, как в деструкторе pidfd_process
+//@ #include <cstddef>
+//@ #include <deque>
+//@ #include <functional>
+//@ #include <memory>
+//@ #include <span>
+//@ #include <string>
+//@ #include <string_view>
+//@ #include <vector>
+//@ namespace libsh_treis::libc
+//@ {
+//@ struct pool_command
+//@ {
+//@   // argv[0] ищется в PATH
+//@   std::vector<std::string> argv;
+//@   std::string_view input;
+//@   std::function<void(std::span<const std::byte>)> on_output;
+//@   std::function<void(int)> on_exit;
+//@ };
+
+//@ class process_pool : libsh_treis::tools::not_movable
+//@ {
+//@   struct running;
+
+//@   std::size_t _max_running;
+//@   std::size_t _chunk_size;
+//@   std::deque<pool_command> _queue;
+
+//@   void
+//@   _x_start (pool_command &&cmd, std::vector<std::unique_ptr<running>> &running);
+
+//@ public:
+//@   explicit process_pool (std::size_t max_running, std::size_t chunk_size = 64 * 1024);
+
+//@   // Можно вызывать и из callback'ов во время x_run
+//@   void
+//@   add (pool_command cmd);
+
+//@   // Выполняет все команды из очереди и возвращается, когда все они завершены
+//@   void
+//@   x_run (void);
+//@ };
+//@ }
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <time.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <utility>
+namespace libsh_treis::libc::detail
+{
+// write, который не порождает SIGPIPE. Менять диспозицию SIGPIPE библиотека не вправе (она общая для процесса), но SIGPIPE от write посылается потоку, поэтому на время write блокируем его в текущем потоке, а если write его породил, снимаем его с ожидания до того, как восстановить маску. SIGPIPE, который уже ждал доставки до write, не наш, его не трогаем. errno от write сохраняется
+ssize_t
+write_without_sigpipe (int fd, const void *buf, std::size_t count)
+{
+  sigset_t pipe_set;
+
+  LIBSH_TREIS_ASSERT (sigemptyset (&pipe_set) == 0);
+  LIBSH_TREIS_ASSERT (sigaddset (&pipe_set, SIGPIPE) == 0);
+
+  sigset_t old_mask;
+
+  LIBSH_TREIS_ASSERT (pthread_sigmask (SIG_BLOCK, &pipe_set, &old_mask) == 0);
+
+  sigset_t pending;
+
+  LIBSH_TREIS_ASSERT (sigpending (&pending) == 0);
+
+  bool was_pending = sigismember (&pending, SIGPIPE) == 1;
+  ssize_t result = write (fd, buf, count);
+  int saved_errno = errno;
+
+  if (result == -1 && saved_errno == EPIPE && !was_pending)
+    {
+      timespec zero = {.tv_sec = 0, .tv_nsec = 0};
+
+      while (sigtimedwait (&pipe_set, nullptr, &zero) == -1 && errno == EINTR)
+        {
+        }
+    }
+
+  LIBSH_TREIS_ASSERT (pthread_sigmask (SIG_SETMASK, &old_mask, nullptr) == 0);
+
+  errno = saved_errno;
+  return result;
+}
+}
+
+namespace libsh_treis::libc
+{
+// Порядок полей важен: при уничтожении трубы закрываются раньше, чем ждём процесс
+struct process_pool::running
+{
+  pidfd_process proc;
+  std::unique_ptr<fd> in;
+  std::unique_ptr<fd> out;
+  std::size_t written;
+  std::optional<int> status;
+  pool_command cmd;
+
+  explicit running (pid_t pid, std::unique_ptr<fd> i, std::unique_ptr<fd> o, pool_command &&c) : proc (pid), in (std::move (i)), out (std::move (o)), written (0), cmd (std::move (c))
+  {
+  }
+};
+
+process_pool::process_pool (std::size_t max_running, std::size_t chunk_size) : _max_running (max_running), _chunk_size (chunk_size)
+{
+  LIBSH_TREIS_ASSERT (max_running != 0);
+  LIBSH_TREIS_ASSERT (chunk_size != 0);
+}
+
+void
+process_pool::add (pool_command cmd)
+{
+  LIBSH_TREIS_ASSERT (!cmd.argv.empty ());
+  _queue.push_back (std::move (cmd));
+}
+
+void
+process_pool::_x_start (pool_command &&cmd, std::vector<std::unique_ptr<running>> &run)
+{
+  // O_CLOEXEC, чтобы другие дети не унаследовали чужие трубы. dup2 в ребёнке снимет его с 0 и 1
+  auto in = x_pipe2 (O_CLOEXEC);
+  auto out = x_pipe2 (O_CLOEXEC);
+
+  x_fcntl_3 (in.writable->resource (), F_SETFL, O_NONBLOCK);
+  x_fcntl_3 (out.readable->resource (), F_SETFL, O_NONBLOCK);
+
+  std::vector<const char *> argv;
+
+  for (const std::string &arg : cmd.argv)
+    {
+      argv.push_back (arg.c_str ());
+    }
+
+  argv.push_back (nullptr);
+
+  spawn_options options = {.dup2 = {{.from = in.readable->resource (), .to = 0}, {.from = out.writable->resource (), .to = 1}}};
+
+  // После запуска ребёнка push_back уже не должен бросать
+  run.reserve (run.size () + 1);
+
+  pid_t pid = libsh_treis::libc::no_raii::x_spawnp (argv[0], argv.data (), options);
+
+  // Концы труб, принадлежащие ребёнку, закрываем сразу. И stdin, если input пуст, тоже: иначе ребёнок, читающий stdin, не получит EOF, и ждать его будет нельзя
+  in.readable = nullptr;
+  out.writable = nullptr;
+
+  if (cmd.input.empty ())
+    {
+      in.writable = nullptr;
+    }
+
+  try
+    {
+      run.push_back (std::make_unique<running> (pid, std::move (in.writable), std::move (out.readable), std::move (cmd)));
+    }
+  catch (...)
+    {
+      // Не удалось создать pidfd (например, EMFILE) или выделить память. Ребёнок может ещё работать, держа наши трубы, так что просто ждать его нельзя
+      kill (pid, SIGKILL);
+      waitpid (pid, nullptr, 0);
+      throw;
+    }
+}
+
+void
+process_pool::x_run (void)
+{
+  std::vector<std::unique_ptr<running>> run;
+  std::vector<pollfd> fds;
+
+  // Для каждого pollfd: номер в run и что это (0 - stdin, 1 - stdout, 2 - pidfd)
+  std::vector<std::pair<std::size_t, int>> owners;
+  std::unique_ptr<std::byte[]> buf (new std::byte[_chunk_size]);
+
+  for (;;)
+    {
+      while (run.size () < _max_running && !_queue.empty ())
+        {
+          pool_command cmd = std::move (_queue.front ());
+          _queue.pop_front ();
+          _x_start (std::move (cmd), run);
+        }
+
+      if (run.empty ())
+        {
+          return;
+        }
+
+      fds.clear ();
+      owners.clear ();
+
+      for (std::size_t i = 0; i != run.size (); ++i)
+        {
+          if (run[i]->in != nullptr)
+            {
+              fds.push_back ({.fd = run[i]->in->resource (), .events = POLLOUT, .revents = 0});
+              owners.push_back ({i, 0});
+            }
+
+          if (run[i]->out != nullptr)
+            {
+              fds.push_back ({.fd = run[i]->out->resource (), .events = POLLIN, .revents = 0});
+              owners.push_back ({i, 1});
+            }
+
+          if (!run[i]->status)
+            {
+              fds.push_back ({.fd = run[i]->proc.resource (), .events = POLLIN, .revents = 0});
+              owners.push_back ({i, 2});
+            }
+        }
+
+      x_poll (fds, -1);
+
+      for (std::size_t j = 0; j != fds.size (); ++j)
+        {
+          if (fds[j].revents == 0)
+            {
+              continue;
+            }
+
+          running &r = *run[owners[j].first];
+
+          switch (owners[j].second)
+            {
+            case 0:
+              {
+                std::string_view rest = r.cmd.input.substr (r.written);
+                ssize_t n = libsh_treis::libc::detail::write_without_sigpipe (r.in->resource (), rest.data (), std::min (rest.size (), _chunk_size));
+
+                if (n == -1)
+                  {
+                    if (errno == EAGAIN || errno == EINTR)
+                      {
+                        break;
+                      }
+
+                    if (errno != EPIPE)
+                      {
+                        THROW_ERRNO;
+                      }
+
+                    // Ребёнку больше не нужен input
+                    r.in = nullptr;
+                    break;
+                  }
+
+                r.written += n;
+
+                if (r.written == r.cmd.input.size ())
+                  {
+                    r.in = nullptr;
+                  }
+              }
+              break;
+            case 1:
+              {
+                ssize_t n = read (r.out->resource (), buf.get (), _chunk_size);
+
+                if (n == -1)
+                  {
+                    if (errno == EAGAIN || errno == EINTR)
+                      {
+                        break;
+                      }
+
+                    THROW_ERRNO;
+                  }
+
+                if (n == 0)
+                  {
+                    r.out = nullptr;
+                    break;
+                  }
+
+                if (r.cmd.on_output)
+                  {
+                    r.cmd.on_output (std::span<const std::byte> (buf.get (), n));
+                  }
+              }
+              break;
+            case 2:
+              r.status = r.proc.x_try_wait ();
+              break;
+            }
+        }
+
+      // Идём с конца: на место удалённого встаёт последний, который уже проверен
+      for (std::size_t i = run.size (); i != 0; --i)
+        {
+          std::unique_ptr<running> &r = run[i - 1];
+
+          if (r->out != nullptr || !r->status)
+            {
+              continue;
+            }
+
+          std::unique_ptr<running> done = std::move (r);
+          r = std::move (run.back ());
+          run.pop_back ();
+
+          done->in = nullptr;
+
+          if (done->cmd.on_exit)
+            {
+              done->cmd.on_exit (*done->status);
+            }
+          else
+            {
+              process_succeed (*done->status);
+            }
+        }
+    }
+}
+}
+
+#include <sys/epoll.h>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+int //@
+x_epoll_create1 (int flags)//@;
+{
+  int result = epoll_create1 (flags);
+
+  if (result == -1)
+    {
+      THROW_ERRNO;
+    }
+
+  return result;
+}
+} //@
+
+namespace libsh_treis::libc //@
+{ //@
+fd //@
+x_epoll_create1 (int flags)//@;
+{
+  return fd (libsh_treis::libc::no_raii::x_epoll_create1 (flags));
+}
+} //@
+
+//@ #include <sys/epoll.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+x_epoll_ctl (int epfd, int op, int fildes, epoll_event *event)//@;
+{
+  if (epoll_ctl (epfd, op, fildes, event) == -1)
+    {
+      THROW_ERRNO;
+    }
+}
+} //@
+
+// Возвращает готовую часть events. Как и x_poll, перезапускается после EINTR (epoll_wait не перезапускается даже с SA_RESTART), ожидая оставшуюся часть timeout
+//@ #include <sys/epoll.h>
+//@ #include <span>
+#include <errno.h>
+#include <chrono>
+namespace libsh_treis::libc //@
+{ //@
+std::span<epoll_event> //@
+x_epoll_wait (int epfd, std::span<epoll_event> events, int timeout)//@;
+{
+  LIBSH_TREIS_ASSERT (events.size () != 0);
+
+  auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+
+  for (;;)
+    {
+      int result = epoll_wait (epfd, events.data (), (int)events.size (), libsh_treis::libc::detail::remaining_timeout (timeout, deadline));
+
+      if (result != -1)
+        {
+          return events.first (result);
+        }
+
+      if (errno != EINTR)
+        {
+          THROW_ERRNO;
+        }
+    }
+}
+} //@
+
+// Если sigmask == nullptr, то, как x_epoll_wait, перезапускается после EINTR. Иначе не перезапускается: sigmask обычно передают как раз затем, чтобы атомарно разблокировать сигналы на время ожидания и узнать о них по EINTR
+//@ #include <sys/epoll.h>
+//@ #include <signal.h>
+//@ #include <span>
+#include <errno.h>
+#include <chrono>
+namespace libsh_treis::libc //@
+{ //@
+std::span<epoll_event> //@
+x_epoll_pwait (int epfd, std::span<epoll_event> events, int timeout, const sigset_t *sigmask)//@;
+{
+  LIBSH_TREIS_ASSERT (events.size () != 0);
+
+  auto deadline = std::chrono::steady_clock::now () + std::chrono::milliseconds (timeout);
+
+  for (;;)
+    {
+      int result = epoll_pwait (epfd, events.data (), (int)events.size (), libsh_treis::libc::detail::remaining_timeout (timeout, deadline), sigmask);
+
+      if (result != -1)
+        {
+          return events.first (result);
+        }
+
+      if (errno != EINTR || sigmask != nullptr)
+        {
+          THROW_ERRNO;
+        }
+    }
+}
+} //@
+
+// Экземпляр epoll. Деструктор закрывает его, как деструктор fd
+//@ #include <sys/epoll.h>
+//@ #include <span>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class epoll : libsh_treis::tools::not_movable
+//@ {
+//@   fd _fd;
+
+//@ public:
+//@   explicit epoll (int flags = EPOLL_CLOEXEC) : _fd (libsh_treis::libc::no_raii::x_epoll_create1 (flags))
+//@   {
+//@   }
+
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd.resource ();
+//@   }
+
+//@   std::span<epoll_event>
+//@   x_wait (std::span<epoll_event> events, int timeout);
+//@ };
+//@ }
+
+#include <errno.h>
+#include <sys/epoll.h>
+namespace libsh_treis::libc
+{
+std::span<epoll_event>
+epoll::x_wait (std::span<epoll_event> events, int timeout)
+{
+  return x_epoll_wait (_fd.resource (), events, timeout);
+}
+}
+
+// Регистрация fd в epoll на время жизни объекта. Деструктор делает EPOLL_CTL_DEL, поэтому объект должен быть уничтожен раньше, чем закрыт fd (иначе EPOLL_CTL_DEL вернёт ошибку) и раньше, чем epoll
+// Как и у fd, исключение из деструктора бросается, только если он вызван не из-за исключения
+// Нельзя перемещать: data.ptr часто указывает на объект, который содержит регистрацию
+//@ #include <cstdint>
+//@ #include <sys/epoll.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class epoll_registration : libsh_treis::tools::not_movable
+//@ {
+//@   int _epfd;
+//@   int _fd;
+//@   epoll_data_t _data;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit epoll_registration (const epoll &ep, int fildes, std::uint32_t events, epoll_data_t data);
+
+//@   ~epoll_registration (void) noexcept (false);
+
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd;
+//@   }
+
+//@   void
+//@   x_modify (std::uint32_t events);
+//@ };
+//@ }
+
+#include <sys/epoll.h>
+namespace libsh_treis::libc
+{
+epoll_registration::epoll_registration (const epoll &ep, int fildes, std::uint32_t events, epoll_data_t data) : _epfd (ep.resource ()), _fd (fildes), _data (data), _exceptions (std::uncaught_exceptions ())
+{
+  epoll_event event = {.events = events, .data = data};
+  x_epoll_ctl (_epfd, EPOLL_CTL_ADD, _fd, &event);
+}
+
+epoll_registration::~epoll_registration (void) noexcept (false)
+{
+  if (std::uncaught_exceptions () == _exceptions)
+    {
+      x_epoll_ctl (_epfd, EPOLL_CTL_DEL, _fd, nullptr);
+    }
+  else
+    {
+      epoll_ctl (_epfd, EPOLL_CTL_DEL, _fd, nullptr);
+    }
+}
+
+void
+epoll_registration::x_modify (std::uint32_t events)
+{
+  epoll_event event = {.events = events, .data = _data};
+  x_epoll_ctl (_epfd, EPOLL_CTL_MOD, _fd, &event);
+}
+}
+
+// Цикл событий: ждёт событий в ep, кладёт их пачкой в batch и отдаёт готовую часть в f, пока f не вернёт false. EINTR перезапускает ожидание
+// Рассчитан на edge-triggered регистрации (EPOLLET): за один epoll_wait обрабатывается сразу много fd, и f должна читать/писать каждый fd до EAGAIN, иначе следующего события по нему не будет
+//@ #include <sys/epoll.h>
+//@ #include <span>
+//@ namespace libsh_treis::libc
+//@ {
+//@ template <typename F> void
+//@ x_epoll_loop (epoll &ep, std::span<epoll_event> batch, F &&f)
+//@ {
+//@   for (;;)
+//@     {
+//@       if (!f (ep.x_wait (batch, -1)))
+//@         {
+//@           return;
+//@         }
+//@     }
+//@ }
+//@ }
+
+//@ // Выделяет память для массива, инициализируя с помощью default initializing. Независимо от того, что написано в стандарте. Добавил, т. к. не нашёл подобной функции в моей реализации стандартной библиотеки C++. Когда будет везде, надо будет удалить
+//@ #include <cstddef>
+//@ #include <memory>
+//@ #include <type_traits>
+//@ namespace libsh_treis::tools
+//@ {
+//@ template <typename T> std::unique_ptr<T>
+//@ make_unique_default_init (std::size_t size)
+//@ {
+//@   static_assert (std::is_unbounded_array_v<T>);
+//@   return std::unique_ptr<T> (new std::remove_extent_t<T>[size]);
+//@ }
+//@ }
+
+//@ // Owning span
+//@ // Предназначен, например, для хранения данных сразу после чтения read'ом или перед записыванием write'ом. От unique_ptr<T[]> отличается отсутствием особого состояния и хранением длины
+//@ // От std::vector отличается отсутствием особого состояния (vector можно переместить и оставить исходный объект в пустом состоянии)
+//@ // Можно создать ospan нулевой длины. Но идеоматический код не должен использовать такой ospan как маркер отсутствия ospan'а
+//@ // ospan нельзя перемещать. Копировать можно, но на данный момент не реализовано
+//@ // Методы begin и end нужны, иначе в debian sid от 2022-05-30 с clang'ом из репы debian нельзя конвертить этот ospan в span
+//@ #include <cstddef>
+//@ #include <cassert>
+//@ #include <type_traits>
+//@ #include <utility>
+//@ namespace libsh_treis::tools
+//@ {
+//@ template <typename T> class ospan: libsh_treis::tools::not_movable
+//@ {
+//@   static_assert (!std::is_unbounded_array_v<T>);
+
+//@   T *_ptr;
+//@   std::size_t _size;
+
+//@   explicit ospan (T *ptr, std::size_t size) noexcept : _ptr (ptr), _size (size)
+//@   {
+//@   }
+
+//@   template <typename U> friend ospan<U>
+//@   make_ospan (std::size_t size);
+
+//@   template <typename U> friend ospan<U>
+//@   make_ospan_for_overwrite (std::size_t size);
+
+//@   template <typename U> friend void
+//@   swap (ospan<U> &, ospan<U> &) noexcept;
+
+//@ public:
+//@   ~ospan (void)
+//@   {
+//@     delete [] _ptr;
+//@   }
+
+//@   const T *
+//@   data (void) const noexcept
+//@   {
+//@     return _ptr;
+//@   }
+
+//@   T *
+//@   data (void) noexcept
+//@   {
+//@     return _ptr;
+//@   }
+
+//@   std::size_t
+//@   size (void) const noexcept
+//@   {
+//@     return _size;
+//@   }
+
+//@   const T *
+//@   begin (void) const noexcept
+//@   {
+//@     return _ptr;
+//@   }
+
+//@   T *
+//@   begin (void) noexcept
+//@   {
+//@     return _ptr;
+//@   }
+
+//@   const T *
+//@   end (void) const noexcept
+//@   {
+//@     return _ptr + _size;
+//@   }
+
+//@   T *
+//@   end (void) noexcept
+//@   {
+//@     return _ptr + _size;
+//@   }
+
+//@   const T &
+//@   operator[] (std::size_t i) const noexcept
+//@   {
+//@     assert (i < _size);
+//@     return _ptr[i];
+//@   }
+
+//@   T &
+//@   operator[] (std::size_t i) noexcept
+//@   {
+//@     assert (i < _size);
+//@     return _ptr[i];
+//@   }
+//@ };
+
+//@ template <typename T> void
+//@ swap (ospan<T> &a, ospan<T> &b) noexcept
+//@ {
+//@   std::swap (a._ptr,  b._ptr);
+//@   std::swap (a._size, b._size);
+//@ }
+
+//@ template <typename T> ospan<T>
+//@ make_ospan (std::size_t size)
+//@ {
+//@   return ospan<T> (new T[size](), size);
+//@ }
+
+//@ template <typename T> ospan<T>
+//@ make_ospan_for_overwrite (std::size_t size)
+//@ {
+//@   return ospan<T> (new T[size], size);
+//@ }
+//@ }
+
+// Один из возможных алгоритмов правильного соединения компонентов пути. Используется тот алгоритм, который использует GNU find
+//@ #include <string_view>
+namespace libsh_treis::tools //@
+{ //@
+std::string //@
+build_path_find (std::string_view up, std::string_view down)//@;
+{
+  LIBSH_TREIS_ASSERT (!up.empty ());
+  LIBSH_TREIS_ASSERT (!down.empty ());
+  LIBSH_TREIS_ASSERT (down.front () != '/');
+
+  if (up.back () == '/')
+    {
+      return std::string (up) + std::string (down);
+    }
+  else
+    {
+      return std::string (up) + "/" + std::string (down);
+    }
+}
+} //@
+
+//@ #include <dirent.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class directory: libsh_treis::tools::not_movable
+//@ {
+//@   DIR *_d;
+//@   int _exceptions;
+
+//@ public:
+//@   explicit directory (DIR *d) noexcept : _d (d), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+
+//@   ~directory (void) noexcept (false)
+//@   {
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         x_closedir (_d);
+//@       }
+//@     else
+//@       {
+//@         closedir (_d);
+//@       }
+//@   }
+
+//@   DIR *
+//@   resource (void) const noexcept
+//@   {
+//@     return _d;
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+directory //@
+x_opendir (const char *dirname)//@;
+{
+  return directory (libsh_treis::libc::no_raii::x_opendir (dirname));
+}
+} //@
+
+// Замена x_readdir для больших каталогов: читает записи пачками с помощью getdents64 в большой буфер, который переиспользуется. В отличие от readdir, не трогает errno и не копирует имена: name указывает прямо в буфер и живёт до следующего x_readdir
+// Объект не владеет dirfd, т. е. не закрывает его. dirfd можно получить, например, с помощью x_open_2 (path, O_RDONLY | O_DIRECTORY | O_CLOEXEC)
+// Как и readdir, возвращает все записи, включая "." и "..". type - DT_REG, DT_DIR и т. д., на некоторых ФС может быть DT_UNKNOWN
+//@ #include <cstddef>
+//@ #include <optional>
+//@ #include <sys/types.h>
+//@ #include <dirent.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ struct directory_entry
+//@ {
+//@   libsh_treis::tools::cstring_span name;
+//@   ino64_t ino;
+//@   unsigned char type;
+//@ };
+//@
+//@ class directory_reader: libsh_treis::tools::not_movable
+//@ {
+//@   int _fd;
+//@   libsh_treis::tools::ospan<std::byte> _buf;
+//@   std::size_t _pos;
+//@   std::size_t _end;
+//@
+//@ public:
+//@   static constexpr std::size_t default_buffer_size = 256 * 1024;
+//@
+//@   explicit directory_reader (int dirfd);
+//@
+//@   explicit directory_reader (int dirfd, std::size_t buffer_size);
+//@
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd;
+//@   }
+//@
+//@   std::optional<directory_entry>
+//@   x_readdir (void);
+//@ };
+//@ }
+
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+namespace libsh_treis::libc
+{
+directory_reader::directory_reader (int dirfd) : directory_reader (dirfd, default_buffer_size)
+{
+}
+
+directory_reader::directory_reader (int dirfd, std::size_t buffer_size) : _fd (dirfd), _buf (libsh_treis::tools::make_ospan_for_overwrite<std::byte> (buffer_size)), _pos (0), _end (0)
+{
+}
+
+std::optional<directory_entry>
+directory_reader::x_readdir (void)
+{
+  if (_pos == _end)
+    {
+      _end = x_getdents64 (_fd, _buf);
+      _pos = 0;
+
+      if (_end == 0)
+        {
+          return std::nullopt;
+        }
+    }
+
+  // Запись - это struct linux_dirent64 из man 2 getdents: d_ino (8 байт), d_off (8 байт), d_reclen (2 байта), d_type (1 байт), d_name. Записи выровнены на 8 байт
+  std::byte *record = _buf.data () + _pos;
+  uint64_t ino;
+  uint16_t reclen;
+
+  memcpy (&ino, record, sizeof (ino));
+  memcpy (&reclen, record + 16, sizeof (reclen));
+
+  char *name = (char *)(record + 19);
+
+  _pos += reclen;
+
+  return directory_entry {.name = libsh_treis::tools::make_cstring_span_unsafe (name, strlen (name)), .ino = (ino64_t)ino, .type = (unsigned char)record[18]};
+}
+}
+
+// Рекурсивный обход дерева каталогов, аналог find. Каталоги открываются с помощью openat относительно родительского каталога, а не по полному пути, так что ядру не нужно каждый раз разбирать путь с начала. Полный путь строится только для каталогов (dir_path), для остальных записей его при необходимости можно получить с помощью build_path_find (dir_path, name.sv ())
+// Сам root не передаётся в callback. Ссылки не разыменовываются (кроме самого root)
+// callback вызывается для каждой записи (кроме "." и ".."). Для каталога возвращаемое значение говорит, спускаться ли в него. Для остальных записей оно игнорируется
+// type никогда не равен DT_UNKNOWN: если ФС не сообщает тип, делаем statx. Если statx_mask != 0, то statx с этой маской (и флагами AT_SYMLINK_NOFOLLOW | statx_flags, например, AT_STATX_DONT_SYNC) делается для всех записей, иначе - только для тех, где без этого не обойтись, и тогда stx == nullptr
+// Если ordered, то обход в глубину, записи каждого каталога - в порядке strcmp, всё в текущем потоке (threads игнорируется). Если threads == 1, то тоже обход в глубину в текущем потоке, но без сортировки. Иначе обход в threads потоках (включая текущий), порядок не определён, и callback вызывается одновременно из разных потоков. Потоки берут каталоги из своих очередей, а когда своя очередь пуста, забирают работу из чужих
+// Записи, которые исчезли во время обхода (между getdents и statx или openat), молча пропускаются, как в find. Каталог, удалённый во время чтения, считается закончившимся. Исчезновение самого root - ошибка
+// Если callback или обход бросит исключение, обход прекращается (в параллельном режиме - после того, как каждый поток доделает текущий каталог), и исключение бросается дальше. Если исключений несколько, бросается одно из них
+//@ #include <functional>
+//@ #include <string>
+//@ #include <sys/types.h>
+//@ #include <linux/stat.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ struct walk_entry
+//@ {
+//@   int dirfd;
+//@   const std::string &dir_path;
+//@   libsh_treis::tools::cstring_span name;
+//@   unsigned char type;
+//@   ino64_t ino;
+//@   const struct statx *stx;
+//@   int depth; // 1 для записей в самом root
+//@ };
+//@
+//@ struct walk_options
+//@ {
+//@   int threads;
+//@   bool ordered;
+//@   unsigned int statx_mask;
+//@   int statx_flags;
+//@ };
+//@ }
+
+#include <string.h>
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+namespace libsh_treis::libc::detail
+{
+// Открытый каталог, который разделяют несколько walk_job. Закрывается в деструкторе shared_ptr, откуда нельзя бросать исключение, поэтому ошибка close игнорируется (это каталог, открытый только на чтение, так что ничего не теряется)
+class walk_dir : libsh_treis::tools::not_movable
+{
+  int _fd;
+
+public:
+  explicit walk_dir (int f) noexcept : _fd (f)
+  {
+  }
+
+  ~walk_dir (void)
+  {
+    close (_fd);
+  }
+
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+};
+
+// Каталог, в который нужно спуститься. parent держит родительский каталог открытым, пока не обработаны все его подкаталоги. Если parent == nullptr, то каталог открывается по полному пути (для root и для глубоких каталогов в walk_ordered)
+struct walk_job
+{
+  std::shared_ptr<walk_dir> parent;
+  std::string path;
+  std::size_t name_offset;
+  int depth;
+};
+
+// В walk_ordered на каждый уровень вложенности открыт один каталог. Глубже этого уровня каталог закрывается перед спуском в подкаталог и потом открывается заново по полному пути, чтобы глубокое дерево не упёрлось в EMFILE
+constexpr int walk_max_open_depth = 64;
+
+bool
+walk_is_dot (const char *name) noexcept
+{
+  return name[0] == '.' && (name[1] == '\0' || (name[1] == '.' && name[2] == '\0'));
+}
+
+// Вызывает callback для записи, при необходимости делая statx. Возвращает, нужно ли спускаться в запись. Если запись уже исчезла, callback не вызывается
+bool
+walk_visit (int dirfd, const std::string &dir_path, const directory_entry &entry, int depth, const walk_options &options, const std::function<bool (const walk_entry &)> &callback)
+{
+  unsigned char type = entry.type;
+  struct statx stx;
+  bool have_stat = false;
+
+  if (options.statx_mask != 0 || type == DT_UNKNOWN)
+    {
+      try
+        {
+          stx = x_statx (dirfd, entry.name.c_str (), AT_SYMLINK_NOFOLLOW | options.statx_flags, options.statx_mask | STATX_TYPE);
+        }
+      catch (const errno_error &ex)
+        {
+          if (ex.error_number () == ENOENT)
+            {
+              return false;
+            }
+
+          throw;
+        }
+
+      type = IFTODT (stx.stx_mode);
+      have_stat = true;
+    }
+
+  bool descend = callback (walk_entry {.dirfd = dirfd, .dir_path = dir_path, .name = entry.name, .type = type, .ino = entry.ino, .stx = have_stat ? &stx : nullptr, .depth = depth});
+
+  return descend && type == DT_DIR;
+}
+
+// Ссылки разыменовываются только для самого root. Если каталог (не root) исчез или был заменён не-каталогом после getdents, возвращает nullptr
+std::shared_ptr<walk_dir>
+walk_open (const walk_job &job)
+{
+  int parent = job.parent == nullptr ? AT_FDCWD : job.parent->resource ();
+  const char *path = job.path.c_str () + (job.parent == nullptr ? 0 : job.name_offset);
+
+  try
+    {
+      return std::make_shared<walk_dir> (libsh_treis::libc::no_raii::x_openat_3 (parent, path, O_RDONLY | O_DIRECTORY | (job.depth == 0 ? 0 : O_NOFOLLOW) | O_CLOEXEC));
+    }
+  catch (const errno_error &ex)
+    {
+      if (job.depth != 0 && (ex.error_number () == ENOENT || ex.error_number () == ENOTDIR))
+        {
+          return nullptr;
+        }
+
+      throw;
+    }
+}
+
+// getdents на удалённом каталоге даёт ENOENT. Считаем такой каталог закончившимся
+std::optional<directory_entry>
+walk_readdir (directory_reader &reader)
+{
+  try
+    {
+      return reader.x_readdir ();
+    }
+  catch (const errno_error &ex)
+    {
+      if (ex.error_number () == ENOENT)
+        {
+          return std::nullopt;
+        }
+
+      throw;
+    }
+}
+
+// Обход в глубину в текущем потоке. Если sorted, то записи каждого каталога - в порядке strcmp
+void
+walk_ordered (const walk_job &job, bool sorted, const walk_options &options, const std::function<bool (const walk_entry &)> &callback)
+{
+  std::shared_ptr<walk_dir> dir = walk_open (job);
+
+  if (dir == nullptr)
+    {
+      return;
+    }
+
+  // Имена приходится копировать: их надо отсортировать, а буфер directory_reader'а не переживает спуск в подкаталоги
+  std::vector<std::pair<std::string, directory_entry>> entries;
+
+  {
+    directory_reader reader (dir->resource (), 32 * 1024);
+
+    while (auto entry = walk_readdir (reader))
+      {
+        if (!walk_is_dot (entry->name.c_str ()))
+          {
+            entries.emplace_back (entry->name.str (), *entry);
+          }
+      }
+  }
+
+  if (sorted)
+    {
+      std::sort (entries.begin (), entries.end (), [](const auto &a, const auto &b){ return a.first < b.first; });
+    }
+
+  bool keep_open = job.depth < walk_max_open_depth;
+
+  for (auto &[name, entry] : entries)
+    {
+      entry.name = libsh_treis::tools::make_cstring_span_unsafe (name.data (), name.size ());
+
+      if (dir == nullptr)
+        {
+          dir = walk_open (walk_job {.parent = nullptr, .path = job.path, .name_offset = 0, .depth = job.depth});
+
+          if (dir == nullptr)
+            {
+              return;
+            }
+        }
+
+      if (walk_visit (dir->resource (), job.path, entry, job.depth + 1, options, callback))
+        {
+          std::string path = libsh_treis::tools::build_path_find (job.path, name);
+          std::size_t name_offset = path.size () - name.size ();
+
+          if (!keep_open)
+            {
+              dir = nullptr;
+            }
+
+          walk_ordered (walk_job {.parent = dir, .path = std::move (path), .name_offset = name_offset, .depth = job.depth + 1}, sorted, options, callback);
+        }
+    }
+}
+
+class walk_parallel
+{
+  struct alignas (64) queue
+  {
+    std::mutex mutex;
+    std::deque<walk_job> jobs;
+  };
+
+  const walk_options &_options;
+  const std::function<bool (const walk_entry &)> &_callback;
+  std::vector<queue> _queues;
+  std::atomic<long> _pending; // Каталоги, которые добавлены в очереди, но ещё не обработаны до конца
+  std::atomic<long> _queued; // Каталоги, которые лежат в очередях
+  std::atomic<int> _sleepers; // Потоки, которые ждут в _idle (или собираются)
+  std::atomic<bool> _failed;
+  std::mutex _idle_mutex;
+  std::condition_variable _idle;
+  std::exception_ptr _error;
+
+  void
+  _push (int worker, walk_job job)
+  {
+    // Увеличиваем _pending до того, как работа станет видна другим потокам, иначе _pending может временно упасть до нуля, и потоки завершатся раньше времени
+    _pending.fetch_add (1);
+
+    {
+      std::lock_guard<std::mutex> lock (_queues[worker].mutex);
+      _queues[worker].jobs.push_back (std::move (job));
+    }
+
+    // Ждущий поток сначала увеличивает _sleepers, потом проверяет _queued (под _idle_mutex). Мы - наоборот. Оба атомика seq_cst, поэтому хотя бы один из нас увидит запись другого: либо он не уснёт, либо мы его разбудим. notify под _idle_mutex, чтобы он не потерялся между проверкой и wait
+    _queued.fetch_add (1);
+
+    if (_sleepers.load () != 0)
+      {
+        std::lock_guard<std::mutex> lock (_idle_mutex);
+        _idle.notify_one ();
+      }
+  }
+
+  // Свою очередь берём с конца (обход в глубину, меньше открытых каталогов), чужие - с начала
+  bool
+  _pop (int worker, walk_job &job)
+  {
+    for (int i = 0; i != (int)_queues.size (); ++i)
+      {
+        queue &q = _queues[(worker + i) % _queues.size ()];
+        std::lock_guard<std::mutex> lock (q.mutex);
+
+        if (!q.jobs.empty ())
+          {
+            _queued.fetch_sub (1);
+
+            if (i == 0)
+              {
+                job = std::move (q.jobs.back ());
+                q.jobs.pop_back ();
+              }
+            else
+              {
+                job = std::move (q.jobs.front ());
+                q.jobs.pop_front ();
+              }
+
+            return true;
+          }
+      }
+
+    return false;
+  }
+
+  void
+  _process (int worker, const walk_job &job)
+  {
+    std::shared_ptr<walk_dir> dir = walk_open (job);
+
+    if (dir == nullptr)
+      {
+        return;
+      }
+
+    directory_reader reader (dir->resource (), 32 * 1024);
+
+    while (auto entry = walk_readdir (reader))
+      {
+        if (walk_is_dot (entry->name.c_str ()))
+          {
+            continue;
+          }
+
+        if (walk_visit (dir->resource (), job.path, *entry, job.depth + 1, _options, _callback))
+          {
+            std::string path = libsh_treis::tools::build_path_find (job.path, entry->name.sv ());
+            std::size_t name_offset = path.size () - entry->name.sv ().size ();
+            _push (worker, walk_job {.parent = dir, .path = std::move (path), .name_offset = name_offset, .depth = job.depth + 1});
+          }
+      }
+  }
+
+  void
+  _work (int worker) noexcept
+  {
+    for (;;)
+      {
+        walk_job job;
+
+        if (!_failed.load () && _pop (worker, job))
+          {
+            try
+              {
+                _process (worker, job);
+              }
+            catch (...)
+              {
+                std::lock_guard<std::mutex> lock (_idle_mutex);
+
+                if (_error == nullptr)
+                  {
+                    _error = std::current_exception ();
+                  }
+
+                _failed.store (true);
+                _idle.notify_all ();
+              }
+
+            if (_pending.fetch_sub (1) == 1)
+              {
+                std::lock_guard<std::mutex> lock (_idle_mutex);
+                _idle.notify_all ();
+              }
+
+            continue;
+          }
+
+        std::unique_lock<std::mutex> lock (_idle_mutex);
+
+        if (_pending.load () == 0 || _failed.load ())
+          {
+            _idle.notify_all ();
+            return;
+          }
+
+        _sleepers.fetch_add (1);
+        _idle.wait (lock, [this]{ return _queued.load () > 0 || _pending.load () == 0 || _failed.load (); });
+        _sleepers.fetch_sub (1);
+      }
+  }
+
+public:
+  walk_parallel (const walk_options &options, const std::function<bool (const walk_entry &)> &callback) : _options (options), _callback (callback), _queues (options.threads), _pending (0), _queued (0), _sleepers (0), _failed (false)
+  {
+  }
+
+  void
+  x_run (walk_job root)
+  {
+    _push (0, std::move (root));
+
+    std::vector<std::thread> threads;
+
+    try
+      {
+        for (int i = 1; i != _options.threads; ++i)
+          {
+            threads.emplace_back ([this, i](void){ _work (i); });
+          }
+      }
+    catch (...)
+      {
+        // Не удалось создать поток. Останавливаем уже созданные
+        {
+          std::lock_guard<std::mutex> lock (_idle_mutex);
+          _failed.store (true);
+          _idle.notify_all ();
+        }
+
+        for (auto &thread : threads)
+          {
+            thread.join ();
+          }
+
+        throw;
+      }
+
+    _work (0);
+
+    for (auto &thread : threads)
+      {
+        thread.join ();
+      }
+
+    if (_error != nullptr)
+      {
+        std::rethrow_exception (_error);
+      }
+  }
+};
+}
+
+namespace libsh_treis::libc //@
+{ //@
+void //@
+walk_tree (const char *root, const walk_options &options, const std::function<bool (const walk_entry &)> &callback)//@;
+{
+  LIBSH_TREIS_ASSERT (options.threads >= 1);
+
+  libsh_treis::libc::detail::walk_job job {.parent = nullptr, .path = root, .name_offset = 0, .depth = 0};
+
+  if (options.ordered || options.threads == 1)
+    {
+      libsh_treis::libc::detail::walk_ordered (job, options.ordered, options, callback);
+    }
+  else
+    {
+      libsh_treis::libc::detail::walk_parallel (options, callback).x_run (std::move (job));
+    }
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+#include <string.h>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+span_memcmp (std::span<const std::byte> s1, std::span<const std::byte> s2) noexcept//@;
+{
+  LIBSH_TREIS_ASSERT (s1.size () == s2.size ());
+  return memcmp (s1.data (), s2.data (), s1.size ());
+}
+} //@
+
+//@ #include <span>
+//@ #include <cstddef>
+#include <string.h>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+span_memcpy (std::span<std::byte> dest, std::span<const std::byte> src) noexcept//@;
+{
+  LIBSH_TREIS_ASSERT (dest.size () == src.size ());
+  memcpy (dest.data (), src.data (), dest.size ());
+}
+} //@
+
+//@ #include <stdio.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class fp: libsh_treis::tools::not_movable
+//@ {
+//@   FILE *_fp;
+//@   int _exceptions;
+//@
+//@ public:
+//@   explicit fp (FILE *f) noexcept : _fp (f), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+//@
+//@   ~fp (void) noexcept (false)
+//@   {
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         x_fclose (_fp);
+//@       }
+//@     else
+//@       {
+//@         fclose (_fp);
+//@       }
+//@   }
+//@
+//@   FILE *
+//@   resource (void) const noexcept
+//@   {
+//@     return _fp;
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+fp //@
+x_fopen (const char *pathname, const char *mode)//@;
+{
+  return fp (libsh_treis::libc::no_raii::x_fopen (pathname, mode));
+}
+} //@
+
+// Деструктор всегда делает munmap
+// Отображение нулевой длины допустимо (mmap такие не создаёт, но map_file возвращает такое для пустого файла), для него munmap не делается
+// Если отображённый файл укоротить, то обращение к отрезанной части приведёт к SIGBUS. Поэтому для файлов, которые могут меняться во время чтения, лучше использовать read
+//@ #include <cstddef>
+//@ #include <exception>
+//@ #include <span>
+//@ #include <sys/mman.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class mapping: libsh_treis::tools::not_movable
+//@ {
+//@   std::byte *_ptr;
+//@   std::size_t _size;
+//@   int _exceptions;
+//@
+//@ public:
+//@   explicit mapping (void *ptr, std::size_t size) noexcept : _ptr ((std::byte *)ptr), _size (size), _exceptions (std::uncaught_exceptions ())
+//@   {
+//@   }
+//@
+//@   ~mapping (void) noexcept (false)
+//@   {
+//@     if (_size == 0)
+//@       {
+//@         return;
+//@       }
+//@
+//@     if (std::uncaught_exceptions () == _exceptions)
+//@       {
+//@         x_munmap (std::span<std::byte> (_ptr, _size));
+//@       }
+//@     else
+//@       {
+//@         munmap (_ptr, _size);
+//@       }
+//@   }
+//@
+//@   std::span<const std::byte>
+//@   bytes (void) const noexcept
+//@   {
+//@     return std::span<const std::byte> (_ptr, _size);
+//@   }
+//@
+//@   // Только для отображений с PROT_WRITE
+//@   std::span<std::byte>
+//@   writable_bytes (void) const noexcept
+//@   {
+//@     return std::span<std::byte> (_ptr, _size);
+//@   }
+//@
+//@   // MADV_SEQUENTIAL, MADV_WILLNEED, MADV_HUGEPAGE и т. д.
+//@   void
+//@   x_madvise (int advice) const
+//@   {
+//@     if (_size != 0)
+//@       {
+//@         libsh_treis::libc::x_madvise (std::span<std::byte> (_ptr, _size), advice);
+//@       }
+//@   }
+//@ };
+//@ }
+
+namespace libsh_treis::libc //@
+{ //@
+mapping //@
+x_mmap (void *addr, size_t len, int prot, int flags, int fildes, off_t off)//@;
+{
+  return mapping (libsh_treis::libc::no_raii::x_mmap (addr, len, prot, flags, fildes, off), len);
+}
+} //@
+
+// Открывает файл, узнаёт его размер и отображает целиком только для чтения. flags - MAP_PRIVATE или MAP_SHARED, к ним можно добавить MAP_POPULATE
+// fd закрывается сразу, отображение от него не зависит
+// Подсказки (MADV_SEQUENTIAL и т. д.) даются потом с помощью mapping::x_madvise. Но если нужен MAP_POPULATE, то подсказки, влияющие на чтение, нужно давать раньше, т. е. этой функцией не пользоваться
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+namespace libsh_treis::libc //@
+{ //@
+mapping //@
+map_file (const char *path, int flags)//@;
+{
+  fd file = x_open_2 (path, O_RDONLY | O_CLOEXEC);
+
+  struct stat st = x_fstat (file.resource ());
+
+  if (!S_ISREG (st.st_mode))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE (path + ": Not a regular file"s);
+    }
+
+  if (st.st_size == 0)
+    {
+      return mapping (nullptr, 0);
+    }
+
+  return x_mmap (nullptr, st.st_size, PROT_READ, flags, file.resource (), 0);
+}
+} //@
+
+// Оптимальный размер буфера для чтения из fildes и записи в fildes (см. "Fast stdio" в начале файла): для пайпа - размер пайпа (даже если он изменён), для остального - st_blksize
+//@ #include <cstddef>
+#include <fcntl.h>
+#include <sys/stat.h>
+namespace libsh_treis::libc //@
+{ //@
+std::size_t //@
+io_buffer_size (int fildes)//@;
+{
+  struct stat st = x_fstat (fildes);
+
+  if (S_ISFIFO (st.st_mode))
+    {
+      return x_fcntl_2 (fildes, F_GETPIPE_SZ);
+    }
+
+  return st.st_blksize;
+}
+} //@
+
+// Копирует всё из in в out до EOF, начиная с текущих позиций в обоих файлах (и сдвигая их), т. е. как цикл из read и write. Данные по возможности не проходят через user space:
+// - файл в файл - copy_file_range (на одной ФС может вообще не копировать данные, а сделать reflink)
+// - из пайпа или в пайп - splice
+// - из файла во что угодно (например, в сокет) - sendfile
+// Если выбранный способ не поддерживается для этих fd (ядро сообщает об этом при первом же вызове), копируем через буфер. Если первый же вызов ничего не скопировал, тоже переходим к следующему способу: старые ядра так делают в copy_file_range для файлов из /proc и /sys с ненулевым st_size (а если это и вправду EOF, то следующий способ тоже сразу вернёт 0)
+// Файлы нулевого размера (например, из /proc) копируем через буфер, т. к. copy_file_range и sendfile для них могут ничего не скопировать. В out, открытый с O_APPEND, copy_file_range не пишет (EBADF), поэтому для него сразу следующий способ
+//@ #include <sys/types.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+namespace libsh_treis::libc::detail
+{
+// Возвращает false, если способ не поддерживается, и тогда ещё ничего не скопировано
+template <typename F> bool
+copy_fd_to_fd_with (F &&transfer)
+{
+  try
+    {
+      if (transfer () == 0)
+        {
+          return false;
+        }
+    }
+  catch (const errno_error &ex)
+    {
+      int err = ex.error_number ();
+
+      if (err == EINVAL || err == ENOSYS || err == EXDEV || err == EOPNOTSUPP)
+        {
+          return false;
+        }
+
+      throw;
+    }
+
+  while (transfer () != 0)
+    {
+    }
+
+  return true;
+}
+}
+
+namespace libsh_treis::libc //@
+{ //@
+void //@
+copy_fd_to_fd (int in, int out)//@;
+{
+  // Большие куски, чтобы было меньше системных вызовов. Ядро всё равно ограничивает размер одной операции
+  constexpr size_t chunk = 1 << 30;
+
+  struct stat in_st = x_fstat (in);
+  struct stat out_st = x_fstat (out);
+
+  bool in_has_size = S_ISREG (in_st.st_mode) && in_st.st_size != 0;
+
+  if (in_has_size && S_ISREG (out_st.st_mode) && (x_fcntl_2 (out, F_GETFL) & O_APPEND) == 0)
+    {
+      if (libsh_treis::libc::detail::copy_fd_to_fd_with ([&](void){ return x_copy_file_range (in, nullptr, out, nullptr, chunk, 0); }))
+        {
+          return;
+        }
+    }
+
+  if (S_ISFIFO (in_st.st_mode) || S_ISFIFO (out_st.st_mode))
+    {
+      if (libsh_treis::libc::detail::copy_fd_to_fd_with ([&](void){ return x_splice (in, nullptr, out, nullptr, chunk, SPLICE_F_MOVE); }))
+        {
+          return;
+        }
+    }
+
+  if (in_has_size)
+    {
+      if (libsh_treis::libc::detail::copy_fd_to_fd_with ([&](void){ return x_sendfile (out, in, nullptr, chunk); }))
+        {
+          return;
+        }
+    }
+
+  auto buf = libsh_treis::tools::make_ospan_for_overwrite<std::byte> (io_buffer_size (in));
+
+  for (;;)
+    {
+      ssize_t have_read = x_read (in, buf);
+
+      if (have_read == 0)
+        {
+          break;
+        }
+
+      write_repeatedly (out, std::span<const std::byte> (buf.data (), have_read));
+    }
+}
+} //@
+
+// Быстрая замена fgetc поверх fd, реализует то, что описано в "Fast stdio" в начале файла. Буфер выровнен на 32 байта, по умолчанию его размер - io_buffer_size
+// Объект не владеет fd, т. е. не закрывает его. Поэтому объект можно создать и для 0
+// Ошибки read приводят к исключениям, как в x_read. EOF не ошибка, x_getc возвращает EOF, как x_fgetc
+// x_peek и skip - это доступ к буферу целиком, без копирования. x_peek возвращает пустой span только в случае EOF
+// x_getline и x_getline_sv - замена getline_buffer::getline без копирования: строка лежит прямо в буфере и живёт до следующего чтения из input_buffer. '\n' и '\0' ищутся за один проход с помощью strchrnul (в glibc он векторизован и сам выбирает SSE2/AVX2/... в runtime'е). Для этого после данных в буфере всегда есть место под один байт
+//@ #include <cstddef>
+//@ #include <cassert>
+//@ #include <optional>
+//@ #include <span>
+//@ #include <string_view>
+//@ #include <stdio.h> // EOF
+//@ namespace libsh_treis::libc
+//@ {
+//@ class input_buffer: libsh_treis::tools::not_movable
+//@ {
+//@   int _fd;
+//@   std::size_t _capacity;
+//@   std::byte *_buf;
+//@   std::byte *_begin;
+//@   std::byte *_end;
+//@
+//@   bool
+//@   _x_underflow (void);
+//@
+//@   bool
+//@   _x_read_more (void);
+//@
+//@   std::byte *
+//@   _x_find_line (bool nul_allowed);
+//@
+//@ public:
+//@   static constexpr std::size_t alignment = 32;
+//@
+//@   explicit input_buffer (int fildes);
+//@
+//@   explicit input_buffer (int fildes, std::size_t capacity);
+//@
+//@   ~input_buffer (void);
+//@
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd;
+//@   }
+//@
+//@   int
+//@   x_getc (void)
+//@   {
+//@     if (_begin == _end) [[unlikely]]
+//@       {
+//@         if (!_x_underflow ())
+//@           {
+//@             return EOF;
+//@           }
+//@       }
+//@
+//@     return (int)(unsigned char)*_begin++;
+//@   }
+//@
+//@   char
+//@   xx_getc (void)
+//@   {
+//@     int result = x_getc ();
+//@
+//@     if (result == EOF)
+//@       {
+//@         _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+//@       }
+//@
+//@     return (char)(unsigned char)result;
+//@   }
+//@
+//@   std::span<const std::byte>
+//@   x_peek (void)
+//@   {
+//@     if (_begin == _end)
+//@       {
+//@         _x_underflow ();
+//@       }
+//@
+//@     return std::span<const std::byte> (_begin, _end);
+//@   }
+//@
+//@   void
+//@   skip (std::size_t n) noexcept
+//@   {
+//@     assert (n <= (std::size_t)(_end - _begin));
+//@     _begin += n;
+//@   }
+//@
+//@   // Аналог x_fread: читает, пока не заполнит buf или не упрётся в EOF
+//@   std::span<std::byte>
+//@   x_read (std::span<std::byte> buf);
+//@
+//@   // Семантика та же, что у getline_buffer::getline: завершающий '\n' выкидывается, его отсутствие в конце файла не ошибка, нулевые байты - ошибка
+//@   std::optional<libsh_treis::tools::cstring_span>
+//@   x_getline (void);
+//@
+//@   // То же, но нулевые байты допустимы
+//@   std::optional<std::string_view>
+//@   x_getline_sv (void);
+//@ };
+//@ }
+
+#include <new>
+#include <algorithm>
+#include <string.h>
+namespace libsh_treis::libc
+{
+input_buffer::input_buffer (int fildes) : input_buffer (fildes, io_buffer_size (fildes))
+{
+}
+
+input_buffer::input_buffer (int fildes, std::size_t capacity) : _fd (fildes), _capacity (capacity)
+{
+  LIBSH_TREIS_ASSERT (capacity != 0);
+  _buf = new (std::align_val_t (alignment)) std::byte[capacity + 1];
+  _begin = _buf;
+  _end = _buf;
+}
+
+input_buffer::~input_buffer (void)
+{
+  operator delete[] (_buf, std::align_val_t (alignment));
+}
+
+// Вызывается только при пустом буфере
+bool
+input_buffer::_x_underflow (void)
+{
+  ssize_t result = libsh_treis::libc::x_read (_fd, std::span<std::byte> (_buf, _capacity));
+
+  _begin = _buf;
+  _end = _buf + result;
+
+  return result != 0;
+}
+
+std::span<std::byte>
+input_buffer::x_read (std::span<std::byte> buf)
+{
+  auto to_fill = buf;
+
+  while (to_fill.size () != 0)
+    {
+      if (_begin == _end)
+        {
+          // Большие куски читаем сразу в buf, минуя наш буфер
+          if (to_fill.size () >= _capacity)
+            {
+              return buf.first (buf.size () - to_fill.size () + read_repeatedly (_fd, to_fill).size ());
+            }
+
+          if (!_x_underflow ())
+            {
+              break;
+            }
+        }
+
+      std::size_t n = std::min (to_fill.size (), (std::size_t)(_end - _begin));
+      memcpy (to_fill.data (), _begin, n);
+      _begin += n;
+      to_fill = to_fill.subspan (n);
+    }
+
+  return buf.first (buf.size () - to_fill.size ());
+}
+
+// Дочитывает данные, сохраняя непрочитанные. Если буфер заполнен, увеличивает его
+bool
+input_buffer::_x_read_more (void)
+{
+  if (_begin != _buf)
+    {
+      memmove (_buf, _begin, _end - _begin);
+      _end = _buf + (_end - _begin);
+      _begin = _buf;
+    }
+
+  if (_end == _buf + _capacity)
+    {
+      std::size_t new_capacity = _capacity * 2;
+      std::byte *new_buf = new (std::align_val_t (alignment)) std::byte[new_capacity + 1];
+      memcpy (new_buf, _buf, _capacity);
+      operator delete[] (_buf, std::align_val_t (alignment));
+      _buf = new_buf;
+      _begin = new_buf;
+      _end = new_buf + _capacity;
+      _capacity = new_capacity;
+    }
+
+  ssize_t result = libsh_treis::libc::x_read (_fd, std::span<std::byte> (_end, _buf + _capacity));
+
+  _end += result;
+
+  return result != 0;
+}
+
+// Возвращает указатель на '\n', завершающий строку, либо _end, если это последняя строка без '\n', либо nullptr, если данных больше нет
+std::byte *
+input_buffer::_x_find_line (bool nul_allowed)
+{
+  std::size_t scanned = 0;
+
+  for (;;)
+    {
+      // Ограничитель для strchrnul
+      *_end = std::byte ('\0');
+
+      char *found = libsh_treis::libc::detail::strchrnul_reexported ((char *)_begin + scanned, '\n');
+
+      if (found != (char *)_end)
+        {
+          if (*found == '\n')
+            {
+              return (std::byte *)found;
+            }
+
+          if (!nul_allowed)
+            {
+              _LIBSH_TREIS_THROW_MESSAGE ("Embedded null bytes");
+            }
+
+          scanned = found + 1 - (char *)_begin;
+          continue;
+        }
+
+      scanned = _end - _begin;
+
+      if (!_x_read_more ())
+        {
+          return _begin == _end ? nullptr : _end;
+        }
+    }
+}
+
+std::optional<libsh_treis::tools::cstring_span>
+input_buffer::x_getline (void)
+{
+  std::byte *line_end = _x_find_line (false);
+
+  if (line_end == nullptr)
+    {
+      return std::nullopt;
+    }
+
+  char *line = (char *)_begin;
+
+  *line_end = std::byte ('\0');
+  _begin = line_end == _end ? _end : line_end + 1;
+
+  return libsh_treis::tools::make_cstring_span_unsafe (line, (char *)line_end - line);
+}
+
+std::optional<std::string_view>
+input_buffer::x_getline_sv (void)
+{
+  std::byte *line_end = _x_find_line (true);
+
+  if (line_end == nullptr)
+    {
+      return std::nullopt;
+    }
+
+  const char *line = (const char *)_begin;
+
+  _begin = line_end == _end ? _end : line_end + 1;
+
+  return std::string_view (line, (const char *)line_end - line);
+}
+}
+
+// Быстрая замена fputc поверх fd, пара к input_buffer. Буфер выровнен на 32 байта, по умолчанию его размер - io_buffer_size
+// Объект не владеет fd, т. е. не закрывает его
+// Деструктор делает x_flush (аналогично тому, как деструктор fd делает close), поэтому может бросить исключение
+// Большие куски (не меньше размера буфера) не копируются в буфер, а пишутся одним writev вместе с содержимым буфера
+// x_reserve и commit позволяют форматировать прямо в буфер, см. x_put_formatted
+//@ #include <cstddef>
+//@ #include <cassert>
+//@ #include <exception>
+//@ #include <span>
+//@ #include <string.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class output_buffer: libsh_treis::tools::not_movable
+//@ {
+//@   int _fd;
+//@   std::size_t _capacity;
+//@   std::byte *_buf;
+//@   std::byte *_end;
+//@   int _exceptions;
+//@
+//@   void
+//@   _x_drain (std::span<const std::byte> tail);
+//@
+//@ public:
+//@   static constexpr std::size_t alignment = 32;
+//@
+//@   explicit output_buffer (int fildes);
+//@
+//@   explicit output_buffer (int fildes, std::size_t capacity);
+//@
+//@   ~output_buffer (void) noexcept (false);
+//@
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd;
+//@   }
+//@
+//@   std::size_t
+//@   capacity (void) const noexcept
+//@   {
+//@     return _capacity;
+//@   }
+//@
+//@   void
+//@   x_putc (char c)
+//@   {
+//@     if (_end == _buf + _capacity) [[unlikely]]
+//@       {
+//@         x_flush ();
+//@       }
+//@
+//@     *_end++ = (std::byte)c;
+//@   }
+//@
+//@   void
+//@   x_write (std::span<const std::byte> buf)
+//@   {
+//@     if (buf.size () <= (std::size_t)(_buf + _capacity - _end)) [[likely]]
+//@       {
+//@         memcpy (_end, buf.data (), buf.size ());
+//@         _end += buf.size ();
+//@       }
+//@     else
+//@       {
+//@         _x_drain (buf);
+//@       }
+//@   }
+//@
+//@   void
+//@   x_flush (void);
+//@
+//@   // Выбрасывает то, что ещё не записано
+//@   void
+//@   discard (void) noexcept
+//@   {
+//@     _end = _buf;
+//@   }
+//@
+//@   // Гарантирует, что в буфере свободно не меньше n байт, и возвращает всё свободное место. Записанное туда нужно подтвердить с помощью commit
+//@   std::span<char>
+//@   x_reserve (std::size_t n)
+//@   {
+//@     assert (n <= _capacity);
+//@
+//@     if ((std::size_t)(_buf + _capacity - _end) < n)
+//@       {
+//@         x_flush ();
+//@       }
+//@
+//@     return std::span<char> ((char *)_end, (char *)(_buf + _capacity));
+//@   }
+//@
+//@   void
+//@   commit (std::size_t n) noexcept
+//@   {
+//@     assert (n <= (std::size_t)(_buf + _capacity - _end));
+//@     _end += n;
+//@   }
+//@
+//@   // f получает std::span<char> размера не меньше max_size, пишет туда и возвращает количество записанных байт
+//@   template <typename F> void
+//@   x_put_formatted (std::size_t max_size, F &&f)
+//@   {
+//@     commit (f (x_reserve (max_size)));
+//@   }
+//@ };
+//@ }
+
+#include <new>
+#include <memory>
+#include <algorithm>
+#include <string.h>
+#include <unistd.h>
+#include <sys/uio.h>
+namespace libsh_treis::libc
+{
+output_buffer::output_buffer (int fildes) : output_buffer (fildes, io_buffer_size (fildes))
+{
+}
+
+output_buffer::output_buffer (int fildes, std::size_t capacity) : _fd (fildes), _capacity (capacity), _exceptions (std::uncaught_exceptions ())
+{
+  LIBSH_TREIS_ASSERT (capacity != 0);
+  _buf = new (std::align_val_t (alignment)) std::byte[capacity];
+  _end = _buf;
+}
+
+output_buffer::~output_buffer (void) noexcept (false)
+{
+  // Освобождаем буфер в любом случае, даже если x_flush бросит исключение
+  std::unique_ptr<std::byte, void (*)(std::byte *)> guard (_buf, [](std::byte *buf){ operator delete[] (buf, std::align_val_t (alignment)); });
+
+  if (std::uncaught_exceptions () == _exceptions)
+    {
+      x_flush ();
+    }
+  else
+    {
+      // Как close в деструкторе fd: пытаемся, но ошибки игнорируем
+      for (std::byte *p = _buf; p != _end;)
+        {
+          ssize_t result = write (_fd, p, _end - p);
+
+          if (result <= 0)
+            {
+              break;
+            }
+
+          p += result;
+        }
+    }
+}
+
+void
+output_buffer::x_flush (void)
+{
+  std::byte *begin = _buf;
+
+  // Сдвигаем _end только после успешной записи, чтобы при исключении не потерять данные, которые не удалось записать
+  while (begin != _end)
+    {
+      begin += libsh_treis::libc::x_write (_fd, std::span<const std::byte> (begin, _end));
+      memmove (_buf, begin, _end - begin);
+      _end = _buf + (_end - begin);
+      begin = _buf;
+    }
+}
+
+// Вызывается, только если tail не помещается в буфер
+void
+output_buffer::_x_drain (std::span<const std::byte> tail)
+{
+  if (tail.size () < _capacity)
+    {
+      x_flush ();
+      memcpy (_end, tail.data (), tail.size ());
+      _end += tail.size ();
+      return;
+    }
+
+  std::span<const std::byte> pending (_buf, _end);
+
+  while (pending.size () != 0 || tail.size () != 0)
+    {
+      iovec iov[2] = {{.iov_base = (void *)pending.data (), .iov_len = pending.size ()}, {.iov_base = (void *)tail.data (), .iov_len = tail.size ()}};
+      std::size_t written = x_writev (_fd, pending.size () == 0 ? std::span<const iovec> (iov + 1, 1) : std::span<const iovec> (iov, 2));
+
+      std::size_t from_pending = std::min (written, pending.size ());
+      pending = pending.subspan (from_pending);
+      tail = tail.subspan (written - from_pending);
+
+      // Буфер всегда содержит ровно то, что из него ещё не записано. Тогда при исключении данные не потеряются и не запишутся дважды
+      memmove (_buf, pending.data (), pending.size ());
+      _end = _buf + pending.size ();
+      pending = std::span<const std::byte> (_buf, _end);
+    }
+}
+}
+
+// Форматирование без varargs и без разбора формата в runtime: формат проверяется во время компиляции (consteval), несоответствие аргументов - ошибка компиляции. Замена x_printf и его семейства там, где важна скорость
+// Формат: {} - очередной аргумент, {{ и }} - фигурные скобки. Внутри можно указать {:[0][ширина][.точность][тип]}
+// - целые числа: тип d (по умолчанию), x, X. x и X печатают отрицательные числа в дополнительном коде разрядности самого типа, как printf с соответствующим модификатором длины (для char - как %hhx)
+// - char: тип c (по умолчанию), d, x, X
+// - float и double (но не long double): тип f, e, g или ничего (кратчайшее точное представление, а с точностью - как g). Точность не больше 64
+// - строки (всё, что конвертируется в std::string_view, и cstring_span): тип s или ничего. Нулевой указатель печатается как "(null)", как в glibc'шном printf
+// Ширина (не больше 255) выравнивает вправо, как в printf. 0 (только для чисел) - дополнение нулями после знака. inf и nan, как и в printf, дополняются пробелами
+// Пишет в std::string (format_to_string, format_append), в std::span<char> (xx_format_to) или в output_buffer (x_format_to). Кучу использует только std::string
+//@ #include <cstddef>
+//@ #include <string>
+//@ #include <string_view>
+//@ #include <span>
+//@ #include <array>
+//@ #include <charconv>
+//@ #include <cmath>
+//@ #include <type_traits>
+//@ #include <concepts>
+//@ #include <system_error>
+//@ #include <string.h>
+//@ namespace libsh_treis::tools
+//@ {
+//@ namespace detail
+//@ {
+//@ enum class format_arg_kind
+//@ {
+//@   unsupported,
+//@   integer,
+//@   character,
+//@   floating,
+//@   string
+//@ };
+//@
+//@ template <typename T> consteval format_arg_kind
+//@ format_arg_kind_of (void)
+//@ {
+//@   using U = std::remove_cvref_t<T>;
+//@
+//@   if constexpr (std::is_same_v<U, char>)
+//@     {
+//@       return format_arg_kind::character;
+//@     }
+//@   else if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, wchar_t> || std::is_same_v<U, char8_t> || std::is_same_v<U, char16_t> || std::is_same_v<U, char32_t>)
+//@     {
+//@       return format_arg_kind::unsupported;
+//@     }
+//@   else if constexpr (std::is_integral_v<U>)
+//@     {
+//@       return format_arg_kind::integer;
+//@     }
+//@   else if constexpr (std::is_same_v<U, float> || std::is_same_v<U, double>)
+//@     {
+//@       // Не long double: 1e4000L в формате f - больше 4000 символов, это не влезет в буфер на стеке
+//@       return format_arg_kind::floating;
+//@     }
+//@   else if constexpr (std::is_convertible_v<const U &, std::string_view> || std::is_same_v<U, cstring_span>)
+//@     {
+//@       return format_arg_kind::string;
+//@     }
+//@   else
+//@     {
+//@       return format_arg_kind::unsupported;
+//@     }
+//@ }
+//@
+//@ struct format_spec
+//@ {
+//@   // Кусок формата перед этим аргументом
+//@   std::size_t literal_begin;
+//@   std::size_t literal_end;
+//@   bool zero;
+//@   unsigned char width;
+//@   signed char precision;
+//@   char type;
+//@ };
+//@
+//@ // Намеренно не constexpr и не определена: её вызов внутри consteval - это ошибка компиляции, в которой видно сообщение
+//@ void
+//@ format_string_error (const char *message);
+//@ }
+//@
+//@ template <typename... Args> class format_string
+//@ {
+//@   std::string_view _sv;
+//@   std::array<detail::format_spec, sizeof... (Args)> _specs;
+//@   std::size_t _tail_begin;
+//@   bool _has_escapes;
+//@
+//@ public:
+//@   template <typename S> requires std::convertible_to<const S &, std::string_view>
+//@   consteval format_string (const S &s) : _sv (s), _specs (), _tail_begin (0), _has_escapes (false)
+//@   {
+//@     constexpr detail::format_arg_kind kinds[] = {detail::format_arg_kind_of<Args> ()..., detail::format_arg_kind::unsupported};
+//@
+//@     std::size_t arg = 0;
+//@     std::size_t i = 0;
+//@     std::size_t n = _sv.size ();
+//@
+//@     while (i != n)
+//@       {
+//@         if (_sv[i] == '}')
+//@           {
+//@             if (i + 1 == n || _sv[i + 1] != '}')
+//@               {
+//@                 detail::format_string_error ("Unmatched '}' in format string");
+//@               }
+//@
+//@             _has_escapes = true;
+//@             i += 2;
+//@             continue;
+//@           }
+//@
+//@         if (_sv[i] != '{')
+//@           {
+//@             ++i;
+//@             continue;
+//@           }
+//@
+//@         if (i + 1 != n && _sv[i + 1] == '{')
+//@           {
+//@             _has_escapes = true;
+//@             i += 2;
+//@             continue;
+//@           }
+//@
+//@         if (arg == sizeof... (Args))
+//@           {
+//@             detail::format_string_error ("Too few arguments for format string");
+//@           }
+//@
+//@         detail::format_spec spec = {.literal_begin = _tail_begin, .literal_end = i, .zero = false, .width = 0, .precision = -1, .type = '\0'};
+//@
+//@         ++i;
+//@
+//@         if (i != n && _sv[i] == ':')
+//@           {
+//@             ++i;
+//@
+//@             if (i != n && _sv[i] == '0')
+//@               {
+//@                 spec.zero = true;
+//@                 ++i;
+//@               }
+//@
+//@             unsigned width = 0;
+//@
+//@             for (; i != n && '0' <= _sv[i] && _sv[i] <= '9'; ++i)
+//@               {
+//@                 width = width * 10 + (_sv[i] - '0');
+//@
+//@                 if (width > 255)
+//@                   {
+//@                     detail::format_string_error ("Width is too big");
+//@                   }
+//@               }
+//@
+//@             spec.width = (unsigned char)width;
+//@
+//@             if (i != n && _sv[i] == '.')
+//@               {
+//@                 ++i;
+//@
+//@                 if (i == n || !('0' <= _sv[i] && _sv[i] <= '9'))
+//@                   {
+//@                     detail::format_string_error ("Bad precision");
+//@                   }
+//@
+//@                 int precision = 0;
+//@
+//@                 for (; i != n && '0' <= _sv[i] && _sv[i] <= '9'; ++i)
+//@                   {
+//@                     precision = precision * 10 + (_sv[i] - '0');
+//@
+//@                     if (precision > 64)
+//@                       {
+//@                         detail::format_string_error ("Precision is too big");
+//@                       }
+//@                   }
+//@
+//@                 spec.precision = (signed char)precision;
+//@               }
+//@
+//@             if (i != n && _sv[i] != '}')
+//@               {
+//@                 spec.type = _sv[i];
+//@                 ++i;
+//@               }
+//@           }
+//@
+//@         if (i == n || _sv[i] != '}')
+//@           {
+//@             detail::format_string_error ("Bad format spec");
+//@           }
+//@
+//@         ++i;
+//@
+//@         switch (kinds[arg])
+//@           {
+//@           case detail::format_arg_kind::unsupported:
+//@             detail::format_string_error ("Unsupported argument type");
+//@             break;
+//@           case detail::format_arg_kind::integer:
+//@             if (!(spec.type == '\0' || spec.type == 'd' || spec.type == 'x' || spec.type == 'X') || spec.precision != -1)
+//@               {
+//@                 detail::format_string_error ("Bad format spec for integer argument");
+//@               }
+//@             break;
+//@           case detail::format_arg_kind::character:
+//@             if (!(spec.type == '\0' || spec.type == 'c' || spec.type == 'd' || spec.type == 'x' || spec.type == 'X') || spec.precision != -1 || (spec.zero && (spec.type == '\0' || spec.type == 'c')))
+//@               {
+//@                 detail::format_string_error ("Bad format spec for char argument");
+//@               }
+//@             break;
+//@           case detail::format_arg_kind::floating:
+//@             if (!(spec.type == '\0' || spec.type == 'f' || spec.type == 'e' || spec.type == 'g'))
+//@               {
+//@                 detail::format_string_error ("Bad format spec for floating point argument");
+//@               }
+//@             break;
+//@           case detail::format_arg_kind::string:
+//@             if (!(spec.type == '\0' || spec.type == 's') || spec.precision != -1 || spec.zero)
+//@               {
+//@                 detail::format_string_error ("Bad format spec for string argument");
+//@               }
+//@             break;
+//@           }
+//@
+//@         _specs[arg] = spec;
+//@         ++arg;
+//@         _tail_begin = i;
+//@       }
+//@
+//@     if (arg != sizeof... (Args))
+//@       {
+//@         detail::format_string_error ("Too many arguments for format string");
+//@       }
+//@   }
+//@
+//@   std::string_view
+//@   sv (void) const noexcept
+//@   {
+//@     return _sv;
+//@   }
+//@
+//@   const detail::format_spec &
+//@   spec (std::size_t i) const noexcept
+//@   {
+//@     return _specs[i];
+//@   }
+//@
+//@   std::size_t
+//@   tail_begin (void) const noexcept
+//@   {
+//@     return _tail_begin;
+//@   }
+//@
+//@   bool
+//@   has_escapes (void) const noexcept
+//@   {
+//@     return _has_escapes;
+//@   }
+//@ };
+//@
+//@ // Чтобы Args выводились из аргументов, а не из формата
+//@ template <typename... Args> using format_string_for = format_string<std::type_identity_t<Args>...>;
+//@
+//@ namespace detail
+//@ {
+//@ // Sink - всё, у чего есть put (std::string_view)
+//@ template <typename Sink> void
+//@ format_put_literal (Sink &sink, std::string_view literal, bool has_escapes)
+//@ {
+//@   if (!has_escapes)
+//@     {
+//@       sink.put (literal);
+//@       return;
 //@     }
-//@   v.push_back (nullptr);
-//@   x_execvp (file, v.data ());
+//@
+//@   // Формат уже проверен, поэтому все скобки в literal удвоены
+//@   for (;;)
+//@     {
+//@       std::size_t brace = literal.find_first_of ("{}");
+//@
+//@       if (brace == std::string_view::npos)
+//@         {
+//@           sink.put (literal);
+//@           return;
+//@         }
+//@
+//@       sink.put (literal.substr (0, brace + 1));
+//@       literal.remove_prefix (brace + 2);
+//@     }
+//@ }
+//@
+//@ template <typename Sink> void
+//@ format_put_padded (Sink &sink, const format_spec &spec, std::string_view s, bool numeric)
+//@ {
+//@   if (s.size () >= spec.width)
+//@     {
+//@       sink.put (s);
+//@       return;
+//@     }
+//@
+//@   std::size_t pad = spec.width - s.size ();
+//@
+//@   if (spec.zero && numeric && s.size () != 0 && s[0] == '-')
+//@     {
+//@       sink.put (s.substr (0, 1));
+//@       s.remove_prefix (1);
+//@     }
+//@
+//@   constexpr std::string_view spaces = "                                ";
+//@   constexpr std::string_view zeros = "00000000000000000000000000000000";
+//@   std::string_view fill = spec.zero && numeric ? zeros : spaces;
+//@
+//@   for (; pad > fill.size (); pad -= fill.size ())
+//@     {
+//@       sink.put (fill);
+//@     }
+//@
+//@   sink.put (fill.substr (0, pad));
+//@   sink.put (s);
+//@ }
+//@
+//@ template <typename Sink, typename T> void
+//@ format_put_arg (Sink &sink, const format_spec &spec, const T &arg)
+//@ {
+//@   constexpr format_arg_kind kind = format_arg_kind_of<T> ();
+//@
+//@   if constexpr (kind == format_arg_kind::string)
+//@     {
+//@       std::string_view s;
+//@
+//@       if constexpr (std::is_same_v<std::remove_cvref_t<T>, cstring_span>)
+//@         {
+//@           s = arg.sv ();
+//@         }
+//@       else if constexpr (std::is_pointer_v<std::remove_cvref_t<T>>)
+//@         {
+//@           // Конструировать std::string_view из nullptr нельзя
+//@           s = arg == nullptr ? std::string_view ("(null)") : std::string_view (arg);
+//@         }
+//@       else
+//@         {
+//@           s = arg;
+//@         }
+//@
+//@       format_put_padded (sink, spec, s, false);
+//@     }
+//@   else if constexpr (kind == format_arg_kind::floating)
+//@     {
+//@       // 1e308 в формате f с точностью 64 - около 375 символов
+//@       char buf[512];
+//@       std::to_chars_result result;
+//@
+//@       if (spec.type == '\0' && spec.precision == -1)
+//@         {
+//@           result = std::to_chars (buf, buf + sizeof (buf), arg);
+//@         }
+//@       else
+//@         {
+//@           std::chars_format format = spec.type == 'f' ? std::chars_format::fixed : spec.type == 'e' ? std::chars_format::scientific : std::chars_format::general;
+//@           result = std::to_chars (buf, buf + sizeof (buf), arg, format, spec.precision == -1 ? 6 : spec.precision);
+//@         }
+//@
+//@       LIBSH_TREIS_ASSERT (result.ec == std::errc ());
+//@       format_put_padded (sink, spec, std::string_view (buf, result.ptr), std::isfinite (arg));
+//@     }
+//@   else
+//@     {
+//@       if constexpr (kind == format_arg_kind::character)
+//@         {
+//@           if (spec.type == '\0' || spec.type == 'c')
+//@             {
+//@               format_put_padded (sink, spec, std::string_view (&arg, 1), false);
+//@               return;
+//@             }
+//@         }
+//@
+//@       // 64 двоичных разряда + знак
+//@       char buf[72];
+//@       std::to_chars_result result;
+//@
+//@       if (spec.type == 'x' || spec.type == 'X')
+//@         {
+//@           // Как в printf: отрицательные - в дополнительном коде
+//@           result = std::to_chars (buf, buf + sizeof (buf), (std::make_unsigned_t<std::remove_cvref_t<T>>)arg, 16);
+//@         }
+//@       else
+//@         {
+//@           result = std::to_chars (buf, buf + sizeof (buf), arg, 10);
+//@         }
+//@
+//@       if (spec.type == 'X')
+//@         {
+//@           for (char *p = buf; p != result.ptr; ++p)
+//@             {
+//@               if ('a' <= *p && *p <= 'f')
+//@                 {
+//@                   *p = (char)(*p - 'a' + 'A');
+//@                 }
+//@             }
+//@         }
+//@
+//@       format_put_padded (sink, spec, std::string_view (buf, result.ptr), true);
+//@     }
+//@ }
+//@
+//@ template <typename Sink, typename... Args> void
+//@ format_to_sink (Sink &sink, const format_string<Args...> &fmt, const Args &...args)
+//@ {
+//@   std::size_t i = 0;
+//@
+//@   ((format_put_literal (sink, fmt.sv ().substr (fmt.spec (i).literal_begin, fmt.spec (i).literal_end - fmt.spec (i).literal_begin), fmt.has_escapes ()), format_put_arg (sink, fmt.spec (i), args), ++i), ...);
+//@
+//@   format_put_literal (sink, fmt.sv ().substr (fmt.tail_begin ()), fmt.has_escapes ());
+//@ }
+//@
+//@ struct string_sink
+//@ {
+//@   std::string &s;
+//@
+//@   void
+//@   put (std::string_view part)
+//@   {
+//@     s.append (part);
+//@   }
+//@ };
+//@
+//@ struct span_sink
+//@ {
+//@   std::span<char> s;
+//@   std::size_t size;
+//@
+//@   void
+//@   put (std::string_view part)
+//@   {
+//@     if (part.size () > s.size () - size)
+//@       {
+//@         _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+//@       }
+//@
+//@     memcpy (s.data () + size, part.data (), part.size ());
+//@     size += part.size ();
+//@   }
+//@ };
+//@ }
+//@
+//@ template <typename... Args> void
+//@ format_append (std::string &s, format_string_for<Args...> fmt, const Args &...args)
+//@ {
+//@   detail::string_sink sink = {.s = s};
+//@   detail::format_to_sink (sink, fmt, args...);
+//@ }
+//@
+//@ template <typename... Args> std::string
+//@ format_to_string (format_string_for<Args...> fmt, const Args &...args)
+//@ {
+//@   std::string result;
+//@   format_append (result, fmt, args...);
+//@   return result;
+//@ }
+//@
+//@ // Как xx_snprintf: пишет в s, дописывает '\0' и возвращает записанное (без '\0'). Если не влезло, исключение
+//@ template <typename... Args> std::span<char>
+//@ xx_format_to (std::span<char> s, format_string_for<Args...> fmt, const Args &...args)
+//@ {
+//@   if (s.size () == 0)
+//@     {
+//@       _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+//@     }
+//@
+//@   detail::span_sink sink = {.s = s.first (s.size () - 1), .size = 0};
+//@   detail::format_to_sink (sink, fmt, args...);
+//@   s[sink.size] = '\0';
+//@   return s.first (sink.size);
+//@ }
+//@ }
+//@
+//@ namespace libsh_treis::libc
+//@ {
+//@ namespace detail
+//@ {
+//@ struct output_buffer_sink
+//@ {
+//@   output_buffer &buf;
+//@
+//@   void
+//@   put (std::string_view part)
+//@   {
+//@     buf.x_write (std::as_bytes (std::span<const char> (part)));
+//@   }
+//@ };
+//@ }
+//@
+//@ template <typename... Args> void
+//@ x_format_to (output_buffer &buf, libsh_treis::tools::format_string_for<Args...> fmt, const Args &...args)
+//@ {
+//@   detail::output_buffer_sink sink = {.buf = buf};
+//@   libsh_treis::tools::detail::format_to_sink (sink, fmt, args...);
+//@ }
+//@ }
+
+// Результат CQE: отрицательный res - это -errno, бросаем исключение
+//@ #include <linux/io_uring.h>
+#include <errno.h>
+namespace libsh_treis::libc //@
+{ //@
+int //@
+x_cqe_result (const io_uring_cqe &cqe)//@;
+{
+  if (cqe.res < 0)
+    {
+      errno = -cqe.res;
+      THROW_ERRNO;
+    }
+
+  return cqe.res;
+}
+} //@
+
+// Кольцо io_uring (без liburing, только syscall'ы). Деструктор закрывает кольцо, как деструктор fd
+// Порядок работы: prep_* заполняют SQE (и возвращают его, чтобы можно было добавить флаги, например, IOSQE_FIXED_FILE для зарегистрированных файлов или IOSQE_IO_LINK), x_submit отправляет все накопленные SQE одним io_uring_enter, for_each_cqe и x_wait_cqe забирают завершения. Ошибку из CQE превращает в исключение x_cqe_result
+// Если в SQ нет места, prep_* сначала сами делают x_submit
+// Буферы, пути, iovec'и и т. д. должны жить, пока не придёт соответствующий CQE (для путей и iovec'ов - хотя бы до x_submit)
+// offset == -1 у prep_read и prep_write означает текущую позицию в файле
+// IORING_SETUP_SQPOLL не поддерживается
+//@ #include <cstddef>
+//@ #include <cstdint>
+//@ #include <atomic>
+//@ #include <span>
+//@ #include <sys/types.h>
+//@ #include <sys/uio.h>
+//@ #include <linux/io_uring.h>
+//@ struct statx;
+//@ namespace libsh_treis::libc
+//@ {
+//@ class uring: libsh_treis::tools::not_movable
+//@ {
+//@   io_uring_params _params;
+//@   fd _fd;
+//@   mapping _sq_ring;
+//@   mapping _cq_ring; // Пустой, если есть IORING_FEAT_SINGLE_MMAP
+//@   mapping _sqes_map;
+//@   unsigned *_sq_head;
+//@   unsigned *_sq_tail;
+//@   unsigned _sq_mask;
+//@   unsigned *_cq_head;
+//@   unsigned *_cq_tail;
+//@   unsigned _cq_mask;
+//@   io_uring_sqe *_sqes;
+//@   io_uring_cqe *_cqes;
+//@   unsigned _sqe_tail; // SQE до этого места заполнены, но, возможно, ещё не опубликованы в _sq_tail
+//@
+//@   io_uring_sqe &
+//@   _x_get_sqe (std::uint8_t opcode, int fd, std::uint64_t user_data);
+//@
+//@ public:
+//@   explicit uring (unsigned entries, unsigned flags);
+//@
+//@   int
+//@   resource (void) const noexcept
+//@   {
+//@     return _fd.resource ();
+//@   }
+//@
+//@   unsigned
+//@   sq_entries (void) const noexcept
+//@   {
+//@     return _params.sq_entries;
+//@   }
+//@
+//@   io_uring_sqe &
+//@   prep_read (int fd, std::span<std::byte> buf, off_t offset, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_write (int fd, std::span<const std::byte> buf, off_t offset, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_readv (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_writev (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data);
+//@
+//@   // buf должен лежать внутри буфера номер buf_index, зарегистрированного x_register_buffers
+//@   io_uring_sqe &
+//@   prep_read_fixed (int fd, std::span<std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_write_fixed (int fd, std::span<const std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data);
+//@
+//@   // fsync_flags - 0 или IORING_FSYNC_DATASYNC
+//@   io_uring_sqe &
+//@   prep_fsync (int fd, unsigned fsync_flags, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_openat (int dirfd, const char *path, int flags, mode_t mode, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_close (int fd, std::uint64_t user_data);
+//@
+//@   io_uring_sqe &
+//@   prep_statx (int dirfd, const char *path, int flags, unsigned mask, struct statx *statxbuf, std::uint64_t user_data);
+//@
+//@   // Отправляет все накопленные SQE и ждёт, пока не будет готово хотя бы wait_nr CQE. Возвращает количество отправленных SQE
+//@   int
+//@   x_submit (unsigned wait_nr);
+//@
+//@   // Вызывает f (const io_uring_cqe &) для каждого уже готового CQE, не делая системных вызовов. Возвращает количество CQE
+//@   template <typename F> unsigned
+//@   for_each_cqe (F &&f)
+//@   {
+//@     unsigned head = *_cq_head;
+//@     unsigned tail = std::atomic_ref<unsigned> (*_cq_tail).load (std::memory_order_acquire);
+//@     unsigned result = tail - head;
+//@
+//@     for (; head != tail; ++head)
+//@       {
+//@         // Освобождаем место в CQ до вызова f, чтобы исключение из f не привело к повторной обработке CQE
+//@         io_uring_cqe cqe = _cqes[head & _cq_mask];
+//@         std::atomic_ref<unsigned> (*_cq_head).store (head + 1, std::memory_order_release);
+//@         f (cqe);
+//@       }
+//@
+//@     return result;
+//@   }
+//@
+//@   // Отправляет накопленные SQE, если готовых CQE нет, ждёт один и забирает его
+//@   io_uring_cqe
+//@   x_wait_cqe (void);
+//@
+//@   void
+//@   x_register_buffers (std::span<const iovec> bufs);
+//@
+//@   void
+//@   x_unregister_buffers (void);
+//@
+//@   // После регистрации в SQE с флагом IOSQE_FIXED_FILE вместо fd передаётся номер в fds
+//@   void
+//@   x_register_files (std::span<const int> fds);
+//@
+//@   void
+//@   x_unregister_files (void);
+//@ };
+//@ }
+
+#include <errno.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <algorithm>
+namespace libsh_treis::libc::detail
+{
+io_uring_params
+uring_params (unsigned flags) noexcept
+{
+  io_uring_params result;
+  memset (&result, 0, sizeof (result));
+  result.flags = flags;
+  return result;
+}
+
+std::size_t
+uring_sq_ring_size (const io_uring_params &p) noexcept
+{
+  std::size_t sq_size = p.sq_off.array + p.sq_entries * sizeof (unsigned);
+  std::size_t cq_size = p.cq_off.cqes + p.cq_entries * sizeof (io_uring_cqe);
+
+  if ((p.features & IORING_FEAT_SINGLE_MMAP) != 0)
+    {
+      return std::max (sq_size, cq_size);
+    }
+
+  return sq_size;
+}
+}
+
+namespace libsh_treis::libc
+{
+uring::uring (unsigned entries, unsigned flags)
+  : _params (libsh_treis::libc::detail::uring_params (flags)),
+    _fd (libsh_treis::libc::no_raii::x_io_uring_setup (entries, &_params)),
+    _sq_ring (x_mmap (nullptr, libsh_treis::libc::detail::uring_sq_ring_size (_params), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd.resource (), IORING_OFF_SQ_RING)),
+    _cq_ring ((_params.features & IORING_FEAT_SINGLE_MMAP) != 0
+      ? mapping (nullptr, 0)
+      : x_mmap (nullptr, _params.cq_off.cqes + _params.cq_entries * sizeof (io_uring_cqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd.resource (), IORING_OFF_CQ_RING)),
+    _sqes_map (x_mmap (nullptr, _params.sq_entries * sizeof (io_uring_sqe), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, _fd.resource (), IORING_OFF_SQES))
+{
+  LIBSH_TREIS_ASSERT ((flags & IORING_SETUP_SQPOLL) == 0);
+
+  std::byte *sq = _sq_ring.writable_bytes ().data ();
+  std::byte *cq = (_params.features & IORING_FEAT_SINGLE_MMAP) != 0 ? sq : _cq_ring.writable_bytes ().data ();
+
+  _sq_head = (unsigned *)(sq + _params.sq_off.head);
+  _sq_tail = (unsigned *)(sq + _params.sq_off.tail);
+  _sq_mask = *(unsigned *)(sq + _params.sq_off.ring_mask);
+  _cq_head = (unsigned *)(cq + _params.cq_off.head);
+  _cq_tail = (unsigned *)(cq + _params.cq_off.tail);
+  _cq_mask = *(unsigned *)(cq + _params.cq_off.ring_mask);
+  _sqes = (io_uring_sqe *)_sqes_map.writable_bytes ().data ();
+  _cqes = (io_uring_cqe *)(cq + _params.cq_off.cqes);
+  _sqe_tail = *_sq_tail;
+
+  // SQE номер i всегда лежит в позиции i, как в liburing
+  unsigned *sq_array = (unsigned *)(sq + _params.sq_off.array);
+
+  for (unsigned i = 0; i != _params.sq_entries; ++i)
+    {
+      sq_array[i] = i;
+    }
+}
+
+io_uring_sqe &
+uring::_x_get_sqe (std::uint8_t opcode, int fd, std::uint64_t user_data)
+{
+  if (_sqe_tail - std::atomic_ref<unsigned> (*_sq_head).load (std::memory_order_acquire) == _params.sq_entries)
+    {
+      x_submit (0);
+
+      if (_sqe_tail - std::atomic_ref<unsigned> (*_sq_head).load (std::memory_order_acquire) == _params.sq_entries)
+        {
+          _LIBSH_TREIS_THROW_MESSAGE ("Submission queue is full");
+        }
+    }
+
+  io_uring_sqe &result = _sqes[_sqe_tail & _sq_mask];
+
+  memset (&result, 0, sizeof (result));
+  result.opcode = opcode;
+  result.fd = fd;
+  result.user_data = user_data;
+
+  ++_sqe_tail;
+
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_read (int fd, std::span<std::byte> buf, off_t offset, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_READ, fd, user_data);
+  result.addr = (std::uintptr_t)buf.data ();
+  result.len = buf.size ();
+  result.off = offset;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_write (int fd, std::span<const std::byte> buf, off_t offset, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_WRITE, fd, user_data);
+  result.addr = (std::uintptr_t)buf.data ();
+  result.len = buf.size ();
+  result.off = offset;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_readv (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_READV, fd, user_data);
+  result.addr = (std::uintptr_t)iov.data ();
+  result.len = iov.size ();
+  result.off = offset;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_writev (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_WRITEV, fd, user_data);
+  result.addr = (std::uintptr_t)iov.data ();
+  result.len = iov.size ();
+  result.off = offset;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_read_fixed (int fd, std::span<std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_READ_FIXED, fd, user_data);
+  result.addr = (std::uintptr_t)buf.data ();
+  result.len = buf.size ();
+  result.off = offset;
+  result.buf_index = buf_index;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_write_fixed (int fd, std::span<const std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_WRITE_FIXED, fd, user_data);
+  result.addr = (std::uintptr_t)buf.data ();
+  result.len = buf.size ();
+  result.off = offset;
+  result.buf_index = buf_index;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_fsync (int fd, unsigned fsync_flags, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_FSYNC, fd, user_data);
+  result.fsync_flags = fsync_flags;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_openat (int dirfd, const char *path, int flags, mode_t mode, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_OPENAT, dirfd, user_data);
+  result.addr = (std::uintptr_t)path;
+  result.len = mode;
+  result.open_flags = flags;
+  return result;
+}
+
+io_uring_sqe &
+uring::prep_close (int fd, std::uint64_t user_data)
+{
+  return _x_get_sqe (IORING_OP_CLOSE, fd, user_data);
+}
+
+io_uring_sqe &
+uring::prep_statx (int dirfd, const char *path, int flags, unsigned mask, struct statx *statxbuf, std::uint64_t user_data)
+{
+  io_uring_sqe &result = _x_get_sqe (IORING_OP_STATX, dirfd, user_data);
+  result.addr = (std::uintptr_t)path;
+  result.len = mask;
+  result.off = (std::uintptr_t)statxbuf;
+  result.statx_flags = flags;
+  return result;
+}
+
+int
+uring::x_submit (unsigned wait_nr)
+{
+  std::atomic_ref<unsigned> (*_sq_tail).store (_sqe_tail, std::memory_order_release);
+
+  int result = 0;
+
+  for (;;)
+    {
+      unsigned to_submit = _sqe_tail - std::atomic_ref<unsigned> (*_sq_head).load (std::memory_order_acquire);
+
+      if (to_submit == 0 && wait_nr == 0)
+        {
+          return result;
+        }
+
+      int submitted = (*libsh_treis::libc::detail::syscall_reexported) (SYS_io_uring_enter, _fd.resource (), to_submit, wait_nr, wait_nr != 0 ? IORING_ENTER_GETEVENTS : 0, nullptr, 0);
+
+      if (submitted != -1)
+        {
+          return result + submitted;
+        }
+
+      if (errno != EINTR)
+        {
+          THROW_ERRNO;
+        }
+
+      // Сигнал во время ожидания. Перезапускаем, но уже отправленные SQE второй раз не отправляем
+      result += to_submit - (_sqe_tail - std::atomic_ref<unsigned> (*_sq_head).load (std::memory_order_acquire));
+
+      if (std::atomic_ref<unsigned> (*_cq_tail).load (std::memory_order_acquire) - *_cq_head >= wait_nr)
+        {
+          return result;
+        }
+    }
+}
+
+io_uring_cqe
+uring::x_wait_cqe (void)
+{
+  unsigned head = *_cq_head;
+
+  while (std::atomic_ref<unsigned> (*_cq_tail).load (std::memory_order_acquire) == head)
+    {
+      x_submit (1);
+    }
+
+  io_uring_cqe result = _cqes[head & _cq_mask];
+  std::atomic_ref<unsigned> (*_cq_head).store (head + 1, std::memory_order_release);
+  return result;
+}
+
+void
+uring::x_register_buffers (std::span<const iovec> bufs)
+{
+  x_io_uring_register (_fd.resource (), IORING_REGISTER_BUFFERS, bufs.data (), bufs.size ());
+}
+
+void
+uring::x_unregister_buffers (void)
+{
+  x_io_uring_register (_fd.resource (), IORING_UNREGISTER_BUFFERS, nullptr, 0);
+}
+
+void
+uring::x_register_files (std::span<const int> fds)
+{
+  x_io_uring_register (_fd.resource (), IORING_REGISTER_FILES, fds.data (), fds.size ());
+}
+
+void
+uring::x_unregister_files (void)
+{
+  x_io_uring_register (_fd.resource (), IORING_UNREGISTER_FILES, nullptr, 0);
+}
+}
+
+// statx для многих имён в одном каталоге: out[i] - результат для names[i]. Для индексаторов и тому подобного, когда от каждого файла нужно лишь несколько полей (см. mask в x_statx)
+// Вариант с uring отправляет запросы пачками по sq_entries штук, так что на пачку нужен один системный вызов. Запросы в пачке выполняются в любом порядке. Если какие-то из них завершились ошибкой, то дожидаемся всей пачки и бросаем исключение для первой ошибки в порядке names. Если ошибку вернул сам io_uring_enter, то тоже сначала дожидаемся всех запросов пачки (а если и это не удаётся, вызываем std::terminate), так что после выхода из функции ядро не трогает names и out. Во время вызова в ring не должно быть других незавершённых запросов
+//@ #include <span>
+//@ #include <linux/stat.h>
+#include <errno.h>
+#include <algorithm>
+#include <vector>
+#include <exception>
+namespace libsh_treis::libc //@
+{ //@
+void //@
+statx_batch (int dirfd, std::span<const char *const> names, int flags, unsigned int mask, std::span<struct statx> out)//@;
+{
+  LIBSH_TREIS_ASSERT (names.size () == out.size ());
+
+  for (std::size_t i = 0; i != names.size (); ++i)
+    {
+      out[i] = x_statx (dirfd, names[i], flags, mask);
+    }
+}
+
+void //@
+statx_batch (uring &ring, int dirfd, std::span<const char *const> names, int flags, unsigned int mask, std::span<struct statx> out)//@;
+{
+  LIBSH_TREIS_ASSERT (names.size () == out.size ());
+
+  std::vector<int> results (ring.sq_entries ());
+
+  while (names.size () != 0)
+    {
+      std::size_t n = std::min (names.size (), (std::size_t)ring.sq_entries ());
+
+      for (std::size_t i = 0; i != n; ++i)
+        {
+          ring.prep_statx (dirfd, names[i], flags, mask, &out[i], i);
+        }
+
+      // Забираем все CQE пачки, даже если есть ошибки: иначе ядро может писать в out после выхода из функции
+      std::size_t done = 0;
+
+      try
+        {
+          ring.x_submit (n);
+
+          for (; done != n; ++done)
+            {
+              io_uring_cqe cqe = ring.x_wait_cqe ();
+              results[cqe.user_data] = cqe.res;
+            }
+        }
+      catch (...)
+        {
+          // Сам ring бросил исключение (например, ENOMEM из io_uring_enter). Часть запросов пачки уже у ядра, часть ещё лежит в SQ, и все они ссылаются на names и out. Дожидаемся их все (x_wait_cqe заодно отправит оставшиеся), и только потом бросаем исключение дальше. Если не получается и это, то безопасно выйти из функции нельзя
+          try
+            {
+              for (; done != n; ++done)
+                {
+                  ring.x_wait_cqe ();
+                }
+            }
+          catch (...)
+            {
+              std::terminate ();
+            }
+
+          throw;
+        }
+
+      for (std::size_t i = 0; i != n; ++i)
+        {
+          if (results[i] < 0)
+            {
+              errno = -results[i];
+              THROW_ERRNO_MESSAGE (names[i]);
+            }
+        }
+
+      names = names.subspan (n);
+      out = out.subspan (n);
+    }
+}
+} //@
+
+// Пул буферов одинакового размера, например, для read. Замена make_ospan_for_overwrite для случая, когда буферы нужны постоянно и выделять их каждый раз через new[] слишком дорого
+// Память выделяется slab'ами через mmap, с подсказкой MADV_HUGEPAGE. Slab'ы не возвращаются системе до разрушения пула. Если все slab'ы (их не больше max_slabs) заняты, x_allocate бросает исключение
+// У каждого потока есть свой маленький (cache_size) thread_local кэш свободных буферов каждого пула, поэтому обычно x_allocate и возврат буфера не трогают общих данных. Если кэш пуст или переполнен, используется общий lock-free стек. Когда поток завершается, буферы из его кэшей возвращаются в общие стеки
+// Буфер возвращается в пул деструктором pooled_buffer, причём можно в другом потоке. Все буферы должны вернуться до разрушения пула
+//@ #include <cstddef>
+//@ #include <cstdint>
+//@ #include <cassert>
+//@ #include <atomic>
+//@ #include <memory>
+//@ #include <mutex>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class buffer_pool;
+//@
+//@ namespace detail
+//@ {
+//@ class buffer_stack;
+//@ }
+//@
+//@ // Как ospan, но память принадлежит пулу
+//@ class pooled_buffer: libsh_treis::tools::not_movable
+//@ {
+//@   buffer_pool &_pool;
+//@   std::byte *_ptr;
+//@   std::uint32_t _index;
+//@
+//@   explicit pooled_buffer (buffer_pool &pool, std::byte *ptr, std::uint32_t index) noexcept : _pool (pool), _ptr (ptr), _index (index)
+//@   {
+//@   }
+//@
+//@   friend class buffer_pool;
+//@
+//@ public:
+//@   ~pooled_buffer (void);
+//@
+//@   const std::byte *
+//@   data (void) const noexcept
+//@   {
+//@     return _ptr;
+//@   }
+//@
+//@   std::byte *
+//@   data (void) noexcept
+//@   {
+//@     return _ptr;
+//@   }
+//@
+//@   std::size_t
+//@   size (void) const noexcept;
+//@
+//@   const std::byte *
+//@   begin (void) const noexcept
+//@   {
+//@     return _ptr;
+//@   }
+//@
+//@   std::byte *
+//@   begin (void) noexcept
+//@   {
+//@     return _ptr;
+//@   }
+//@
+//@   const std::byte *
+//@   end (void) const noexcept
+//@   {
+//@     return _ptr + size ();
+//@   }
+//@
+//@   std::byte *
+//@   end (void) noexcept
+//@   {
+//@     return _ptr + size ();
+//@   }
+//@ };
+//@
+//@ class buffer_pool: libsh_treis::tools::not_movable
+//@ {
+//@ public:
+//@   static constexpr int cache_size = 8;
+//@
+//@ private:
+//@   std::size_t _buffer_size;
+//@   std::size_t _buffers_per_slab;
+//@   std::size_t _slab_size;
+//@   std::size_t _max_slabs;
+//@   std::unique_ptr<std::unique_ptr<mapping>[]> _slabs; // Меняется только под _grow_mutex
+//@   std::unique_ptr<std::atomic<std::byte *>[]> _slab_addresses;
+//@   std::shared_ptr<detail::buffer_stack> _stack; // Общий стек свободных буферов. На него ссылаются и кэши потоков, поэтому он может пережить пул
+//@   std::size_t _slab_count; // Меняется только под _grow_mutex
+//@   std::mutex _grow_mutex;
+//@
+//@   std::byte *
+//@   _address (std::uint32_t index) const noexcept
+//@   {
+//@     return _slab_addresses[index / _buffers_per_slab].load (std::memory_order_relaxed) + (index % _buffers_per_slab) * _buffer_size;
+//@   }
+//@
+//@   std::uint32_t
+//@   _x_grow (void);
+//@
+//@   void
+//@   _release (std::uint32_t index) noexcept;
+//@
+//@   friend class pooled_buffer;
+//@
+//@ public:
+//@   // alignment - степень двойки, не больше размера страницы
+//@   explicit buffer_pool (std::size_t buffer_size, std::size_t alignment, std::size_t buffers_per_slab, std::size_t max_slabs);
+//@
+//@   ~buffer_pool (void);
+//@
+//@   std::size_t
+//@   buffer_size (void) const noexcept
+//@   {
+//@     return _buffer_size;
+//@   }
+//@
+//@   pooled_buffer
+//@   x_allocate (void);
+//@ };
+//@
+//@ inline std::size_t
+//@ pooled_buffer::size (void) const noexcept
+//@ {
+//@   return _pool.buffer_size ();
+//@ }
 //@ }
+
+#include <limits.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <atomic>
+#include <memory>
+#include <vector>
+namespace libsh_treis::libc::detail
+{
+// Lock-free стек номеров свободных буферов
+class buffer_stack : libsh_treis::tools::not_movable
+{
+  std::unique_ptr<std::atomic<std::uint32_t>[]> _next; // Следующий элемент (номер + 1, 0 - конец)
+  std::atomic<std::uint64_t> _head; // Вершина: в младших 32 битах номер + 1, в старших - счётчик против ABA
+
+public:
+  // false после разрушения пула
+  std::atomic<bool> alive;
+
+  explicit buffer_stack (std::size_t size) : _next (std::make_unique<std::atomic<std::uint32_t>[]> (size)), _head (0), alive (true)
+  {
+  }
+
+  bool
+  pop (std::uint32_t &index) noexcept
+  {
+    std::uint64_t old_head = _head.load (std::memory_order_acquire);
+
+    for (;;)
+      {
+        std::uint32_t top = (std::uint32_t)old_head;
+
+        if (top == 0)
+          {
+            return false;
+          }
+
+        std::uint64_t new_head = ((old_head >> 32) + 1) << 32 | _next[top - 1].load (std::memory_order_relaxed);
+
+        if (_head.compare_exchange_weak (old_head, new_head, std::memory_order_acquire, std::memory_order_acquire))
+          {
+            index = top - 1;
+            return true;
+          }
+      }
+  }
+
+  void
+  push (std::uint32_t index) noexcept
+  {
+    std::uint64_t old_head = _head.load (std::memory_order_relaxed);
+
+    for (;;)
+      {
+        _next[index].store ((std::uint32_t)old_head, std::memory_order_relaxed);
+
+        std::uint64_t new_head = ((old_head >> 32) + 1) << 32 | (index + 1);
+
+        if (_head.compare_exchange_weak (old_head, new_head, std::memory_order_release, std::memory_order_relaxed))
+          {
+            return;
+          }
+      }
+  }
+};
+
+// Кэш свободных буферов одного пула в одном потоке
+struct buffer_cache
+{
+  std::shared_ptr<buffer_stack> stack;
+  int count;
+  std::uint32_t indexes[libsh_treis::libc::buffer_pool::cache_size];
+};
+
+// Все кэши потока. Пулов у потока обычно один-два, поэтому просто vector
+class thread_buffer_caches : libsh_treis::tools::not_movable
+{
+  std::vector<buffer_cache> _caches;
+
+public:
+  thread_buffer_caches (void) = default;
+
+  // Поток завершается: отдаём буферы в общие стеки
+  ~thread_buffer_caches (void)
+  {
+    for (buffer_cache &cache : _caches)
+      {
+        for (int i = 0; i != cache.count; ++i)
+          {
+            cache.stack->push (cache.indexes[i]);
+          }
+      }
+  }
+
+  buffer_cache *
+  find (const buffer_stack *stack) noexcept
+  {
+    for (buffer_cache &cache : _caches)
+      {
+        if (cache.stack.get () == stack)
+          {
+            return &cache;
+          }
+      }
+
+    return nullptr;
+  }
+
+  // Как find, но создаёт кэш, если его нет. Заодно выбрасывает кэши разрушенных пулов (их буферы уже никому не нужны)
+  buffer_cache &
+  x_find_or_add (const std::shared_ptr<buffer_stack> &stack)
+  {
+    buffer_cache *result = find (stack.get ());
+
+    if (result != nullptr)
+      {
+        return *result;
+      }
+
+    std::erase_if (_caches, [](const buffer_cache &cache){ return !cache.stack->alive.load (std::memory_order_relaxed); });
+    _caches.push_back (buffer_cache {.stack = stack, .count = 0, .indexes = {}});
+    return _caches.back ();
+  }
+};
+
+thread_local thread_buffer_caches thread_caches;
+}
+
+namespace libsh_treis::libc
+{
+pooled_buffer::~pooled_buffer (void)
+{
+  _pool._release (_index);
+}
+
+buffer_pool::buffer_pool (std::size_t buffer_size, std::size_t alignment, std::size_t buffers_per_slab, std::size_t max_slabs)
+{
+  LIBSH_TREIS_ASSERT (buffer_size != 0 && buffers_per_slab != 0 && max_slabs != 0);
+  LIBSH_TREIS_ASSERT (alignment != 0 && (alignment & (alignment - 1)) == 0 && alignment <= (std::size_t)sysconf (_SC_PAGESIZE));
+  LIBSH_TREIS_ASSERT (buffers_per_slab * max_slabs < UINT32_MAX);
+
+  // Размер slab'а кратен 2 MiB, чтобы он целиком мог лежать в huge pages. Оставшееся место тоже заполняем буферами
+  constexpr std::size_t huge_page = 2 * 1024 * 1024;
+
+  _buffer_size = (buffer_size + alignment - 1) / alignment * alignment;
+  _slab_size = (_buffer_size * buffers_per_slab + huge_page - 1) / huge_page * huge_page;
+  _buffers_per_slab = _slab_size / _buffer_size;
+  _max_slabs = max_slabs;
+  LIBSH_TREIS_ASSERT (_buffers_per_slab * _max_slabs < UINT32_MAX);
+
+  _slabs = std::make_unique<std::unique_ptr<mapping>[]> (_max_slabs);
+  _slab_addresses = std::make_unique<std::atomic<std::byte *>[]> (_max_slabs);
+  _stack = std::make_shared<libsh_treis::libc::detail::buffer_stack> (_buffers_per_slab * _max_slabs);
+  _slab_count = 0;
+}
+
+buffer_pool::~buffer_pool (void)
+{
+  _stack->alive.store (false, std::memory_order_relaxed);
+}
+
+// Добавляет slab, кладёт его буферы в общий стек, кроме одного, который возвращает
+std::uint32_t
+buffer_pool::_x_grow (void)
+{
+  std::lock_guard<std::mutex> lock (_grow_mutex);
+
+  // Пока ждали, кто-то другой мог добавить slab
+  std::uint32_t result;
+
+  if (_stack->pop (result))
+    {
+      return result;
+    }
+
+  if (_slab_count == _max_slabs)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Pool is exhausted");
+    }
+
+  // mmap выравнивает только на страницу. Чтобы slab целиком мог лежать в huge pages, берём на 2 MiB больше и обрезаем края
+  constexpr std::size_t huge_page = 2 * 1024 * 1024;
+
+  std::byte *raw = (std::byte *)libsh_treis::libc::no_raii::x_mmap (nullptr, _slab_size + huge_page, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  std::byte *aligned = (std::byte *)(((std::uintptr_t)raw + huge_page - 1) / huge_page * huge_page);
+
+  // Ошибки munmap здесь быть не может (адреса наши и выровнены на страницу), а бросить исключение, не потеряв raw, было бы сложно
+  if (aligned != raw)
+    {
+      munmap (raw, aligned - raw);
+    }
+
+  if (aligned + _slab_size != raw + _slab_size + huge_page)
+    {
+      munmap (aligned + _slab_size, raw + _slab_size + huge_page - (aligned + _slab_size));
+    }
+
+  _slabs[_slab_count] = std::make_unique<mapping> (aligned, _slab_size);
+
+  // Только подсказка, поэтому ошибку (например, если ядро собрано без THP) игнорируем
+  madvise (aligned, _slab_size, MADV_HUGEPAGE);
+
+  _slab_addresses[_slab_count].store (aligned, std::memory_order_relaxed);
+
+  std::uint32_t first = _slab_count * _buffers_per_slab;
+
+  ++_slab_count;
+
+  for (std::uint32_t i = first + _buffers_per_slab - 1; i != first; --i)
+    {
+      _stack->push (i);
+    }
+
+  return first;
+}
+
+pooled_buffer
+buffer_pool::x_allocate (void)
+{
+  libsh_treis::libc::detail::buffer_cache &cache = libsh_treis::libc::detail::thread_caches.x_find_or_add (_stack);
+  std::uint32_t index;
+
+  if (cache.count != 0)
+    {
+      index = cache.indexes[--cache.count];
+    }
+  else if (!_stack->pop (index))
+    {
+      index = _x_grow ();
+    }
+
+  return pooled_buffer (*this, _address (index), index);
+}
+
+void
+buffer_pool::_release (std::uint32_t index) noexcept
+{
+  libsh_treis::libc::detail::buffer_cache *cache = libsh_treis::libc::detail::thread_caches.find (_stack.get ());
+
+  // Если у этого потока кэша нет (он только возвращает буферы, но не берёт), то сразу в общий стек
+  if (cache != nullptr && cache->count != cache_size)
+    {
+      cache->indexes[cache->count++] = index;
+      return;
+    }
+
+  _stack->push (index);
+}
+}
+
+//@ #include <stddef.h>
+//@ #include <stdio.h>
+//@ #include <stdlib.h>
+//@ #include <sys/types.h>
+//@ #include <memory>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class getline_buffer: libsh_treis::tools::not_movable
+//@ {
+//@   char *line;
+//@   size_t n;
+//@
+//@ public:
+//@   getline_buffer (void) noexcept : line (nullptr)
+//@   {
+//@   }
+//@
+//@   ~getline_buffer (void)
+//@   {
+//@     free (line);
+//@   }
+//@
+//@   // Пока в моих задачах мне было нужно лишь следующее:
+//@   // - getline, а не getdelim
+//@   // - Проверка на наличие нулевых байтов (внимание! сейчас у меня именно getline, а не getdelim, а значит, delimiter не может быть '\0'; если буду использовать getdelim, подумать об этом)
+//@   // - Выкидывание завершающего delimiter'а (если в конце файла нет delimiter'а, то не бросаем исключение для совместимости с виндовыми практиками)
+//@   std::unique_ptr<libsh_treis::tools::cstring_span>
+//@   getline (FILE *stream)
+//@   {
+//@     ssize_t result = libsh_treis::libc::no_raii::x_getline (&line, &n, stream);
+//@
+//@     if (result == -1)
+//@       {
+//@         return nullptr;
+//@       }
+//@
+//@     if (line[result - 1] == '\n')
+//@       {
+//@         line[result - 1] = '\0';
+//@         --result;
+//@       }
+//@
+//@     return std::make_unique<libsh_treis::tools::cstring_span> (libsh_treis::tools::make_cstring_span (line, result));
+//@   }
+//@ };
 //@ }
 
-//@ // Выделяет память для массива, инициализируя с помощью default initializing. Независимо от того, что написано в стандарте. Добавил, т. к. не нашёл подобной функции в моей реализации стандартной библиотеки C++. Когда будет везде, надо будет удалить
+// Вы должны позаботиться, чтобы эта функция всегда писала непустую строку
+// Мы просто ставим лимит на длину строки. Если лимит будет достигнут, будет исключение
+namespace libsh_treis::libc //@
+{ //@
+std::string //@
+x_strftime (const char *format, const tm &tm)//@;
+{
+  char buffer[256];
+  return libsh_treis::libc::no_raii::x_strftime (buffer, format, tm).str ();
+}
+} //@
+
+#include <array>
+#include <cstdint>
+#include <limits>
+#include <string.h>
+#include <errno.h>
+namespace libsh_treis::libc::detail
+{
+// "00", "01", ..., "99" подряд
+constexpr auto two_digits = []
+{
+  std::array<char, 200> result;
+
+  for (int i = 0; i != 100; ++i)
+    {
+      result[2 * i] = (char)('0' + i / 10);
+      result[2 * i + 1] = (char)('0' + i % 10);
+    }
+
+  return result;
+}();
+
+// Пишет 9 цифр value с ведущими нулями
+void
+write_9_digits (char *out, std::uint32_t value) noexcept
+{
+  out[8] = (char)('0' + value % 10);
+  value /= 10;
+
+  for (int i = 6; i >= 0; i -= 2)
+    {
+      memcpy (out + i, two_digits.data () + 2 * (value % 100), 2);
+      value /= 100;
+    }
+}
+
+// То же, что gmtime_r, но без обращения к libc. gmtime_r в glibc берёт глобальный lock (из-за tzset), а нам часовой пояс не нужен. Алгоритм civil_from_days Говарда Хиннанта. Как и gmtime_r, бросает EOVERFLOW, если год не влезает в int
+tm
+x_utc_tm (time_t t)
+{
+  std::int64_t days = t / 86400;
+  std::int64_t secs = t % 86400;
+
+  if (secs < 0)
+    {
+      secs += 86400;
+      --days;
+    }
+
+  tm result = {};
+
+  result.tm_sec = (int)(secs % 60);
+  result.tm_min = (int)(secs / 60 % 60);
+  result.tm_hour = (int)(secs / 3600);
+
+  // 1970-01-01 - четверг
+  result.tm_wday = (int)((days % 7 + 11) % 7);
+
+  std::int64_t z = days + 719468;
+  std::int64_t era = (z >= 0 ? z : z - 146096) / 146097;
+  std::int64_t doe = z - era * 146097;
+  std::int64_t yoe = (doe - doe / 1460 + doe / 36524 - doe / 146096) / 365;
+  std::int64_t doy = doe - (365 * yoe + yoe / 4 - yoe / 100);
+  std::int64_t mp = (5 * doy + 2) / 153;
+  std::int64_t month = mp < 10 ? mp + 3 : mp - 9;
+  std::int64_t year = yoe + era * 400 + (month <= 2);
+
+  if (year - 1900 < std::numeric_limits<int>::min () || year - 1900 > std::numeric_limits<int>::max ())
+    {
+      errno = EOVERFLOW;
+      THROW_ERRNO;
+    }
+
+  result.tm_mday = (int)(doy - (153 * mp + 2) / 5 + 1);
+  result.tm_mon = (int)(month - 1);
+  result.tm_year = (int)(year - 1900);
+
+  bool leap = year % 4 == 0 && (year % 100 != 0 || year % 400 == 0);
+
+  // doy считается от 1 марта
+  result.tm_yday = (int)(mp < 10 ? doy + 59 + leap : doy - 306);
+  result.tm_zone = "GMT";
+
+  return result;
+}
+}
+
+// Берёт timespec и пишет в s время в UTC, т. е. делает нечто, похожее на strftime. Но в отличие от strftime дописывает секунды, точку и наносекунды. Ничего не выделяет в куче
+// Результат strftime и секунды кешируются в thread_local переменной, пока не сменится секунда или format, так что на каждый вызов в среднем остаётся только memcpy и запись наносекунд
+// Вы должны позаботиться, чтобы format всегда давал непустую строку. Если результат не влез в s, будет исключение
+//@ #include <time.h>
+//@ #include <span>
+namespace libsh_treis::libc::no_raii //@
+{ //@
+libsh_treis::tools::cstring_span //@
+x_utc_nanoseconds (std::span<char> s, const char *format, const timespec &spec)//@;
+{
+  LIBSH_TREIS_ASSERT (spec.tv_nsec >= 0 && spec.tv_nsec < 1000000000);
+
+  struct cache
+  {
+    bool valid = false;
+    time_t sec;
+    char format[64];
+    char prefix[256 + 2]; // Как в x_strftime (const char *, const tm &): до 255 символов strftime, плюс секунды
+    std::size_t prefix_size;
+  };
+
+  thread_local cache c;
+
+  std::size_t format_size = strlen (format);
+
+  // Слишком длинный format не кешируем
+  bool cacheable = format_size < sizeof (c.format);
+
+  if (!(cacheable && c.valid && c.sec == spec.tv_sec && memcmp (c.format, format, format_size + 1) == 0))
+    {
+      tm tm = libsh_treis::libc::detail::x_utc_tm (spec.tv_sec);
+
+      // Если x_strftime бросит исключение, c.prefix будет испорчен, поэтому сначала сбрасываем кеш
+      c.valid = false;
+
+      std::size_t prefix_size = libsh_treis::libc::no_raii::x_strftime (std::span<char> (c.prefix, sizeof (c.prefix) - 2), format, tm).sv ().size ();
+
+      memcpy (c.prefix + prefix_size, libsh_treis::libc::detail::two_digits.data () + 2 * tm.tm_sec, 2);
+      c.prefix_size = prefix_size + 2;
+      c.sec = spec.tv_sec;
+      c.valid = cacheable;
+
+      if (cacheable)
+        {
+          memcpy (c.format, format, format_size + 1);
+        }
+    }
+
+  // Префикс, точка, 9 цифр, '\0'
+  std::size_t size = c.prefix_size + 1 + 9;
+
+  if (size + 1 > s.size ())
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+    }
+
+  memcpy (s.data (), c.prefix, c.prefix_size);
+  s[c.prefix_size] = '.';
+  libsh_treis::libc::detail::write_9_digits (s.data () + c.prefix_size + 1, (std::uint32_t)spec.tv_nsec);
+  s[size] = '\0';
+
+  return libsh_treis::tools::make_cstring_span_unsafe (s.data (), size);
+}
+} //@
+
+// То же, что no_raii::x_utc_nanoseconds, но возвращает std::string
+//@ #include <time.h>
+namespace libsh_treis::libc //@
+{ //@
+std::string //@
+utc_nanoseconds (const char *format, const timespec &spec)//@;
+{
+  char buffer[256 + 2 + 1 + 9 + 1];
+  return libsh_treis::libc::no_raii::x_utc_nanoseconds (buffer, format, spec).str ();
+}
+} //@
+
+// Журнал только для дописывания с group commit'ом. Каждая запись пишется (write'ом, под mutex'ом, целиком), и x_append возвращает append_completion. append_completion::x_wait ждёт, пока запись не окажется на диске
+// Group commit: если никто не делает fdatasync, то поток из x_wait становится лидером и делает один fdatasync за всех, кто уже дописал свои записи. Остальные просто ждут его. Так на много одновременных писателей приходится один flush устройства, а не по одному на запись
+// batch_window: лидер перед fdatasync ждёт столько, чтобы набралось больше записей. 0 - не ждать (меньше задержка). Больше - больше пропускная способность при многих писателях
+// write_behind: каждые столько байт запускается write-back (sync_file_range) только что записанного куска, а предыдущий кусок дожидается. Так грязных страниц в кэше не больше двух кусков, и fdatasync не приходится сбрасывать всё сразу. 0 - выключено
+// Объект не владеет fd. Записи дописываются в конец файла, т. е. fd должен быть открыт на запись и спозиционирован в конце (например, с O_APPEND), и больше никто не должен писать в этот файл
+// Ошибка fdatasync или записи отравляет журнал: после неудачного fsync Linux может выбросить грязные страницы, и следующий fsync уже ничего не скажет. Поэтому все ждущие и все последующие x_append и x_wait бросают то же исключение
+// Деструктор ничего не сбрасывает: записи, для которых не вызван x_wait, могут не сохраниться
+//@ #include <chrono>
+//@ #include <condition_variable>
 //@ #include <cstddef>
-//@ #include <memory>
-//@ #include <type_traits>
-//@ namespace libsh_treis::tools
-//@ {
-//@ template <typename T> std::unique_ptr<T>
-//@ make_unique_default_init (std::size_t size)
+//@ #include <cstdint>
+//@ #include <exception>
+//@ #include <mutex>
+//@ #include <span>
+//@ #include <sys/types.h>
+//@ namespace libsh_treis::libc
 //@ {
-//@   static_assert (std::is_unbounded_array_v<T>);
-//@   return std::unique_ptr<T> (new std::remove_extent_t<T>[size]);
-//@ }
-//@ }
+//@ class durable_appender;
 
-//@ // Owning span
-//@ // Предназначен, например, для хранения данных сразу после чтения read'ом или перед записыванием write'ом. От unique_ptr<T[]> отличается отсутствием особого состояния и хранением длины
-//@ // От std::vector отличается отсутствием особого состояния (vector можно переместить и оставить исходный объект в пустом состоянии)
-//@ // Можно создать ospan нулевой длины. Но идеоматический код не должен использовать такой ospan как маркер отсутствия ospan'а
-//@ // ospan нельзя перемещать. Копировать можно, но на данный момент не реализовано
-//@ // Методы begin и end нужны, иначе в debian sid от 2022-05-30 с clang'ом из репы debian нельзя конвертить этот ospan в span
-//@ #include <cstddef>
-//@ #include <cassert>
-//@ #include <type_traits>
-//@ #include <utility>
-//@ namespace libsh_treis::tools
+//@ class append_completion
 //@ {
-//@ template <typename T> class ospan: libsh_treis::tools::not_movable
+//@   durable_appender *_appender;
+//@   std::uint64_t _seq;
+
+//@ public:
+//@   explicit append_completion (durable_appender &appender, std::uint64_t seq) noexcept : _appender (&appender), _seq (seq)
+//@   {
+//@   }
+
+//@   void
+//@   x_wait (void) const;
+//@ };
+
+//@ class durable_appender : libsh_treis::tools::not_movable
 //@ {
-//@   static_assert (!std::is_unbounded_array_v<T>);
+//@   int _fd;
+//@   std::chrono::microseconds _batch_window;
+//@   off_t _write_behind;
+//@   std::mutex _mutex;
+//@   std::condition_variable _synced;
+//@   std::uint64_t _appended;
+//@   std::uint64_t _durable;
+//@   bool _syncing;
+//@   std::exception_ptr _error;
+//@   off_t _offset;
+//@   off_t _chunk_begin;
+//@   off_t _prev_chunk_begin;
+
+//@   void
+//@   _x_write_behind (void);
+
+//@   friend class append_completion;
+
+//@   void
+//@   _x_wait (std::uint64_t seq);
 
-//@   T *_ptr;
-//@   std::size_t _size;
+//@ public:
+//@   explicit durable_appender (int fildes, std::chrono::microseconds batch_window = std::chrono::microseconds (0), off_t write_behind = 8 * 1024 * 1024);
 
-//@   explicit ospan (T *ptr, std::size_t size) noexcept : _ptr (ptr), _size (size)
+//@   int
+//@   resource (void) const noexcept
 //@   {
+//@     return _fd;
 //@   }
 
-//@   template <typename U> friend ospan<U>
-//@   make_ospan (std::size_t size);
+//@   append_completion
+//@   x_append (std::span<const std::byte> record);
 
-//@   template <typename U> friend ospan<U>
-//@   make_ospan_for_overwrite (std::size_t size);
+//@   // x_append и сразу x_wait
+//@   void
+//@   x_append_durable (std::span<const std::byte> record);
+//@ };
+//@ }
 
-//@   template <typename U> friend void
-//@   swap (ospan<U> &, ospan<U> &) noexcept;
+#include <algorithm>
+#include <sys/stat.h>
+namespace libsh_treis::libc
+{
+void
+append_completion::x_wait (void) const
+{
+  _appender->_x_wait (_seq);
+}
+
+durable_appender::durable_appender (int fildes, std::chrono::microseconds batch_window, off_t write_behind) : _fd (fildes), _batch_window (batch_window), _write_behind (write_behind), _appended (0), _durable (0), _syncing (false), _offset (x_fstat (fildes).st_size), _chunk_begin (_offset), _prev_chunk_begin (-1)
+{
+}
+
+// Вызывается под _mutex
+void
+durable_appender::_x_write_behind (void)
+{
+  if (_write_behind == 0 || _offset - _chunk_begin < _write_behind)
+    {
+      return;
+    }
+
+  x_sync_file_range (_fd, _chunk_begin, _offset - _chunk_begin, sync_file_range_write);
+
+  if (_prev_chunk_begin != -1)
+    {
+      x_sync_file_range (_fd, _prev_chunk_begin, _chunk_begin - _prev_chunk_begin, sync_file_range_wait_before | sync_file_range_write | sync_file_range_wait_after);
+    }
+
+  _prev_chunk_begin = _chunk_begin;
+  _chunk_begin = _offset;
+}
+
+append_completion
+durable_appender::x_append (std::span<const std::byte> record)
+{
+  std::lock_guard lock (_mutex);
+
+  if (_error)
+    {
+      std::rethrow_exception (_error);
+    }
+
+  try
+    {
+      write_repeatedly (_fd, record);
+      _offset += record.size ();
+      _x_write_behind ();
+    }
+  catch (...)
+    {
+      // Непонятно, сколько записи попало в файл, поэтому дальше писать нельзя
+      _error = std::current_exception ();
+      _synced.notify_all ();
+      throw;
+    }
+
+  ++_appended;
+
+  return append_completion (*this, _appended);
+}
+
+void
+durable_appender::_x_wait (std::uint64_t seq)
+{
+  std::unique_lock lock (_mutex);
+
+  for (;;)
+    {
+      if (_error)
+        {
+          std::rethrow_exception (_error);
+        }
+
+      if (_durable >= seq)
+        {
+          return;
+        }
+
+      if (_syncing)
+        {
+          _synced.wait (lock);
+          continue;
+        }
+
+      // Становимся лидером
+      _syncing = true;
+
+      if (_batch_window.count () != 0)
+        {
+          _synced.wait_for (lock, _batch_window, [this]{ return _error != nullptr; });
+        }
+
+      std::uint64_t target = _appended;
+
+      lock.unlock ();
+
+      std::exception_ptr error;
+
+      try
+        {
+          x_fdatasync (_fd);
+        }
+      catch (...)
+        {
+          error = std::current_exception ();
+        }
+
+      lock.lock ();
+
+      _syncing = false;
+
+      if (error)
+        {
+          _error = error;
+        }
+      else
+        {
+          _durable = std::max (_durable, target);
+        }
+
+      _synced.notify_all ();
+    }
+}
+
+void
+durable_appender::x_append_durable (std::span<const std::byte> record)
+{
+  x_append (record).x_wait ();
+}
+}
 
+// Атомная замена файла: пишем во временный файл в той же директории, а потом за один rename подменяем им path. Читатели видят либо старый файл целиком, либо новый целиком, в том числе после падения системы
+// Временный файл - безымянный (O_TMPFILE), поэтому если процесс упадёт, мусора не останется. Если файловая система не поддерживает O_TMPFILE, то x_mkstemp с именем ".<имя>.XXXXXX" (права тогда ставятся fchmod'ом, и umask применяется вручную, так что в обоих случаях у файла mode & ~umask)
+// Данные пишутся через output (), это output_buffer
+// x_commit: flush, fsync файла, linkat через /proc/self/fd во временное имя (только для O_TMPFILE), renameat2 на path, fsync директории
+// Если задан backup_path, то используется RENAME_EXCHANGE: path должен существовать, и старая версия атомно оказывается во временном имени, а потом переименовывается в backup_path (он должен быть на той же файловой системе). Если это переименование не удалось, то обмен откатывается повторным RENAME_EXCHANGE, и path остаётся старым. fsync делается и для директории backup_path
+// Директории path и backup_path открываются в конструкторе, т. е. относительные пути считаются от текущей директории на момент конструктора
+// Без x_commit ничего не заменяется: деструктор просто удаляет временный файл. Так же, если x_commit не удался до замены, то временный файл удаляется, а path не трогается
+//@ #include <string>
+//@ #include <memory>
+//@ #include <sys/types.h>
+//@ namespace libsh_treis::libc
+//@ {
+//@ class atomic_file_writer : libsh_treis::tools::not_movable
+//@ {
+//@   fd _dir;
+//@   std::string _name;
+//@
+//@   // nullptr, если backup_path не задан
+//@   std::unique_ptr<fd> _backup_dir;
+//@   std::string _backup_name;
+//@   std::unique_ptr<fd> _file;
+//@
+//@   // Пусто для O_TMPFILE
+//@   std::string _temp_name;
+//@   std::unique_ptr<output_buffer> _out;
+//@   bool _done;
+//@
+//@   void
+//@   _discard (void) noexcept;
+//@
+//@   void
+//@   _x_link_temp (void);
+//@
 //@ public:
-//@   ~ospan (void)
+//@   static constexpr std::size_t buffer_size = 256 * 1024;
+//@
+//@   explicit atomic_file_writer (const char *path, mode_t mode = 0644, const char *backup_path = nullptr);
+//@
+//@   ~atomic_file_writer (void) noexcept;
+//@
+//@   output_buffer &
+//@   output (void) noexcept
 //@   {
-//@     delete [] _ptr;
+//@     return *_out;
 //@   }
+//@
+//@   void
+//@   x_commit (void);
+//@ };
+//@ }
 
-//@   const T *
-//@   data (void) const noexcept
-//@   {
-//@     return _ptr;
-//@   }
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/fs.h>
+namespace libsh_treis::libc::detail
+{
+// path -> директория и имя
+std::pair<std::string, std::string>
+split_path (const char *path)
+{
+  std::string_view p (path);
+  std::size_t slash = p.rfind ('/');
 
-//@   T *
-//@   data (void) noexcept
-//@   {
-//@     return _ptr;
-//@   }
+  if (slash == std::string_view::npos)
+    {
+      return {".", std::string (p)};
+    }
 
-//@   std::size_t
-//@   size (void) const noexcept
-//@   {
-//@     return _size;
-//@   }
+  return {slash == 0 ? "/" : std::string (p.substr (0, slash)), std::string (p.substr (slash + 1))};
+}
+}
 
-//@   const T *
-//@   begin (void) const noexcept
-//@   {
-//@     return _ptr;
-//@   }
+namespace libsh_treis::libc
+{
+atomic_file_writer::atomic_file_writer (const char *path, mode_t mode, const char *backup_path) : _dir (libsh_treis::libc::no_raii::x_open_2 (libsh_treis::libc::detail::split_path (path).first.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC)), _name (libsh_treis::libc::detail::split_path (path).second), _done (false)
+{
+  LIBSH_TREIS_ASSERT (!_name.empty ());
 
-//@   T *
-//@   begin (void) noexcept
-//@   {
-//@     return _ptr;
-//@   }
+  if (backup_path != nullptr)
+    {
+      auto [dir, name] = libsh_treis::libc::detail::split_path (backup_path);
 
-//@   const T *
-//@   end (void) const noexcept
-//@   {
-//@     return _ptr + _size;
-//@   }
+      LIBSH_TREIS_ASSERT (!name.empty ());
 
-//@   T *
-//@   end (void) noexcept
-//@   {
-//@     return _ptr + _size;
-//@   }
+      _backup_dir = std::make_unique<fd> (libsh_treis::libc::no_raii::x_open_2 (dir.c_str (), O_RDONLY | O_DIRECTORY | O_CLOEXEC));
+      _backup_name = std::move (name);
+    }
 
-//@   const T &
-//@   operator[] (std::size_t i) const noexcept
-//@   {
-//@     assert (i < _size);
-//@     return _ptr[i];
-//@   }
+  int file = libsh_treis::libc::detail::open_tmpfile_reexported (_dir.resource (), mode);
+
+  if (file != -1)
+    {
+      _file = std::make_unique<fd> (file);
+    }
+  else
+    {
+      if (!(errno == EOPNOTSUPP || errno == EISDIR || errno == EINVAL))
+        {
+          THROW_ERRNO_MESSAGE (path);
+        }
 
-//@   T &
-//@   operator[] (std::size_t i) noexcept
-//@   {
-//@     assert (i < _size);
-//@     return _ptr[i];
-//@   }
-//@ };
+      auto [dir, name] = libsh_treis::libc::detail::split_path (path);
+      std::string templ = dir + "/." + name + ".XXXXXX";
 
-//@ template <typename T> void
-//@ swap (ospan<T> &a, ospan<T> &b) noexcept
-//@ {
-//@   std::swap (a._ptr,  b._ptr);
-//@   std::swap (a._size, b._size);
-//@ }
+      _file = std::make_unique<fd> (libsh_treis::libc::no_raii::x_mkstemp (templ.data ()));
+      _temp_name = templ.substr (dir.size () + 1);
+    }
 
-//@ template <typename T> ospan<T>
-//@ make_ospan (std::size_t size)
-//@ {
-//@   return ospan<T> (new T[size](), size);
-//@ }
+  // С этого момента может существовать именованный временный файл
+  try
+    {
+      if (!_temp_name.empty ())
+        {
+          // umask можно только прочитать, заодно поменяв. Сразу возвращаем старое значение. Если другой поток в это время создаёт файлы, он может их создать с umask 0
+          mode_t mask = umask (0);
 
-//@ template <typename T> ospan<T>
-//@ make_ospan_for_overwrite (std::size_t size)
-//@ {
-//@   return ospan<T> (new T[size], size);
-//@ }
-//@ }
+          umask (mask);
+          x_fchmod (_file->resource (), mode & ~mask);
+        }
 
-// Один из возможных алгоритмов правильного соединения компонентов пути. Используется тот алгоритм, который использует GNU find
-//@ #include <string_view>
-namespace libsh_treis::tools //@
-{ //@
-std::string //@
-build_path_find (std::string_view up, std::string_view down)//@;
+      _out = std::make_unique<output_buffer> (_file->resource (), buffer_size);
+    }
+  catch (...)
+    {
+      _discard ();
+      throw;
+    }
+}
+
+void
+atomic_file_writer::_discard (void) noexcept
 {
-  LIBSH_TREIS_ASSERT (!up.empty ());
-  LIBSH_TREIS_ASSERT (!down.empty ());
-  LIBSH_TREIS_ASSERT (down.front () != '/');
+  _done = true;
 
-  if (up.back () == '/')
+  // В конструкторе _out может ещё не быть
+  if (_out != nullptr)
     {
-      return std::string (up) + std::string (down);
+      _out->discard ();
     }
-  else
+
+  if (!_temp_name.empty ())
     {
-      return std::string (up) + "/" + std::string (down);
+      unlinkat (_dir.resource (), _temp_name.c_str (), 0);
     }
 }
-} //@
 
-//@ #include <dirent.h>
-//@ namespace libsh_treis::libc
-//@ {
-//@ class directory: libsh_treis::tools::not_movable
-//@ {
-//@   DIR *_d;
-//@   int _exceptions;
+// Даёт имя файлу из O_TMPFILE
+void
+atomic_file_writer::_x_link_temp (void)
+{
+  std::string proc_path = "/proc/self/fd/" + std::to_string (_file->resource ());
 
-//@ public:
-//@   explicit directory (DIR *d) noexcept : _d (d), _exceptions (std::uncaught_exceptions ())
-//@   {
-//@   }
+  // Имя может быть занято (например, другим процессом, пишущим тот же path), тогда пробуем следующее
+  for (unsigned int i = 0;; ++i)
+    {
+      std::string temp_name = "." + _name + "." + std::to_string (getpid ()) + "." + std::to_string (i);
 
-//@   ~directory (void) noexcept (false)
-//@   {
-//@     if (std::uncaught_exceptions () == _exceptions)
-//@       {
-//@         x_closedir (_d);
-//@       }
-//@     else
-//@       {
-//@         closedir (_d);
-//@       }
-//@   }
+      try
+        {
+          x_linkat (AT_FDCWD, proc_path.c_str (), _dir.resource (), temp_name.c_str (), AT_SYMLINK_FOLLOW);
+        }
+      catch (const errno_error &ex)
+        {
+          if (ex.error_number () == EEXIST)
+            {
+              continue;
+            }
 
-//@   DIR *
-//@   resource (void) const noexcept
-//@   {
-//@     return _d;
-//@   }
-//@ };
-//@ }
+          throw;
+        }
 
-namespace libsh_treis::libc //@
-{ //@
-directory //@
-x_opendir (const char *dirname)//@;
-{
-  return directory (libsh_treis::libc::no_raii::x_opendir (dirname));
+      _temp_name = std::move (temp_name);
+      return;
+    }
 }
-} //@
 
-//@ #include <span>
-//@ #include <cstddef>
-#include <string.h>
-namespace libsh_treis::libc //@
-{ //@
-int //@
-span_memcmp (std::span<const std::byte> s1, std::span<const std::byte> s2) noexcept//@;
+void
+atomic_file_writer::x_commit (void)
 {
-  LIBSH_TREIS_ASSERT (s1.size () == s2.size ());
-  return memcmp (s1.data (), s2.data (), s1.size ());
+  LIBSH_TREIS_ASSERT (!_done);
+
+  try
+    {
+      _out->x_flush ();
+      x_fsync (_file->resource ());
+
+      if (_temp_name.empty ())
+        {
+          _x_link_temp ();
+        }
+
+      if (_backup_dir == nullptr)
+        {
+          x_renameat2 (_dir.resource (), _temp_name.c_str (), _dir.resource (), _name.c_str (), 0);
+          _temp_name.clear ();
+        }
+      else
+        {
+          // Теперь в path новая версия, а во временном имени - старая
+          x_renameat2 (_dir.resource (), _temp_name.c_str (), _dir.resource (), _name.c_str (), RENAME_EXCHANGE);
+
+          try
+            {
+              x_renameat2 (_dir.resource (), _temp_name.c_str (), _backup_dir->resource (), _backup_name.c_str (), 0);
+            }
+          catch (...)
+            {
+              // Возвращаем старую версию на место. Если и это не удалось, то новая версия остаётся в path, а старую удаляем, чтобы не осталось мусора
+              (*libsh_treis::libc::detail::syscall_reexported) (SYS_renameat2, _dir.resource (), _temp_name.c_str (), _dir.resource (), _name.c_str (), RENAME_EXCHANGE);
+              throw;
+            }
+
+          _temp_name.clear ();
+        }
+
+      _done = true;
+
+      x_fsync (_dir.resource ());
+
+      if (_backup_dir != nullptr)
+        {
+          x_fsync (_backup_dir->resource ());
+        }
+    }
+  catch (...)
+    {
+      if (!_done)
+        {
+          _discard ();
+        }
+
+      throw;
+    }
 }
-} //@
 
-//@ #include <span>
-//@ #include <cstddef>
-#include <string.h>
-namespace libsh_treis::libc //@
-{ //@
-void //@
-span_memcpy (std::span<std::byte> dest, std::span<const std::byte> src) noexcept//@;
+// Деструкторы членов-fd бросают, если close не удался. Нам это уже не важно: файл либо закоммичен (и уже сделан fsync), либо выбрасывается. Поэтому ловим это в function-try-block и выходим через return, т. к. из конца его обработчика исключение бросилось бы снова
+atomic_file_writer::~atomic_file_writer (void) noexcept
+try
 {
-  LIBSH_TREIS_ASSERT (dest.size () == src.size ());
-  memcpy (dest.data (), src.data (), dest.size ());
+  if (!_done)
+    {
+      _discard ();
+    }
 }
-} //@
-
-//@ #include <stdio.h>
-//@ namespace libsh_treis::libc
-//@ {
-//@ class fp: libsh_treis::tools::not_movable
-//@ {
-//@   FILE *_fp;
-//@   int _exceptions;
-//@
-//@ public:
-//@   explicit fp (FILE *f) noexcept : _fp (f), _exceptions (std::uncaught_exceptions ())
-//@   {
-//@   }
-//@
-//@   ~fp (void) noexcept (false)
-//@   {
-//@     if (std::uncaught_exceptions () == _exceptions)
-//@       {
-//@         x_fclose (_fp);
-//@       }
-//@     else
-//@       {
-//@         fclose (_fp);
-//@       }
-//@   }
-//@
-//@   FILE *
-//@   resource (void) const noexcept
-//@   {
-//@     return _fp;
-//@   }
-//@ };
-//@ }
-
-namespace libsh_treis::libc //@
-{ //@
-fp //@
-x_fopen (const char *pathname, const char *mode)//@;
+catch (...)
 {
-  return fp (libsh_treis::libc::no_raii::x_fopen (pathname, mode));
+  return;
+}
 }
-} //@
 
-//@ #include <stddef.h>
-//@ #include <stdio.h>
-//@ #include <stdlib.h>
+// Последовательное чтение fd (обычного файла) с управлением page cache'ем: впереди позиции чтения - POSIX_FADV_WILLNEED на window байт (чтение идёт без ожидания диска), позади - POSIX_FADV_DONTNEED (прочитанное не вытесняет из кэша чужой рабочий набор)
+// DONTNEED выбрасывает из кэша и страницы, которые были там до нас, поэтому, если файл читают и другие, лучше не пользоваться
+// Объект не владеет fd. Читает pread'ом со своей позиции, начиная с offset, позицию fd не трогает
+//@ #include <cstddef>
+//@ #include <span>
 //@ #include <sys/types.h>
-//@ #include <memory>
 //@ namespace libsh_treis::libc
 //@ {
-//@ class getline_buffer: libsh_treis::tools::not_movable
+//@ class sequential_scan : libsh_treis::tools::not_movable
 //@ {
-//@   char *line;
-//@   size_t n;
-//@
+//@   int _fd;
+//@   off_t _page;
+//@   off_t _window;
+//@   off_t _pos;
+//@   off_t _advised;
+//@   off_t _dropped;
+
 //@ public:
-//@   getline_buffer (void) noexcept : line (nullptr)
-//@   {
-//@   }
-//@
-//@   ~getline_buffer (void)
+//@   explicit sequential_scan (int fildes, off_t offset = 0, off_t window = 8 * 1024 * 1024);
+
+//@   int
+//@   resource (void) const noexcept
 //@   {
-//@     free (line);
+//@     return _fd;
 //@   }
-//@
-//@   // Пока в моих задачах мне было нужно лишь следующее:
-//@   // - getline, а не getdelim
-//@   // - Проверка на наличие нулевых байтов (внимание! сейчас у меня именно getline, а не getdelim, а значит, delimiter не может быть '\0'; если буду использовать getdelim, подумать об этом)
-//@   // - Выкидывание завершающего delimiter'а (если в конце файла нет delimiter'а, то не бросаем исключение для совместимости с виндовыми практиками)
-//@   std::unique_ptr<libsh_treis::tools::cstring_span>
-//@   getline (FILE *stream)
+
+//@   off_t
+//@   position (void) const noexcept
 //@   {
-//@     ssize_t result = libsh_treis::libc::no_raii::x_getline (&line, &n, stream);
-//@
-//@     if (result == -1)
-//@       {
-//@         return nullptr;
-//@       }
-//@
-//@     if (line[result - 1] == '\n')
-//@       {
-//@         line[result - 1] = '\0';
-//@         --result;
-//@       }
-//@
-//@     return std::make_unique<libsh_treis::tools::cstring_span> (libsh_treis::tools::make_cstring_span (line, result));
+//@     return _pos;
 //@   }
+
+//@   // Как x_read: 0 - конец файла
+//@   ssize_t
+//@   x_read (std::span<std::byte> buf);
 //@ };
 //@ }
 
-// Вы должны позаботиться, чтобы эта функция всегда писала непустую строку
-// Мы просто ставим лимит на длину строки. Если лимит будет достигнут, будет исключение
-namespace libsh_treis::libc //@
-{ //@
-std::string //@
-x_strftime (const char *format, const tm &tm)//@;
+#include <fcntl.h>
+#include <unistd.h>
+namespace libsh_treis::libc
 {
-  char buffer[256];
-  return libsh_treis::libc::no_raii::x_strftime (buffer, format, tm).str ();
+sequential_scan::sequential_scan (int fildes, off_t offset, off_t window) : _fd (fildes), _page ((off_t)sysconf (_SC_PAGESIZE)), _window (window), _pos (offset), _advised (offset), _dropped (offset)
+{
+  LIBSH_TREIS_ASSERT (window > 0);
+
+  // Удваивает readahead ядра
+  x_posix_fadvise (_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
 }
-} //@
 
-// Берёт timespec и превращает его в строчку, показывающую время в UTC, т. е. делает нечто, похожее на strftime. Но в отличие от strftime дописывает секунды, точку и наносекунды
-//@ #include <time.h>
-namespace libsh_treis::libc //@
-{ //@
-std::string //@
-utc_nanoseconds (const char *format, const timespec &spec)//@;
+ssize_t
+sequential_scan::x_read (std::span<std::byte> buf)
 {
-  return x_strftime (format, x_gmtime_r (spec.tv_sec)) + x_strftime ("%S", x_gmtime_r (spec.tv_sec)) + x_asprintf (".%09d", (int)spec.tv_nsec);
+  while (_advised < _pos + (off_t)buf.size () + _window)
+    {
+      x_posix_fadvise (_fd, _advised, _window, POSIX_FADV_WILLNEED);
+      _advised += _window;
+    }
+
+  ssize_t result = x_pread (_fd, buf, _pos);
+
+  _pos += result;
+
+  // Выбрасываем пачками по window, границы выравниваем на страницу, чтобы не выбросить страницу, которую ещё читаем
+  if (_pos - _dropped >= _window)
+    {
+      off_t end = _pos / _page * _page;
+
+      x_posix_fadvise (_fd, _dropped, end - _dropped, POSIX_FADV_DONTNEED);
+      _dropped = end;
+    }
+
+  return result;
+}
 }
-} //@
@@ -0,0 +1,3044 @@
+#pragma once
+#include <functional>
+#include <exception>
+#include <stdexcept>
+#include <string>
+#include "gnu-source.hpp"
+#define _LIBSH_TREIS_THROW_MESSAGE(m) \
+  do \
+    { \
+      throw std::runtime_error (__PRETTY_FUNCTION__ + std::string (": ") + (m)); \
+    } \
+  while (false)
+#include <locale.h>
+namespace libsh_treis::libc
+{
+char *
+x_strerror_l (int errnum, locale_t locale);
+}
+#include <atomic>
+#include <stdexcept>
+#include <string_view>
+namespace libsh_treis::libc
+{
+class errno_error : public std::runtime_error
+{
+  int _errnum;
+  const char *_function;
+  char _message[256];
+
+  // nullptr, пока what () ещё не вызывали. Выделяется new[]
+  mutable std::atomic<char *> _what;
+
+public:
+  explicit errno_error (int errnum, const char *function) noexcept;
+
+  explicit errno_error (int errnum, const char *function, std::string_view message) noexcept;
+
+  errno_error (const errno_error &other) noexcept;
+
+  errno_error &
+  operator= (const errno_error &) = delete;
+
+  ~errno_error (void) override;
+
+  int
+  error_number (void) const noexcept
+  {
+    return _errnum;
+  }
+
+  const char *
+  function (void) const noexcept
+  {
+    return _function;
+  }
+
+  const char *
+  message (void) const noexcept
+  {
+    return _message;
+  }
+
+  const char *
+  what (void) const noexcept override;
+};
+}
+namespace libsh_treis::tools
+{
+bool
+is_successful (const std::function<void(void)> &func) noexcept;
+int
+main_helper (const std::function<void(void)> &func) noexcept;
+}
+namespace libsh_treis::tools
+{
+class not_movable
+{
+public:
+  not_movable (void) = default;
+  not_movable (not_movable &&) = delete;
+  not_movable (const not_movable &) = delete;
+  not_movable &
+  operator= (not_movable &&) = delete;
+  not_movable &
+  operator= (const not_movable &) = delete;
+};
+}
+#include <stdio.h>
+#include <stdlib.h>
+#define LIBSH_TREIS_ASSERT(assertion) \
+  do \
+    { \
+      if (assertion) \
+        { \
+          /* Пишем if именно в такой форме, чтобы сработал обычный contextual conversion to bool, а не "operator!" */ \
+        } \
+      else \
+        { \
+          fprintf (stderr, "%s", (libsh_treis::libc::detail::program_invocation_name_reexported () + std::string (": ") + __PRETTY_FUNCTION__ + std::string (": assertion \"") + #assertion + std::string ("\" failed")).c_str ()); \
+          exit (EXIT_FAILURE); \
+        } \
+    } \
+  while (false)
+#include <span>
+#include <cstddef>
+namespace libsh_treis::tools
+{
+template <typename T> std::span<const std::byte, sizeof (T)>
+any_as_bytes (const T &x) noexcept
+{
+  return std::as_bytes (std::span<const T, 1> (&x, 1));
+}
+template <typename T> std::span<std::byte, sizeof (T)>
+any_as_writable_bytes (T &x) noexcept
+{
+  return std::as_writable_bytes (std::span<T, 1> (&x, 1));
+}
+}
+#include <cstddef>
+#include <cassert>
+#include <span>
+namespace libsh_treis::tools
+{
+class cstring_span
+{
+  char *_data;
+  std::size_t _size;
+
+  explicit cstring_span (char *data, std::size_t size) noexcept : _data (data), _size (size)
+  {
+    assert (strlen (data) == size);
+  }
+
+  friend cstring_span
+  make_cstring_span (char *, std::size_t);
+
+  friend cstring_span
+  make_cstring_span_unsafe (char *, std::size_t) noexcept;
+
+public:
+  char *
+  c_str (void) const noexcept
+  {
+    return _data;
+  }
+
+  std::string_view
+  sv (void) const noexcept
+  {
+    return std::string_view (_data, _size);
+  }
+
+  std::string
+  str (void) const
+  {
+    return std::string (this->sv ());
+  }
+
+  std::span<char>
+  span_nunu (void) const noexcept
+  {
+    return std::span<char> (_data, _size);
+  }
+};
+}
+#include <cstddef>
+namespace libsh_treis::tools
+{
+cstring_span
+make_cstring_span (char *data, std::size_t size);
+}
+#include <cstddef>
+namespace libsh_treis::tools
+{
+cstring_span
+make_cstring_span_unsafe (char *data, std::size_t size) noexcept;
+}
+namespace libsh_treis::tools
+{
+// Соответствует понятию из стандарта
+template <typename T> concept Cpp17Destructible = requires (T x)
+{
+  { x.~T () } noexcept;
+};
+}
+#include <memory>
+namespace libsh_treis::tools
+{
+template <typename T> std::unique_ptr<T>
+ptr_to_unique (T *ptr)
+{
+  return std::unique_ptr<T> (ptr);
+}
+}
+#include <sys/types.h> // size_t, ssize_t
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+x_write (int fildes, std::span<const std::byte> buf);
+}
+#include <sys/types.h> // size_t, ssize_t
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+x_read (int fildes, std::span<std::byte> buf);
+}
+#include <sys/types.h> // ssize_t
+#include <sys/uio.h>
+#include <span>
+namespace libsh_treis::libc
+{
+ssize_t
+x_writev (int fildes, std::span<const iovec> iov);
+}
+#include <sys/types.h> // ssize_t
+#include <sys/uio.h>
+#include <span>
+namespace libsh_treis::libc
+{
+ssize_t
+x_readv (int fildes, std::span<const iovec> iov);
+}
+#include <cassert>
+namespace libsh_treis::libc
+{
+template <typename T> class try_result
+{
+  T _value;
+  int _error;
+  explicit try_result (T value, int error) noexcept : _value (value), _error (error)
+  {
+  }
+public:
+  static try_result
+  success (T value) noexcept
+  {
+    return try_result (value, 0);
+  }
+  static try_result
+  failure (int error) noexcept
+  {
+    assert (error != 0);
+    return try_result (T (), error);
+  }
+  bool
+  has_value (void) const noexcept
+  {
+    return _error == 0;
+  }
+  explicit operator bool (void) const noexcept
+  {
+    return has_value ();
+  }
+  T
+  value (void) const noexcept
+  {
+    assert (has_value ());
+    return _value;
+  }
+  int
+  error (void) const noexcept
+  {
+    assert (!has_value ());
+    return _error;
+  }
+};
+}
+#include <cstddef>
+#include <sys/types.h>
+#include <span>
+namespace libsh_treis::libc
+{
+try_result<ssize_t>
+try_read (int fildes, std::span<std::byte> buf);
+try_result<ssize_t>
+try_write (int fildes, std::span<const std::byte> buf);
+}
+#include <cstddef>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <span>
+namespace libsh_treis::libc
+{
+try_result<ssize_t>
+try_readv (int fildes, std::span<const iovec> iov);
+try_result<ssize_t>
+try_writev (int fildes, std::span<const iovec> iov);
+}
+#include <sys/socket.h>
+namespace libsh_treis::libc::no_raii
+{
+try_result<int>
+try_accept (int socket, sockaddr *address, socklen_t *address_len);
+}
+#include <cstddef>
+#include <sys/types.h>
+#include <span>
+namespace libsh_treis::libc
+{
+try_result<ssize_t>
+try_recv (int socket, std::span<std::byte> buf, int flags);
+try_result<ssize_t>
+try_send (int socket, std::span<const std::byte> buf, int flags);
+}
+#include <sys/types.h> // ssize_t, off_t
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+x_writev (int fildes, std::span<const std::span<const std::byte>> bufs);
+ssize_t
+x_readv (int fildes, std::span<const std::span<std::byte>> bufs);
+ssize_t
+x_pwritev2 (int fildes, std::span<const std::span<const std::byte>> bufs, off_t offset, int flags);
+ssize_t
+x_preadv2 (int fildes, std::span<const std::span<std::byte>> bufs, off_t offset, int flags);
+}
+#include <sys/types.h> // size_t, ssize_t, off_t
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+x_pwrite (int fildes, std::span<const std::byte> buf, off_t offset);
+ssize_t
+x_pread (int fildes, std::span<std::byte> buf, off_t offset);
+}
+#include <sys/types.h> // ssize_t, off_t
+#include <sys/uio.h> // RWF_NOWAIT, RWF_HIPRI, ...
+#include <span>
+namespace libsh_treis::libc
+{
+ssize_t
+x_pwritev2 (int fildes, std::span<const iovec> iov, off_t offset, int flags);
+ssize_t
+x_preadv2 (int fildes, std::span<const iovec> iov, off_t offset, int flags);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+int
+x_fgetc (FILE *stream);
+}
+namespace libsh_treis::libc
+{
+int
+x_getchar_nunu (void);
+}
+#include <sys/types.h> // size_t, ssize_t
+#include <stdio.h>
+namespace libsh_treis::libc::no_raii
+{
+ssize_t
+x_getdelim (char **lineptr, size_t *n, int delimiter, FILE *stream);
+}
+#include <sys/types.h> // size_t, ssize_t
+#include <stdio.h>
+namespace libsh_treis::libc::no_raii
+{
+ssize_t
+x_getline (char **lineptr, size_t *n, FILE *stream);
+}
+#include <fcntl.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_open_2 (const char *path, int oflag);
+}
+#include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_open_3 (const char *path, int oflag, mode_t mode);
+}
+#include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_openat_3 (int dirfd, const char *path, int oflag);
+int
+x_openat_4 (int dirfd, const char *path, int oflag, mode_t mode);
+}
+namespace libsh_treis::libc
+{
+void
+x_close (int fildes);
+}
+#include <fcntl.h>
+namespace libsh_treis::libc
+{
+int
+x_fcntl_2 (int fildes, int cmd);
+int
+x_fcntl_3 (int fildes, int cmd, int arg);
+}
+#include <stdarg.h>
+namespace libsh_treis::libc
+{
+int
+x_vdprintf (int fildes, const char *format, va_list ap);
+}
+#include <stdarg.h>
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+int
+x_vfprintf (FILE *stream, const char *format, va_list ap);
+}
+#include <stdarg.h>
+namespace libsh_treis::libc
+{
+int
+x_vprintf (const char *format, va_list ap);
+}
+#include <span>
+#include <stdarg.h>
+namespace libsh_treis::libc
+{
+int
+x_vsnprintf (std::span<char> s, const char *format, va_list ap);
+}
+#include <stdarg.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_vasprintf (char **strp, const char *fmt, va_list ap);
+}
+namespace libsh_treis::libc
+{
+int
+x_dprintf (int fildes, const char *format, ...);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+int
+x_fprintf (FILE *stream, const char *format, ...);
+}
+namespace libsh_treis::libc
+{
+int
+x_printf (const char *format, ...);
+}
+#include <span>
+namespace libsh_treis::libc
+{
+int
+x_snprintf (std::span<char> s, const char *format, ...);
+}
+namespace libsh_treis::libc::no_raii
+{
+int
+x_asprintf_nunu (char **strp, const char *fmt, ...);
+}
+namespace libsh_treis::libc
+{
+void
+x_chdir (const char *path);
+}
+namespace libsh_treis::libc::no_raii
+{
+FILE *
+x_popen (const char *command, const char *mode);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+int
+x_pclose (FILE *stream);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+int
+x_fileno (FILE *stream);
+}
+namespace libsh_treis::libc::no_raii
+{
+struct pipe_result
+{
+  int readable;
+  int writable;
+};
+pipe_result
+x_pipe (void);
+}
+namespace libsh_treis::libc::no_raii
+{
+pipe_result
+x_pipe2 (int flags);
+}
+#include <poll.h>
+#include <span>
+namespace libsh_treis::libc
+{
+int
+x_poll (std::span<pollfd> fds, int timeout);
+}
+#include <poll.h>
+#include <signal.h>
+#include <time.h>
+#include <span>
+namespace libsh_treis::libc
+{
+int
+x_ppoll (std::span<pollfd> fds, const timespec *timeout, const sigset_t *sigmask);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::no_raii
+{
+pid_t
+x_fork (void);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+pid_t
+x_waitpid (pid_t pid, int *stat_loc, int options);
+}
+namespace libsh_treis::libc
+{
+void
+x_dup2 (int fildes, int fildes2);
+}
+namespace libsh_treis::libc
+{
+[[noreturn]] void
+x_execv_nunu (const char *path, const char *const argv[]);
+}
+namespace libsh_treis::libc
+{
+[[noreturn]] void
+x_execvp (const char *file, const char *const argv[]);
+}
+#include <time.h>
+namespace libsh_treis::libc
+{
+timespec
+x_clock_gettime (clockid_t clk_id);
+}
+namespace libsh_treis::libc
+{
+void
+x_syncfs (int fd);
+}
+namespace libsh_treis::libc
+{
+void
+x_unlink (const char *pathname);
+}
+#include <unistd.h>
+namespace libsh_treis::libc
+{
+off_t
+x_lseek (int fd, off_t offset, int whence);
+}
+namespace libsh_treis::libc::no_raii
+{
+int
+x_mkstemp (char *templ);
+}
+#include <time.h>
+namespace libsh_treis::libc
+{
+void
+x_clock_nanosleep (clockid_t clock_id, int flags, const timespec *request);
+}
+#include <dirent.h>
+namespace libsh_treis::libc::no_raii
+{
+DIR *
+x_opendir (const char *dirname);
+}
+#include <dirent.h>
+namespace libsh_treis::libc
+{
+void
+x_closedir (DIR *dirp);
+}
+#include <dirent.h>
+namespace libsh_treis::libc
+{
+dirent *
+x_readdir (DIR *dirp);
+}
+#include <dirent.h>
+namespace libsh_treis::libc
+{
+int
+x_dirfd (DIR *dirp);
+}
+#include <sys/stat.h>
+namespace libsh_treis::libc
+{
+struct stat
+x_stat (const char *path);
+}
+#include <sys/stat.h>
+namespace libsh_treis::libc
+{
+struct stat
+x_fstat (int fildes);
+}
+#include <sys/stat.h>
+#include <fcntl.h>
+namespace libsh_treis::libc
+{
+struct stat
+x_fstatat (int dirfd, const char *path, int flags);
+}
+#include <fcntl.h>
+#include <linux/stat.h>
+namespace libsh_treis::libc
+{
+struct statx
+x_statx (int dirfd, const char *path, int flags, unsigned int mask);
+}
+#include <span>
+#include <cstddef>
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+std::span<std::byte>
+x_fread (std::span<std::byte> buf, FILE *stream);
+}
+#include <time.h>
+namespace libsh_treis::libc
+{
+tm
+x_gmtime_r (time_t t);
+}
+#include <stddef.h>
+#include <time.h>
+#include <span>
+namespace libsh_treis::libc::no_raii
+{
+libsh_treis::tools::cstring_span
+x_strftime (std::span<char> s, const char *format, const tm &tm);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+void
+x_mkdir (const char *path, mode_t mode);
+}
+namespace libsh_treis::libc
+{
+void
+x_mkdtemp (char *templ);
+}
+namespace libsh_treis::libc
+{
+int
+x_system (const char *command);
+}
+#include <stdio.h>
+namespace libsh_treis::libc::no_raii
+{
+FILE *
+x_fopen (const char *pathname, const char *mode);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+void
+x_fclose (FILE *stream);
+};
+namespace libsh_treis::libc
+{
+void
+x_fsync (int fildes);
+}
+namespace libsh_treis::libc
+{
+void
+x_fdatasync (int fildes);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+inline constexpr unsigned int sync_file_range_wait_before = 1;
+inline constexpr unsigned int sync_file_range_write = 2;
+inline constexpr unsigned int sync_file_range_wait_after = 4;
+}
+namespace libsh_treis::libc
+{
+void
+x_sync_file_range (int fildes, off_t offset, off_t nbytes, unsigned int flags);
+}
+#include <signal.h>
+namespace libsh_treis::libc
+{
+struct sigaction
+x_sigaction (int sig, const struct sigaction *act);
+}
+#include <signal.h>
+namespace libsh_treis::libc
+{
+sigset_t
+x_sigemptyset (void);
+}
+namespace libsh_treis::libc
+{
+void
+x_rename (const char *oldpath, const char *newpath);
+}
+#include <fcntl.h> // For AT_FDCWD
+#include <linux/fs.h> // For RENAME_EXCHANGE, ...
+namespace libsh_treis::libc
+{
+void
+x_renameat2 (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, unsigned int flags);
+}
+namespace libsh_treis::libc
+{
+void
+x_linkat (int olddirfd, const char *oldpath, int newdirfd, const char *newpath, int flags);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+void
+x_fchmod (int fildes, mode_t mode);
+}
+#include <sys/types.h>
+#include <sys/mman.h>
+namespace libsh_treis::libc::no_raii
+{
+void *
+x_mmap (void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+x_munmap (std::span<std::byte> addr);
+}
+#include <span>
+#include <cstddef>
+#include <sys/mman.h>
+namespace libsh_treis::libc
+{
+void
+x_madvise (std::span<std::byte> addr, int advice);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+void
+x_posix_fadvise (int fildes, off_t offset, off_t len, int advice);
+}
+#include <sys/types.h>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+x_readahead (int fildes, off_t offset, std::size_t count);
+}
+#include <sys/types.h>
+#include <linux/falloc.h>
+namespace libsh_treis::libc
+{
+void
+x_fallocate (int fildes, int mode, off_t offset, off_t len);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+x_mincore (std::span<std::byte> addr, std::span<unsigned char> vec);
+}
+#include <sys/types.h>
+#include <fcntl.h>
+namespace libsh_treis::libc
+{
+ssize_t
+x_splice (int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
+ssize_t
+x_tee (int fd_in, int fd_out, size_t len, unsigned int flags);
+ssize_t
+x_copy_file_range (int fd_in, off_t *off_in, int fd_out, off_t *off_out, size_t len, unsigned int flags);
+}
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <span>
+namespace libsh_treis::libc
+{
+ssize_t
+x_vmsplice (int fd, std::span<const iovec> iov, unsigned int flags);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+ssize_t
+x_sendfile (int out_fd, int in_fd, off_t *offset, size_t count);
+}
+#include <linux/io_uring.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_io_uring_setup (unsigned int entries, io_uring_params *p);
+}
+namespace libsh_treis::libc
+{
+int
+x_io_uring_enter (int fd, unsigned int to_submit, unsigned int min_complete, unsigned int flags);
+int
+x_io_uring_register (int fd, unsigned int opcode, const void *arg, unsigned int nr_args);
+}
+#include <sys/types.h>
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+x_getdents64 (int fd, std::span<std::byte> dirp);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+char
+xx_fgetc_nunu (FILE *stream);
+}
+namespace libsh_treis::libc
+{
+char
+xx_getchar_nunu (void);
+}
+#include <span>
+#include <cstddef>
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+bool
+xx_fread (std::span<std::byte> buf, FILE *stream);
+}
+#include <span>
+#include <cstddef>
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+void
+xxx_fread (std::span<std::byte> buf, FILE *stream);
+}
+#include <stdarg.h>
+#include <span>
+namespace libsh_treis::libc
+{
+std::span<char>
+xx_vsnprintf (std::span<char> s, const char *format, va_list ap);
+}
+#include <span>
+namespace libsh_treis::libc
+{
+std::span<char>
+xx_snprintf (std::span<char> s, const char *format, ...);
+}
+namespace libsh_treis::libc
+{
+const char *
+xx_strrchr (const char *s, int c);
+char *
+xx_strrchr (char *s, int c);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+std::span<std::byte>
+read_repeatedly (int fildes, std::span<std::byte> buf);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+bool
+x_read_repeatedly (int fildes, std::span<std::byte> buf);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+xx_read_repeatedly (int fildes, std::span<std::byte> buf);
+}
+#include <sys/types.h>
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+std::span<std::byte>
+pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset);
+bool
+x_pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset);
+void
+xx_pread_repeatedly (int fildes, std::span<std::byte> buf, off_t offset);
+}
+#include <sys/types.h>
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+pwrite_repeatedly (int fildes, std::span<const std::byte> buf, off_t offset);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+write_repeatedly (int fildes, std::span<const std::byte> buf);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+writev_repeatedly (int fildes, std::span<const std::span<const std::byte>> bufs);
+}
+#include <sys/types.h> // ssize_t
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+ssize_t
+readv_repeatedly (int fildes, std::span<const std::span<std::byte>> bufs);
+}
+#include <sys/types.h>
+#include <unistd.h>
+namespace libsh_treis::libc
+{
+class fd: libsh_treis::tools::not_movable
+{
+  int _fd;
+  int _exceptions;
+public:
+  explicit fd (int f) noexcept : _fd (f), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+  ~fd (void) noexcept (false)
+  {
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        x_close (_fd);
+      }
+    else
+      {
+        close (_fd);
+      }
+  }
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+};
+}
+namespace libsh_treis::libc
+{
+fd
+x_open_2 (const char *path, int oflag);
+fd
+x_open_3 (const char *path, int oflag, mode_t mode);
+fd
+x_mkstemp (char *templ);
+fd
+x_openat_3 (int dirfd, const char *path, int oflag);
+fd
+x_openat_4 (int dirfd, const char *path, int oflag, mode_t mode);
+}
+#include <string_view>
+#include <charconv>
+#include <system_error>
+namespace libsh_treis::libc
+{
+template <typename T> T
+sto (std::string_view s)
+{
+  if (s.size () == 0)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Empty string");
+    }
+  if (!(s[0] == '-' || ('0' <= s[0] && s[0] <= '9')))
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Doesn't begin with [-0-9]");
+    }
+  T result;
+  auto [ptr, ec] = std::from_chars (s.data (), s.data () + s.size (), result);
+  if (ec != std::errc ())
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Not a valid number (std::from_chars returned error)");
+    }
+  if (ptr != s.data () + s.size ())
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("There is a garbagge after number");
+    }
+  return result;
+}
+}
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <span>
+#include <bit>
+#include <charconv>
+#include <limits>
+#include <type_traits>
+#include <system_error>
+#include <string.h>
+namespace libsh_treis::libc
+{
+struct sto_span_result
+{
+  std::size_t count;
+  std::size_t position;
+  bool error;
+};
+
+namespace detail
+{
+// Все 8 байт - цифры
+inline bool
+swar_is_8_digits (std::uint64_t chunk) noexcept
+{
+  return ((chunk & 0xF0F0F0F0F0F0F0F0) | (((chunk + 0x0606060606060606) & 0xF0F0F0F0F0F0F0F0) >> 4)) == 0x3333333333333333;
+}
+
+// 8 цифр в число. Первая цифра - в младшем байте (little endian)
+inline std::uint64_t
+swar_parse_8_digits (std::uint64_t chunk) noexcept
+{
+  chunk = (chunk & 0x0F0F0F0F0F0F0F0F) * 2561 >> 8;
+  chunk = (chunk & 0x00FF00FF00FF00FF) * 6553601 >> 16;
+  return (chunk & 0x0000FFFF0000FFFF) * 42949672960001 >> 32;
+}
+
+template <typename T> bool
+sto_field (const char *begin, const char *end, T &result) noexcept
+{
+  if (begin == end || !(*begin == '-' || ('0' <= *begin && *begin <= '9')))
+    {
+      return false;
+    }
+
+  if constexpr (std::is_integral_v<T> && std::endian::native == std::endian::little)
+    {
+      bool negative = *begin == '-';
+      const char *p = begin + negative;
+
+      if (p != end && end - p <= 19)
+        {
+          std::uint64_t value = 0;
+
+          for (; end - p >= 8; p += 8)
+            {
+              std::uint64_t chunk;
+              memcpy (&chunk, p, 8);
+
+              if (!swar_is_8_digits (chunk))
+                {
+                  return false;
+                }
+
+              value = value * 100000000 + swar_parse_8_digits (chunk);
+            }
+
+          for (; p != end; ++p)
+            {
+              if (!('0' <= *p && *p <= '9'))
+                {
+                  return false;
+                }
+
+              value = value * 10 + (*p - '0');
+            }
+
+          if (!negative)
+            {
+              if (value > (std::uint64_t)std::numeric_limits<T>::max ())
+                {
+                  return false;
+                }
+
+              result = (T)value;
+              return true;
+            }
+
+          // Для беззнаковых типов from_chars не принимает знак вообще, даже "-0"
+          if constexpr (std::is_signed_v<T>)
+            {
+              if (value > (std::uint64_t)std::numeric_limits<T>::max () + 1)
+                {
+                  return false;
+                }
+
+              result = (T)(0 - value);
+              return true;
+            }
+          else
+            {
+              return false;
+            }
+        }
+    }
+
+  auto [ptr, ec] = std::from_chars (begin, end, result);
+
+  return ec == std::errc () && ptr == end;
+}
+}
+
+template <typename T> sto_span_result
+sto_span (std::string_view s, char delimiter, std::span<T> out) noexcept
+{
+  const char *begin = s.data ();
+  const char *end = s.data () + s.size ();
+  const char *p = begin;
+  std::size_t count = 0;
+
+  if (p == end)
+    {
+      return {.count = 0, .position = 0, .error = false};
+    }
+
+  for (;;)
+    {
+      if (count == out.size ())
+        {
+          return {.count = count, .position = (std::size_t)(p - begin), .error = false};
+        }
+
+      const char *field_end = (const char *)memchr (p, delimiter, end - p);
+
+      if (field_end == nullptr)
+        {
+          field_end = end;
+        }
+
+      if (!detail::sto_field (p, field_end, out[count]))
+        {
+          return {.count = count, .position = (std::size_t)(p - begin), .error = true};
+        }
+
+      ++count;
+
+      if (field_end == end)
+        {
+          return {.count = count, .position = s.size (), .error = false};
+        }
+
+      p = field_end + 1;
+    }
+}
+}
+#include <stdarg.h>
+#include <string>
+namespace libsh_treis::libc
+{
+std::string
+x_vasprintf (const char *fmt, va_list ap);
+}
+#include <string>
+namespace libsh_treis::libc
+{
+std::string
+x_asprintf (const char *fmt, ...);
+}
+namespace libsh_treis::libc
+{
+void
+process_succeed (int status);
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+class pipe_stream: libsh_treis::tools::not_movable
+{
+  FILE *_stream;
+  int _exceptions;
+public:
+  explicit pipe_stream (FILE *stream) noexcept : _stream (stream), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+  ~pipe_stream (void) noexcept (false)
+  {
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        process_succeed (x_pclose (_stream));
+      }
+    else
+      {
+        pclose (_stream);
+      }
+  }
+  FILE *
+  resource (void) const noexcept
+  {
+    return _stream;
+  }
+};
+}
+namespace libsh_treis::libc
+{
+pipe_stream
+x_popen (const char *command, const char *mode);
+}
+#include <memory>
+namespace libsh_treis::libc
+{
+struct pipe_result
+{
+  std::unique_ptr<fd> readable;
+  std::unique_ptr<fd> writable;
+};
+pipe_result
+x_pipe (void);
+}
+namespace libsh_treis::libc
+{
+pipe_result
+x_pipe2 (int flags);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::no_raii
+{
+pid_t
+safe_fork (const std::function<void(void)> &func);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+int
+x_waitpid_status (pid_t pid, int options);
+}
+#include <sys/types.h>
+#include <sys/wait.h>
+namespace libsh_treis::libc
+{
+class process : libsh_treis::tools::not_movable
+{
+  pid_t _pid;
+  int _exceptions;
+public:
+  explicit process (pid_t pid) noexcept : _pid (pid), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+  ~process (void) noexcept (false)
+  {
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        process_succeed (x_waitpid_status (_pid, 0));
+      }
+    else
+      {
+        waitpid (_pid, nullptr, 0);
+      }
+  }
+  pid_t
+  resource (void) const noexcept
+  {
+    return _pid;
+  }
+};
+}
+namespace libsh_treis::libc
+{
+process
+safe_fork (const std::function<void(void)> &func);
+}
+#include <memory>
+namespace libsh_treis::libc
+{
+int
+x_waitpid_raii (std::unique_ptr<process> proc, int options);
+}
+#include <vector>
+namespace libsh_treis::libc
+{
+template <typename Iter> [[noreturn]] void
+x_execv_string_nunu (const char *path, Iter b, Iter e)
+{
+  std::vector<const char *> v;
+  for (; b != e; ++b)
+    {
+      v.push_back (b->c_str ());
+    }
+  v.push_back (nullptr);
+  x_execv_nunu (path, v.data ());
+}
+}
+#include <vector>
+namespace libsh_treis::libc
+{
+template <typename Iter> [[noreturn]] void
+x_execvp_string (const char *file, Iter b, Iter e)
+{
+  std::vector<const char *> v;
+  for (; b != e; ++b)
+    {
+      v.push_back (b->c_str ());
+    }
+  v.push_back (nullptr);
+  x_execvp (file, v.data ());
+}
+}
+#include <vector>
+#include <signal.h>
+namespace libsh_treis::libc
+{
+struct spawn_dup2
+{
+  int from;
+  int to;
+};
+
+struct spawn_options
+{
+  std::vector<spawn_dup2> dup2;
+  const char *chdir = nullptr;
+  const sigset_t *sigmask = nullptr;
+  const sigset_t *sigdefault = nullptr;
+  char *const *envp = nullptr;
+};
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::no_raii
+{
+pid_t
+x_spawnp (const char *file, const char *const argv[], const spawn_options &options);
+}
+namespace libsh_treis::libc
+{
+process
+x_spawnp (const char *file, const char *const argv[], const spawn_options &options);
+}
+#include <vector>
+namespace libsh_treis::libc
+{
+template <typename Iter> process
+x_spawnp_string (const char *file, Iter b, Iter e, const spawn_options &options)
+{
+  std::vector<const char *> v;
+  for (; b != e; ++b)
+    {
+      v.push_back (b->c_str ());
+    }
+  v.push_back (nullptr);
+  return x_spawnp (file, v.data (), options);
+}
+}
+#include <sys/types.h>
+namespace libsh_treis::libc::no_raii
+{
+int
+x_pidfd_open (pid_t pid, unsigned int flags);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+fd
+x_pidfd_open (pid_t pid, unsigned int flags);
+}
+#include <signal.h>
+namespace libsh_treis::libc
+{
+void
+x_pidfd_send_signal (int pidfd, int sig, siginfo_t *info, unsigned int flags);
+}
+#include <signal.h>
+#include <sys/wait.h>
+namespace libsh_treis::libc
+{
+siginfo_t
+x_waitid (idtype_t idtype, id_t id, int options);
+}
+#include <signal.h>
+namespace libsh_treis::libc
+{
+int
+siginfo_to_status (const siginfo_t &info);
+}
+#include <optional>
+#include <sys/types.h>
+#include <signal.h>
+#include <sys/wait.h>
+namespace libsh_treis::libc
+{
+class pidfd_process : libsh_treis::tools::not_movable
+{
+  pid_t _pid;
+  fd _pidfd;
+  bool _reaped;
+  int _exceptions;
+public:
+  explicit pidfd_process (pid_t pid);
+  ~pidfd_process (void) noexcept (false);
+  int
+  resource (void) const noexcept
+  {
+    return _pidfd.resource ();
+  }
+  pid_t
+  pid (void) const noexcept
+  {
+    return _pid;
+  }
+  // Блокируется до завершения ребёнка, забирает его и возвращает status в формате waitpid
+  int
+  x_wait (void);
+  // Не блокируется. Если ребёнок завершился, забирает его и возвращает status в формате waitpid
+  std::optional<int>
+  x_try_wait (void);
+  void
+  x_send_signal (int sig);
+};
+}
+namespace libsh_treis::libc
+{
+pidfd_process
+x_spawnp_pidfd (const char *file, const char *const argv[], const spawn_options &options);
+}
+#include <cstddef>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <vector>
+namespace libsh_treis::libc
+{
+struct pool_command
+{
+  // argv[0] ищется в PATH
+  std::vector<std::string> argv;
+  std::string_view input;
+  std::function<void(std::span<const std::byte>)> on_output;
+  std::function<void(int)> on_exit;
+};
+class process_pool : libsh_treis::tools::not_movable
+{
+  struct running;
+  std::size_t _max_running;
+  std::size_t _chunk_size;
+  std::deque<pool_command> _queue;
+  void
+  _x_start (pool_command &&cmd, std::vector<std::unique_ptr<running>> &running);
+public:
+  explicit process_pool (std::size_t max_running, std::size_t chunk_size = 64 * 1024);
+  // Можно вызывать и из callback'ов во время x_run
+  void
+  add (pool_command cmd);
+  // Выполняет все команды из очереди и возвращается, когда все они завершены
+  void
+  x_run (void);
+};
+}
+namespace libsh_treis::libc::no_raii
+{
+int
+x_epoll_create1 (int flags);
+}
+namespace libsh_treis::libc
+{
+fd
+x_epoll_create1 (int flags);
+}
+#include <sys/epoll.h>
+namespace libsh_treis::libc
+{
+void
+x_epoll_ctl (int epfd, int op, int fildes, epoll_event *event);
+}
+#include <sys/epoll.h>
+#include <span>
+namespace libsh_treis::libc
+{
+std::span<epoll_event>
+x_epoll_wait (int epfd, std::span<epoll_event> events, int timeout);
+}
+#include <sys/epoll.h>
+#include <signal.h>
+#include <span>
+namespace libsh_treis::libc
+{
+std::span<epoll_event>
+x_epoll_pwait (int epfd, std::span<epoll_event> events, int timeout, const sigset_t *sigmask);
+}
+#include <sys/epoll.h>
+#include <span>
+namespace libsh_treis::libc
+{
+class epoll : libsh_treis::tools::not_movable
+{
+  fd _fd;
+public:
+  explicit epoll (int flags = EPOLL_CLOEXEC) : _fd (libsh_treis::libc::no_raii::x_epoll_create1 (flags))
+  {
+  }
+  int
+  resource (void) const noexcept
+  {
+    return _fd.resource ();
+  }
+  std::span<epoll_event>
+  x_wait (std::span<epoll_event> events, int timeout);
+};
+}
+#include <cstdint>
+#include <sys/epoll.h>
+namespace libsh_treis::libc
+{
+class epoll_registration : libsh_treis::tools::not_movable
+{
+  int _epfd;
+  int _fd;
+  epoll_data_t _data;
+  int _exceptions;
+public:
+  explicit epoll_registration (const epoll &ep, int fildes, std::uint32_t events, epoll_data_t data);
+  ~epoll_registration (void) noexcept (false);
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+  void
+  x_modify (std::uint32_t events);
+};
+}
+#include <sys/epoll.h>
+#include <span>
+namespace libsh_treis::libc
+{
+template <typename F> void
+x_epoll_loop (epoll &ep, std::span<epoll_event> batch, F &&f)
+{
+  for (;;)
+    {
+      if (!f (ep.x_wait (batch, -1)))
+        {
+          return;
+        }
+    }
+}
+}
+// Выделяет память для массива, инициализируя с помощью default initializing. Независимо от того, что написано в стандарте. Добавил, т. к. не нашёл подобной функции в моей реализации стандартной библиотеки C++. Когда будет везде, надо будет удалить
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+namespace libsh_treis::tools
+{
+template <typename T> std::unique_ptr<T>
+make_unique_default_init (std::size_t size)
+{
+  static_assert (std::is_unbounded_array_v<T>);
+  return std::unique_ptr<T> (new std::remove_extent_t<T>[size]);
+}
+}
+// Owning span
+// Предназначен, например, для хранения данных сразу после чтения read'ом или перед записыванием write'ом. От unique_ptr<T[]> отличается отсутствием особого состояния и хранением длины
+// От std::vector отличается отсутствием особого состояния (vector можно переместить и оставить исходный объект в пустом состоянии)
+// Можно создать ospan нулевой длины. Но идеоматический код не должен использовать такой ospan как маркер отсутствия ospan'а
+// ospan нельзя перемещать. Копировать можно, но на данный момент не реализовано
+// Методы begin и end нужны, иначе в debian sid от 2022-05-30 с clang'ом из репы debian нельзя конвертить этот ospan в span
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+#include <utility>
+namespace libsh_treis::tools
+{
+template <typename T> class ospan: libsh_treis::tools::not_movable
+{
+  static_assert (!std::is_unbounded_array_v<T>);
+  T *_ptr;
+  std::size_t _size;
+  explicit ospan (T *ptr, std::size_t size) noexcept : _ptr (ptr), _size (size)
+  {
+  }
+  template <typename U> friend ospan<U>
+  make_ospan (std::size_t size);
+  template <typename U> friend ospan<U>
+  make_ospan_for_overwrite (std::size_t size);
+  template <typename U> friend void
+  swap (ospan<U> &, ospan<U> &) noexcept;
+public:
+  ~ospan (void)
+  {
+    delete [] _ptr;
+  }
+  const T *
+  data (void) const noexcept
+  {
+    return _ptr;
+  }
+  T *
+  data (void) noexcept
+  {
+    return _ptr;
+  }
+  std::size_t
+  size (void) const noexcept
+  {
+    return _size;
+  }
+  const T *
+  begin (void) const noexcept
+  {
+    return _ptr;
+  }
+  T *
+  begin (void) noexcept
+  {
+    return _ptr;
+  }
+  const T *
+  end (void) const noexcept
+  {
+    return _ptr + _size;
+  }
+  T *
+  end (void) noexcept
+  {
+    return _ptr + _size;
+  }
+  const T &
+  operator[] (std::size_t i) const noexcept
+  {
+    assert (i < _size);
+    return _ptr[i];
+  }
+  T &
+  operator[] (std::size_t i) noexcept
+  {
+    assert (i < _size);
+    return _ptr[i];
+  }
+};
+template <typename T> void
+swap (ospan<T> &a, ospan<T> &b) noexcept
+{
+  std::swap (a._ptr,  b._ptr);
+  std::swap (a._size, b._size);
+}
+template <typename T> ospan<T>
+make_ospan (std::size_t size)
+{
+  return ospan<T> (new T[size](), size);
+}
+template <typename T> ospan<T>
+make_ospan_for_overwrite (std::size_t size)
+{
+  return ospan<T> (new T[size], size);
+}
+}
+#include <string_view>
+namespace libsh_treis::tools
+{
+std::string
+build_path_find (std::string_view up, std::string_view down);
+}
+#include <dirent.h>
+namespace libsh_treis::libc
+{
+class directory: libsh_treis::tools::not_movable
+{
+  DIR *_d;
+  int _exceptions;
+public:
+  explicit directory (DIR *d) noexcept : _d (d), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+  ~directory (void) noexcept (false)
+  {
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        x_closedir (_d);
+      }
+    else
+      {
+        closedir (_d);
+      }
+  }
+  DIR *
+  resource (void) const noexcept
+  {
+    return _d;
+  }
+};
+}
+namespace libsh_treis::libc
+{
+directory
+x_opendir (const char *dirname);
+}
+#include <cstddef>
+#include <optional>
+#include <sys/types.h>
+#include <dirent.h>
+namespace libsh_treis::libc
+{
+struct directory_entry
+{
+  libsh_treis::tools::cstring_span name;
+  ino64_t ino;
+  unsigned char type;
+};
+
+class directory_reader: libsh_treis::tools::not_movable
+{
+  int _fd;
+  libsh_treis::tools::ospan<std::byte> _buf;
+  std::size_t _pos;
+  std::size_t _end;
+
+public:
+  static constexpr std::size_t default_buffer_size = 256 * 1024;
+
+  explicit directory_reader (int dirfd);
+
+  explicit directory_reader (int dirfd, std::size_t buffer_size);
+
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+
+  std::optional<directory_entry>
+  x_readdir (void);
+};
+}
+#include <functional>
+#include <string>
+#include <sys/types.h>
+#include <linux/stat.h>
+namespace libsh_treis::libc
+{
+struct walk_entry
+{
+  int dirfd;
+  const std::string &dir_path;
+  libsh_treis::tools::cstring_span name;
+  unsigned char type;
+  ino64_t ino;
+  const struct statx *stx;
+  int depth; // 1 для записей в самом root
+};
+
+struct walk_options
+{
+  int threads;
+  bool ordered;
+  unsigned int statx_mask;
+  int statx_flags;
+};
+}
+namespace libsh_treis::libc
+{
+void
+walk_tree (const char *root, const walk_options &options, const std::function<bool (const walk_entry &)> &callback);
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+int
+span_memcmp (std::span<const std::byte> s1, std::span<const std::byte> s2) noexcept;
+}
+#include <span>
+#include <cstddef>
+namespace libsh_treis::libc
+{
+void
+span_memcpy (std::span<std::byte> dest, std::span<const std::byte> src) noexcept;
+}
+#include <stdio.h>
+namespace libsh_treis::libc
+{
+class fp: libsh_treis::tools::not_movable
+{
+  FILE *_fp;
+  int _exceptions;
+
+public:
+  explicit fp (FILE *f) noexcept : _fp (f), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+
+  ~fp (void) noexcept (false)
+  {
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        x_fclose (_fp);
+      }
+    else
+      {
+        fclose (_fp);
+      }
+  }
+
+  FILE *
+  resource (void) const noexcept
+  {
+    return _fp;
+  }
+};
+}
+namespace libsh_treis::libc
+{
+fp
+x_fopen (const char *pathname, const char *mode);
+}
+#include <cstddef>
+#include <exception>
+#include <span>
+#include <sys/mman.h>
+namespace libsh_treis::libc
+{
+class mapping: libsh_treis::tools::not_movable
+{
+  std::byte *_ptr;
+  std::size_t _size;
+  int _exceptions;
+
+public:
+  explicit mapping (void *ptr, std::size_t size) noexcept : _ptr ((std::byte *)ptr), _size (size), _exceptions (std::uncaught_exceptions ())
+  {
+  }
+
+  ~mapping (void) noexcept (false)
+  {
+    if (_size == 0)
+      {
+        return;
+      }
+
+    if (std::uncaught_exceptions () == _exceptions)
+      {
+        x_munmap (std::span<std::byte> (_ptr, _size));
+      }
+    else
+      {
+        munmap (_ptr, _size);
+      }
+  }
+
+  std::span<const std::byte>
+  bytes (void) const noexcept
+  {
+    return std::span<const std::byte> (_ptr, _size);
+  }
+
+  // Только для отображений с PROT_WRITE
+  std::span<std::byte>
+  writable_bytes (void) const noexcept
+  {
+    return std::span<std::byte> (_ptr, _size);
+  }
+
+  // MADV_SEQUENTIAL, MADV_WILLNEED, MADV_HUGEPAGE и т. д.
+  void
+  x_madvise (int advice) const
+  {
+    if (_size != 0)
+      {
+        libsh_treis::libc::x_madvise (std::span<std::byte> (_ptr, _size), advice);
+      }
+  }
+};
+}
+namespace libsh_treis::libc
+{
+mapping
+x_mmap (void *addr, size_t len, int prot, int flags, int fildes, off_t off);
+}
+namespace libsh_treis::libc
+{
+mapping
+map_file (const char *path, int flags);
+}
+#include <cstddef>
+namespace libsh_treis::libc
+{
+std::size_t
+io_buffer_size (int fildes);
+}
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+void
+copy_fd_to_fd (int in, int out);
+}
+#include <cstddef>
+#include <cassert>
+#include <optional>
+#include <span>
+#include <string_view>
+#include <stdio.h> // EOF
+namespace libsh_treis::libc
+{
+class input_buffer: libsh_treis::tools::not_movable
+{
+  int _fd;
+  std::size_t _capacity;
+  std::byte *_buf;
+  std::byte *_begin;
+  std::byte *_end;
+
+  bool
+  _x_underflow (void);
+
+  bool
+  _x_read_more (void);
+
+  std::byte *
+  _x_find_line (bool nul_allowed);
+
+public:
+  static constexpr std::size_t alignment = 32;
+
+  explicit input_buffer (int fildes);
+
+  explicit input_buffer (int fildes, std::size_t capacity);
+
+  ~input_buffer (void);
+
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+
+  int
+  x_getc (void)
+  {
+    if (_begin == _end) [[unlikely]]
+      {
+        if (!_x_underflow ())
+          {
+            return EOF;
+          }
+      }
+
+    return (int)(unsigned char)*_begin++;
+  }
+
+  char
+  xx_getc (void)
+  {
+    int result = x_getc ();
+
+    if (result == EOF)
+      {
+        _LIBSH_TREIS_THROW_MESSAGE ("EOF");
+      }
+
+    return (char)(unsigned char)result;
+  }
+
+  std::span<const std::byte>
+  x_peek (void)
+  {
+    if (_begin == _end)
+      {
+        _x_underflow ();
+      }
+
+    return std::span<const std::byte> (_begin, _end);
+  }
+
+  void
+  skip (std::size_t n) noexcept
+  {
+    assert (n <= (std::size_t)(_end - _begin));
+    _begin += n;
+  }
+
+  // Аналог x_fread: читает, пока не заполнит buf или не упрётся в EOF
+  std::span<std::byte>
+  x_read (std::span<std::byte> buf);
+
+  // Семантика та же, что у getline_buffer::getline: завершающий '\n' выкидывается, его отсутствие в конце файла не ошибка, нулевые байты - ошибка
+  std::optional<libsh_treis::tools::cstring_span>
+  x_getline (void);
+
+  // То же, но нулевые байты допустимы
+  std::optional<std::string_view>
+  x_getline_sv (void);
+};
+}
+#include <cstddef>
+#include <cassert>
+#include <exception>
+#include <span>
+#include <string.h>
+namespace libsh_treis::libc
+{
+class output_buffer: libsh_treis::tools::not_movable
+{
+  int _fd;
+  std::size_t _capacity;
+  std::byte *_buf;
+  std::byte *_end;
+  int _exceptions;
+
+  void
+  _x_drain (std::span<const std::byte> tail);
+
+public:
+  static constexpr std::size_t alignment = 32;
+
+  explicit output_buffer (int fildes);
+
+  explicit output_buffer (int fildes, std::size_t capacity);
+
+  ~output_buffer (void) noexcept (false);
+
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+
+  std::size_t
+  capacity (void) const noexcept
+  {
+    return _capacity;
+  }
+
+  void
+  x_putc (char c)
+  {
+    if (_end == _buf + _capacity) [[unlikely]]
+      {
+        x_flush ();
+      }
+
+    *_end++ = (std::byte)c;
+  }
+
+  void
+  x_write (std::span<const std::byte> buf)
+  {
+    if (buf.size () <= (std::size_t)(_buf + _capacity - _end)) [[likely]]
+      {
+        memcpy (_end, buf.data (), buf.size ());
+        _end += buf.size ();
+      }
+    else
+      {
+        _x_drain (buf);
+      }
+  }
+
+  void
+  x_flush (void);
+
+  // Выбрасывает то, что ещё не записано
+  void
+  discard (void) noexcept
+  {
+    _end = _buf;
+  }
+
+  // Гарантирует, что в буфере свободно не меньше n байт, и возвращает всё свободное место. Записанное туда нужно подтвердить с помощью commit
+  std::span<char>
+  x_reserve (std::size_t n)
+  {
+    assert (n <= _capacity);
+
+    if ((std::size_t)(_buf + _capacity - _end) < n)
+      {
+        x_flush ();
+      }
+
+    return std::span<char> ((char *)_end, (char *)(_buf + _capacity));
+  }
+
+  void
+  commit (std::size_t n) noexcept
+  {
+    assert (n <= (std::size_t)(_buf + _capacity - _end));
+    _end += n;
+  }
+
+  // f получает std::span<char> размера не меньше max_size, пишет туда и возвращает количество записанных байт
+  template <typename F> void
+  x_put_formatted (std::size_t max_size, F &&f)
+  {
+    commit (f (x_reserve (max_size)));
+  }
+};
+}
+#include <cstddef>
+#include <string>
+#include <string_view>
+#include <span>
+#include <array>
+#include <charconv>
+#include <cmath>
+#include <type_traits>
+#include <concepts>
+#include <system_error>
+#include <string.h>
+namespace libsh_treis::tools
+{
+namespace detail
+{
+enum class format_arg_kind
+{
+  unsupported,
+  integer,
+  character,
+  floating,
+  string
+};
+
+template <typename T> consteval format_arg_kind
+format_arg_kind_of (void)
+{
+  using U = std::remove_cvref_t<T>;
+
+  if constexpr (std::is_same_v<U, char>)
+    {
+      return format_arg_kind::character;
+    }
+  else if constexpr (std::is_same_v<U, bool> || std::is_same_v<U, wchar_t> || std::is_same_v<U, char8_t> || std::is_same_v<U, char16_t> || std::is_same_v<U, char32_t>)
+    {
+      return format_arg_kind::unsupported;
+    }
+  else if constexpr (std::is_integral_v<U>)
+    {
+      return format_arg_kind::integer;
+    }
+  else if constexpr (std::is_same_v<U, float> || std::is_same_v<U, double>)
+    {
+      // Не long double: 1e4000L в формате f - больше 4000 символов, это не влезет в буфер на стеке
+      return format_arg_kind::floating;
+    }
+  else if constexpr (std::is_convertible_v<const U &, std::string_view> || std::is_same_v<U, cstring_span>)
+    {
+      return format_arg_kind::string;
+    }
+  else
+    {
+      return format_arg_kind::unsupported;
+    }
+}
+
+struct format_spec
+{
+  // Кусок формата перед этим аргументом
+  std::size_t literal_begin;
+  std::size_t literal_end;
+  bool zero;
+  unsigned char width;
+  signed char precision;
+  char type;
+};
+
+// Намеренно не constexpr и не определена: её вызов внутри consteval - это ошибка компиляции, в которой видно сообщение
+void
+format_string_error (const char *message);
+}
+
+template <typename... Args> class format_string
+{
+  std::string_view _sv;
+  std::array<detail::format_spec, sizeof... (Args)> _specs;
+  std::size_t _tail_begin;
+  bool _has_escapes;
+
+public:
+  template <typename S> requires std::convertible_to<const S &, std::string_view>
+  consteval format_string (const S &s) : _sv (s), _specs (), _tail_begin (0), _has_escapes (false)
+  {
+    constexpr detail::format_arg_kind kinds[] = {detail::format_arg_kind_of<Args> ()..., detail::format_arg_kind::unsupported};
+
+    std::size_t arg = 0;
+    std::size_t i = 0;
+    std::size_t n = _sv.size ();
+
+    while (i != n)
+      {
+        if (_sv[i] == '}')
+          {
+            if (i + 1 == n || _sv[i + 1] != '}')
+              {
+                detail::format_string_error ("Unmatched '}' in format string");
+              }
+
+            _has_escapes = true;
+            i += 2;
+            continue;
+          }
+
+        if (_sv[i] != '{')
+          {
+            ++i;
+            continue;
+          }
+
+        if (i + 1 != n && _sv[i + 1] == '{')
+          {
+            _has_escapes = true;
+            i += 2;
+            continue;
+          }
+
+        if (arg == sizeof... (Args))
+          {
+            detail::format_string_error ("Too few arguments for format string");
+          }
+
+        detail::format_spec spec = {.literal_begin = _tail_begin, .literal_end = i, .zero = false, .width = 0, .precision = -1, .type = '\0'};
+
+        ++i;
+
+        if (i != n && _sv[i] == ':')
+          {
+            ++i;
+
+            if (i != n && _sv[i] == '0')
+              {
+                spec.zero = true;
+                ++i;
+              }
+
+            unsigned width = 0;
+
+            for (; i != n && '0' <= _sv[i] && _sv[i] <= '9'; ++i)
+              {
+                width = width * 10 + (_sv[i] - '0');
+
+                if (width > 255)
+                  {
+                    detail::format_string_error ("Width is too big");
+                  }
+              }
+
+            spec.width = (unsigned char)width;
+
+            if (i != n && _sv[i] == '.')
+              {
+                ++i;
+
+                if (i == n || !('0' <= _sv[i] && _sv[i] <= '9'))
+                  {
+                    detail::format_string_error ("Bad precision");
+                  }
+
+                int precision = 0;
+
+                for (; i != n && '0' <= _sv[i] && _sv[i] <= '9'; ++i)
+                  {
+                    precision = precision * 10 + (_sv[i] - '0');
+
+                    if (precision > 64)
+                      {
+                        detail::format_string_error ("Precision is too big");
+                      }
+                  }
+
+                spec.precision = (signed char)precision;
+              }
+
+            if (i != n && _sv[i] != '}')
+              {
+                spec.type = _sv[i];
+                ++i;
+              }
+          }
+
+        if (i == n || _sv[i] != '}')
+          {
+            detail::format_string_error ("Bad format spec");
+          }
+
+        ++i;
+
+        switch (kinds[arg])
+          {
+          case detail::format_arg_kind::unsupported:
+            detail::format_string_error ("Unsupported argument type");
+            break;
+          case detail::format_arg_kind::integer:
+            if (!(spec.type == '\0' || spec.type == 'd' || spec.type == 'x' || spec.type == 'X') || spec.precision != -1)
+              {
+                detail::format_string_error ("Bad format spec for integer argument");
+              }
+            break;
+          case detail::format_arg_kind::character:
+            if (!(spec.type == '\0' || spec.type == 'c' || spec.type == 'd' || spec.type == 'x' || spec.type == 'X') || spec.precision != -1 || (spec.zero && (spec.type == '\0' || spec.type == 'c')))
+              {
+                detail::format_string_error ("Bad format spec for char argument");
+              }
+            break;
+          case detail::format_arg_kind::floating:
+            if (!(spec.type == '\0' || spec.type == 'f' || spec.type == 'e' || spec.type == 'g'))
+              {
+                detail::format_string_error ("Bad format spec for floating point argument");
+              }
+            break;
+          case detail::format_arg_kind::string:
+            if (!(spec.type == '\0' || spec.type == 's') || spec.precision != -1 || spec.zero)
+              {
+                detail::format_string_error ("Bad format spec for string argument");
+              }
+            break;
+          }
+
+        _specs[arg] = spec;
+        ++arg;
+        _tail_begin = i;
+      }
+
+    if (arg != sizeof... (Args))
+      {
+        detail::format_string_error ("Too many arguments for format string");
+      }
+  }
+
+  std::string_view
+  sv (void) const noexcept
+  {
+    return _sv;
+  }
+
+  const detail::format_spec &
+  spec (std::size_t i) const noexcept
+  {
+    return _specs[i];
+  }
+
+  std::size_t
+  tail_begin (void) const noexcept
+  {
+    return _tail_begin;
+  }
+
+  bool
+  has_escapes (void) const noexcept
+  {
+    return _has_escapes;
+  }
+};
+
+// Чтобы Args выводились из аргументов, а не из формата
+template <typename... Args> using format_string_for = format_string<std::type_identity_t<Args>...>;
+
+namespace detail
+{
+// Sink - всё, у чего есть put (std::string_view)
+template <typename Sink> void
+format_put_literal (Sink &sink, std::string_view literal, bool has_escapes)
+{
+  if (!has_escapes)
+    {
+      sink.put (literal);
+      return;
+    }
+
+  // Формат уже проверен, поэтому все скобки в literal удвоены
+  for (;;)
+    {
+      std::size_t brace = literal.find_first_of ("{}");
+
+      if (brace == std::string_view::npos)
+        {
+          sink.put (literal);
+          return;
+        }
+
+      sink.put (literal.substr (0, brace + 1));
+      literal.remove_prefix (brace + 2);
+    }
+}
+
+template <typename Sink> void
+format_put_padded (Sink &sink, const format_spec &spec, std::string_view s, bool numeric)
+{
+  if (s.size () >= spec.width)
+    {
+      sink.put (s);
+      return;
+    }
+
+  std::size_t pad = spec.width - s.size ();
+
+  if (spec.zero && numeric && s.size () != 0 && s[0] == '-')
+    {
+      sink.put (s.substr (0, 1));
+      s.remove_prefix (1);
+    }
+
+  constexpr std::string_view spaces = "                                ";
+  constexpr std::string_view zeros = "00000000000000000000000000000000";
+  std::string_view fill = spec.zero && numeric ? zeros : spaces;
+
+  for (; pad > fill.size (); pad -= fill.size ())
+    {
+      sink.put (fill);
+    }
+
+  sink.put (fill.substr (0, pad));
+  sink.put (s);
+}
+
+template <typename Sink, typename T> void
+format_put_arg (Sink &sink, const format_spec &spec, const T &arg)
+{
+  constexpr format_arg_kind kind = format_arg_kind_of<T> ();
+
+  if constexpr (kind == format_arg_kind::string)
+    {
+      std::string_view s;
+
+      if constexpr (std::is_same_v<std::remove_cvref_t<T>, cstring_span>)
+        {
+          s = arg.sv ();
+        }
+      else if constexpr (std::is_pointer_v<std::remove_cvref_t<T>>)
+        {
+          // Конструировать std::string_view из nullptr нельзя
+          s = arg == nullptr ? std::string_view ("(null)") : std::string_view (arg);
+        }
+      else
+        {
+          s = arg;
+        }
+
+      format_put_padded (sink, spec, s, false);
+    }
+  else if constexpr (kind == format_arg_kind::floating)
+    {
+      // 1e308 в формате f с точностью 64 - около 375 символов
+      char buf[512];
+      std::to_chars_result result;
+
+      if (spec.type == '\0' && spec.precision == -1)
+        {
+          result = std::to_chars (buf, buf + sizeof (buf), arg);
+        }
+      else
+        {
+          std::chars_format format = spec.type == 'f' ? std::chars_format::fixed : spec.type == 'e' ? std::chars_format::scientific : std::chars_format::general;
+          result = std::to_chars (buf, buf + sizeof (buf), arg, format, spec.precision == -1 ? 6 : spec.precision);
+        }
+
+      LIBSH_TREIS_ASSERT (result.ec == std::errc ());
+      format_put_padded (sink, spec, std::string_view (buf, result.ptr), std::isfinite (arg));
+    }
+  else
+    {
+      if constexpr (kind == format_arg_kind::character)
+        {
+          if (spec.type == '\0' || spec.type == 'c')
+            {
+              format_put_padded (sink, spec, std::string_view (&arg, 1), false);
+              return;
+            }
+        }
+
+      // 64 двоичных разряда + знак
+      char buf[72];
+      std::to_chars_result result;
+
+      if (spec.type == 'x' || spec.type == 'X')
+        {
+          // Как в printf: отрицательные - в дополнительном коде
+          result = std::to_chars (buf, buf + sizeof (buf), (std::make_unsigned_t<std::remove_cvref_t<T>>)arg, 16);
+        }
+      else
+        {
+          result = std::to_chars (buf, buf + sizeof (buf), arg, 10);
+        }
+
+      if (spec.type == 'X')
+        {
+          for (char *p = buf; p != result.ptr; ++p)
+            {
+              if ('a' <= *p && *p <= 'f')
+                {
+                  *p = (char)(*p - 'a' + 'A');
+                }
+            }
+        }
+
+      format_put_padded (sink, spec, std::string_view (buf, result.ptr), true);
+    }
+}
+
+template <typename Sink, typename... Args> void
+format_to_sink (Sink &sink, const format_string<Args...> &fmt, const Args &...args)
+{
+  std::size_t i = 0;
+
+  ((format_put_literal (sink, fmt.sv ().substr (fmt.spec (i).literal_begin, fmt.spec (i).literal_end - fmt.spec (i).literal_begin), fmt.has_escapes ()), format_put_arg (sink, fmt.spec (i), args), ++i), ...);
+
+  format_put_literal (sink, fmt.sv ().substr (fmt.tail_begin ()), fmt.has_escapes ());
+}
+
+struct string_sink
+{
+  std::string &s;
+
+  void
+  put (std::string_view part)
+  {
+    s.append (part);
+  }
+};
+
+struct span_sink
+{
+  std::span<char> s;
+  std::size_t size;
+
+  void
+  put (std::string_view part)
+  {
+    if (part.size () > s.size () - size)
+      {
+        _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+      }
+
+    memcpy (s.data () + size, part.data (), part.size ());
+    size += part.size ();
+  }
+};
+}
+
+template <typename... Args> void
+format_append (std::string &s, format_string_for<Args...> fmt, const Args &...args)
+{
+  detail::string_sink sink = {.s = s};
+  detail::format_to_sink (sink, fmt, args...);
+}
+
+template <typename... Args> std::string
+format_to_string (format_string_for<Args...> fmt, const Args &...args)
+{
+  std::string result;
+  format_append (result, fmt, args...);
+  return result;
+}
+
+// Как xx_snprintf: пишет в s, дописывает '\0' и возвращает записанное (без '\0'). Если не влезло, исключение
+template <typename... Args> std::span<char>
+xx_format_to (std::span<char> s, format_string_for<Args...> fmt, const Args &...args)
+{
+  if (s.size () == 0)
+    {
+      _LIBSH_TREIS_THROW_MESSAGE ("Buffer overflow");
+    }
+
+  detail::span_sink sink = {.s = s.first (s.size () - 1), .size = 0};
+  detail::format_to_sink (sink, fmt, args...);
+  s[sink.size] = '\0';
+  return s.first (sink.size);
+}
+}
+
+namespace libsh_treis::libc
+{
+namespace detail
+{
+struct output_buffer_sink
+{
+  output_buffer &buf;
+
+  void
+  put (std::string_view part)
+  {
+    buf.x_write (std::as_bytes (std::span<const char> (part)));
+  }
+};
+}
+
+template <typename... Args> void
+x_format_to (output_buffer &buf, libsh_treis::tools::format_string_for<Args...> fmt, const Args &...args)
+{
+  detail::output_buffer_sink sink = {.buf = buf};
+  libsh_treis::tools::detail::format_to_sink (sink, fmt, args...);
+}
+}
+#include <linux/io_uring.h>
+namespace libsh_treis::libc
+{
+int
+x_cqe_result (const io_uring_cqe &cqe);
+}
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <span>
+#include <sys/types.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+struct statx;
+namespace libsh_treis::libc
+{
+class uring: libsh_treis::tools::not_movable
+{
+  io_uring_params _params;
+  fd _fd;
+  mapping _sq_ring;
+  mapping _cq_ring; // Пустой, если есть IORING_FEAT_SINGLE_MMAP
+  mapping _sqes_map;
+  unsigned *_sq_head;
+  unsigned *_sq_tail;
+  unsigned _sq_mask;
+  unsigned *_cq_head;
+  unsigned *_cq_tail;
+  unsigned _cq_mask;
+  io_uring_sqe *_sqes;
+  io_uring_cqe *_cqes;
+  unsigned _sqe_tail; // SQE до этого места заполнены, но, возможно, ещё не опубликованы в _sq_tail
+
+  io_uring_sqe &
+  _x_get_sqe (std::uint8_t opcode, int fd, std::uint64_t user_data);
+
+public:
+  explicit uring (unsigned entries, unsigned flags);
+
+  int
+  resource (void) const noexcept
+  {
+    return _fd.resource ();
+  }
+
+  unsigned
+  sq_entries (void) const noexcept
+  {
+    return _params.sq_entries;
+  }
+
+  io_uring_sqe &
+  prep_read (int fd, std::span<std::byte> buf, off_t offset, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_write (int fd, std::span<const std::byte> buf, off_t offset, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_readv (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_writev (int fd, std::span<const iovec> iov, off_t offset, std::uint64_t user_data);
+
+  // buf должен лежать внутри буфера номер buf_index, зарегистрированного x_register_buffers
+  io_uring_sqe &
+  prep_read_fixed (int fd, std::span<std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_write_fixed (int fd, std::span<const std::byte> buf, off_t offset, std::uint16_t buf_index, std::uint64_t user_data);
+
+  // fsync_flags - 0 или IORING_FSYNC_DATASYNC
+  io_uring_sqe &
+  prep_fsync (int fd, unsigned fsync_flags, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_openat (int dirfd, const char *path, int flags, mode_t mode, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_close (int fd, std::uint64_t user_data);
+
+  io_uring_sqe &
+  prep_statx (int dirfd, const char *path, int flags, unsigned mask, struct statx *statxbuf, std::uint64_t user_data);
+
+  // Отправляет все накопленные SQE и ждёт, пока не будет готово хотя бы wait_nr CQE. Возвращает количество отправленных SQE
+  int
+  x_submit (unsigned wait_nr);
+
+  // Вызывает f (const io_uring_cqe &) для каждого уже готового CQE, не делая системных вызовов. Возвращает количество CQE
+  template <typename F> unsigned
+  for_each_cqe (F &&f)
+  {
+    unsigned head = *_cq_head;
+    unsigned tail = std::atomic_ref<unsigned> (*_cq_tail).load (std::memory_order_acquire);
+    unsigned result = tail - head;
+
+    for (; head != tail; ++head)
+      {
+        // Освобождаем место в CQ до вызова f, чтобы исключение из f не привело к повторной обработке CQE
+        io_uring_cqe cqe = _cqes[head & _cq_mask];
+        std::atomic_ref<unsigned> (*_cq_head).store (head + 1, std::memory_order_release);
+        f (cqe);
+      }
+
+    return result;
+  }
+
+  // Отправляет накопленные SQE, если готовых CQE нет, ждёт один и забирает его
+  io_uring_cqe
+  x_wait_cqe (void);
+
+  void
+  x_register_buffers (std::span<const iovec> bufs);
+
+  void
+  x_unregister_buffers (void);
+
+  // После регистрации в SQE с флагом IOSQE_FIXED_FILE вместо fd передаётся номер в fds
+  void
+  x_register_files (std::span<const int> fds);
+
+  void
+  x_unregister_files (void);
+};
+}
+#include <span>
+#include <linux/stat.h>
+namespace libsh_treis::libc
+{
+void
+statx_batch (int dirfd, std::span<const char *const> names, int flags, unsigned int mask, std::span<struct statx> out);
+void
+statx_batch (uring &ring, int dirfd, std::span<const char *const> names, int flags, unsigned int mask, std::span<struct statx> out);
+}
+#include <cstddef>
+#include <cstdint>
+#include <cassert>
+#include <atomic>
+#include <memory>
+#include <mutex>
+namespace libsh_treis::libc
+{
+class buffer_pool;
+
+namespace detail
+{
+class buffer_stack;
+}
+
+// Как ospan, но память принадлежит пулу
+class pooled_buffer: libsh_treis::tools::not_movable
+{
+  buffer_pool &_pool;
+  std::byte *_ptr;
+  std::uint32_t _index;
+
+  explicit pooled_buffer (buffer_pool &pool, std::byte *ptr, std::uint32_t index) noexcept : _pool (pool), _ptr (ptr), _index (index)
+  {
+  }
+
+  friend class buffer_pool;
+
+public:
+  ~pooled_buffer (void);
+
+  const std::byte *
+  data (void) const noexcept
+  {
+    return _ptr;
+  }
+
+  std::byte *
+  data (void) noexcept
+  {
+    return _ptr;
+  }
+
+  std::size_t
+  size (void) const noexcept;
+
+  const std::byte *
+  begin (void) const noexcept
+  {
+    return _ptr;
+  }
+
+  std::byte *
+  begin (void) noexcept
+  {
+    return _ptr;
+  }
+
+  const std::byte *
+  end (void) const noexcept
+  {
+    return _ptr + size ();
+  }
+
+  std::byte *
+  end (void) noexcept
+  {
+    return _ptr + size ();
+  }
+};
+
+class buffer_pool: libsh_treis::tools::not_movable
+{
+public:
+  static constexpr int cache_size = 8;
+
+private:
+  std::size_t _buffer_size;
+  std::size_t _buffers_per_slab;
+  std::size_t _slab_size;
+  std::size_t _max_slabs;
+  std::unique_ptr<std::unique_ptr<mapping>[]> _slabs; // Меняется только под _grow_mutex
+  std::unique_ptr<std::atomic<std::byte *>[]> _slab_addresses;
+  std::shared_ptr<detail::buffer_stack> _stack; // Общий стек свободных буферов. На него ссылаются и кэши потоков, поэтому он может пережить пул
+  std::size_t _slab_count; // Меняется только под _grow_mutex
+  std::mutex _grow_mutex;
+
+  std::byte *
+  _address (std::uint32_t index) const noexcept
+  {
+    return _slab_addresses[index / _buffers_per_slab].load (std::memory_order_relaxed) + (index % _buffers_per_slab) * _buffer_size;
+  }
+
+  std::uint32_t
+  _x_grow (void);
+
+  void
+  _release (std::uint32_t index) noexcept;
+
+  friend class pooled_buffer;
+
+public:
+  // alignment - степень двойки, не больше размера страницы
+  explicit buffer_pool (std::size_t buffer_size, std::size_t alignment, std::size_t buffers_per_slab, std::size_t max_slabs);
+
+  ~buffer_pool (void);
+
+  std::size_t
+  buffer_size (void) const noexcept
+  {
+    return _buffer_size;
+  }
+
+  pooled_buffer
+  x_allocate (void);
+};
+
+inline std::size_t
+pooled_buffer::size (void) const noexcept
+{
+  return _pool.buffer_size ();
+}
+}
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/types.h>
+#include <memory>
+namespace libsh_treis::libc
+{
+class getline_buffer: libsh_treis::tools::not_movable
+{
+  char *line;
+  size_t n;
+
+public:
+  getline_buffer (void) noexcept : line (nullptr)
+  {
+  }
+
+  ~getline_buffer (void)
+  {
+    free (line);
+  }
+
+  // Пока в моих задачах мне было нужно лишь следующее:
+  // - getline, а не getdelim
+  // - Проверка на наличие нулевых байтов (внимание! сейчас у меня именно getline, а не getdelim, а значит, delimiter не может быть '\0'; если буду использовать getdelim, подумать об этом)
+  // - Выкидывание завершающего delimiter'а (если в конце файла нет delimiter'а, то не бросаем исключение для совместимости с виндовыми практиками)
+  std::unique_ptr<libsh_treis::tools::cstring_span>
+  getline (FILE *stream)
+  {
+    ssize_t result = libsh_treis::libc::no_raii::x_getline (&line, &n, stream);
+
+    if (result == -1)
+      {
+        return nullptr;
+      }
+
+    if (line[result - 1] == '\n')
+      {
+        line[result - 1] = '\0';
+        --result;
+      }
+
+    return std::make_unique<libsh_treis::tools::cstring_span> (libsh_treis::tools::make_cstring_span (line, result));
+  }
+};
+}
+namespace libsh_treis::libc
+{
+std::string
+x_strftime (const char *format, const tm &tm);
+}
+#include <time.h>
+#include <span>
+namespace libsh_treis::libc::no_raii
+{
+libsh_treis::tools::cstring_span
+x_utc_nanoseconds (std::span<char> s, const char *format, const timespec &spec);
+}
+#include <time.h>
+namespace libsh_treis::libc
+{
+std::string
+utc_nanoseconds (const char *format, const timespec &spec);
+}
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <mutex>
+#include <span>
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+class durable_appender;
+class append_completion
+{
+  durable_appender *_appender;
+  std::uint64_t _seq;
+public:
+  explicit append_completion (durable_appender &appender, std::uint64_t seq) noexcept : _appender (&appender), _seq (seq)
+  {
+  }
+  void
+  x_wait (void) const;
+};
+class durable_appender : libsh_treis::tools::not_movable
+{
+  int _fd;
+  std::chrono::microseconds _batch_window;
+  off_t _write_behind;
+  std::mutex _mutex;
+  std::condition_variable _synced;
+  std::uint64_t _appended;
+  std::uint64_t _durable;
+  bool _syncing;
+  std::exception_ptr _error;
+  off_t _offset;
+  off_t _chunk_begin;
+  off_t _prev_chunk_begin;
+  void
+  _x_write_behind (void);
+  friend class append_completion;
+  void
+  _x_wait (std::uint64_t seq);
+public:
+  explicit durable_appender (int fildes, std::chrono::microseconds batch_window = std::chrono::microseconds (0), off_t write_behind = 8 * 1024 * 1024);
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+  append_completion
+  x_append (std::span<const std::byte> record);
+  // x_append и сразу x_wait
+  void
+  x_append_durable (std::span<const std::byte> record);
+};
+}
+#include <string>
+#include <memory>
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+class atomic_file_writer : libsh_treis::tools::not_movable
+{
+  fd _dir;
+  std::string _name;
+
+  // nullptr, если backup_path не задан
+  std::unique_ptr<fd> _backup_dir;
+  std::string _backup_name;
+  std::unique_ptr<fd> _file;
+
+  // Пусто для O_TMPFILE
+  std::string _temp_name;
+  std::unique_ptr<output_buffer> _out;
+  bool _done;
+
+  void
+  _discard (void) noexcept;
+
+  void
+  _x_link_temp (void);
+
+public:
+  static constexpr std::size_t buffer_size = 256 * 1024;
+
+  explicit atomic_file_writer (const char *path, mode_t mode = 0644, const char *backup_path = nullptr);
+
+  ~atomic_file_writer (void) noexcept;
+
+  output_buffer &
+  output (void) noexcept
+  {
+    return *_out;
+  }
+
+  void
+  x_commit (void);
+};
+}
+#include <cstddef>
+#include <span>
+#include <sys/types.h>
+namespace libsh_treis::libc
+{
+class sequential_scan : libsh_treis::tools::not_movable
+{
+  int _fd;
+  off_t _page;
+  off_t _window;
+  off_t _pos;
+  off_t _advised;
+  off_t _dropped;
+public:
+  explicit sequential_scan (int fildes, off_t offset = 0, off_t window = 8 * 1024 * 1024);
+  int
+  resource (void) const noexcept
+  {
+    return _fd;
+  }
+  off_t
+  position (void) const noexcept
+  {
+    return _pos;
+  }
+  // Как x_read: 0 - конец файла
+  ssize_t
+  x_read (std::span<std::byte> buf);
+};
+}